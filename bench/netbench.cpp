@@ -0,0 +1,508 @@
+//==========================================================================================================
+// netbench.cpp - Loopback micro-benchmarks for NetSock, UDPSock and NetUtil
+//
+// Measures round-trip latency, streaming throughput at several message sizes, connection setup rate
+// and address lookup rate, all over loopback, and writes the results as JSON so that runs can be
+// compared from one commit to the next.
+//
+// Usage: netbench [-o <file.json>] [-rev <git revision>] [-port <base port>] [-iterations <count>]
+//                 [-megabytes <count>] [-connections <count>]
+//
+// Build and run this with "make bench"
+//==========================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "netsock.h"
+#include "udpsock.h"
+#include "netutil.h"
+#include "cthread.h"
+#include "cmd_line.h"
+using namespace std;
+
+// These are the message sizes we measure streaming throughput with
+static const int STREAM_SIZES[] = {64, 512, 4096, 65536};
+static const int STREAM_SIZE_COUNT = sizeof(STREAM_SIZES) / sizeof(STREAM_SIZES[0]);
+
+// This is the size of a ping-pong message
+static const int PING_SIZE = 64;
+
+// Our settings, from the command line
+static int    s_base_port   = 47000;
+static int    s_iterations  = 20000;
+static int    s_megabytes   = 256;
+static int    s_connections = 2000;
+
+// The results are accumulated here, as JSON fragments
+static vector<string> s_results;
+
+
+//==========================================================================================================
+// now_ns() - Returns a monotonic timestamp in nanoseconds
+//==========================================================================================================
+static uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// add_result() - Formats a JSON object and adds it to the results
+//==========================================================================================================
+static void add_result(const char* fmt, ...)
+{
+    char    buffer[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buffer, sizeof buffer, fmt, ap);
+    va_end(ap);
+
+    s_results.push_back(buffer);
+    printf("%s\n", buffer);
+    fflush(stdout);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// report_latency() - Sorts a list of round-trip times and reports its percentiles
+//==========================================================================================================
+static void report_latency(const char* name, vector<uint64_t>& rtt)
+{
+    uint64_t total = 0;
+
+    // If there are no samples, there's nothing to report
+    if (rtt.empty()) return;
+
+    // Sort the samples so we can pick out the percentiles
+    sort(rtt.begin(), rtt.end());
+
+    // Compute the mean
+    for (size_t i=0; i<rtt.size(); ++i) total += rtt[i];
+
+    // And report them, in microseconds
+    add_result("{\"name\": \"%s\", \"size\": %d, \"samples\": %d, \"mean_us\": %.2f, \"p50_us\": %.2f, "
+               "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}",
+               name, PING_SIZE, (int)rtt.size(), total / 1000.0 / rtt.size(),
+               rtt[rtt.size() * 50  / 100 ] / 1000.0,
+               rtt[rtt.size() * 99  / 100 ] / 1000.0,
+               rtt[rtt.size() * 999 / 1000] / 1000.0,
+               rtt.back() / 1000.0);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// TcpEchoServer - Accepts one connection and echoes fixed-size messages back to the client
+//==========================================================================================================
+class TcpEchoServer : public CThread
+{
+public:
+    void main()
+    {
+        char buffer[PING_SIZE];
+        while (m_sock.receive(buffer, PING_SIZE) == PING_SIZE) m_sock.send(buffer, PING_SIZE);
+        m_sock.close();
+    }
+    NetSock m_sock;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bench_tcp_latency() - Measures TCP ping-pong round-trip times
+//==========================================================================================================
+static void bench_tcp_latency()
+{
+    NetSock          server, client;
+    TcpEchoServer    echo;
+    vector<uint64_t> rtt;
+    char             buffer[PING_SIZE];
+
+    // Create the server socket and connect to it
+    if (!server.create_server(s_base_port, "127.0.0.1", AF_INET)) return;
+    server.listen(1);
+    if (!client.connect("127.0.0.1", s_base_port, AF_INET)) return;
+    server.accept(-1, &echo.m_sock);
+    server.close();
+
+    // Round trips should be as quick as possible
+    client.set_nagling(false);
+    echo.m_sock.set_nagling(false);
+
+    // Start the echo server
+    echo.spawn();
+
+    // Time each round trip
+    memset(buffer, 0, sizeof buffer);
+    for (int i=0; i<s_iterations; ++i)
+    {
+        uint64_t start = now_ns();
+        client.send(buffer, PING_SIZE);
+        if (client.receive(buffer, PING_SIZE) != PING_SIZE) break;
+        rtt.push_back(now_ns() - start);
+    }
+
+    // Shut down the echo server
+    client.close();
+    echo.join();
+
+    // And report the results
+    report_latency("tcp_pingpong", rtt);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// UdpEchoServer - Echoes datagrams back to the client until it receives an empty one
+//==========================================================================================================
+class UdpEchoServer : public CThread
+{
+public:
+    void main()
+    {
+        char buffer[PING_SIZE + 1];
+        while (true)
+        {
+            int length = m_receiver.receive(buffer, sizeof buffer);
+            if (length <= 0) break;
+            m_sender.send(buffer, length);
+        }
+    }
+    UDPSock m_receiver, m_sender;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bench_udp_latency() - Measures UDP ping-pong round-trip times
+//==========================================================================================================
+static void bench_udp_latency()
+{
+    UDPSock          receiver, sender;
+    UdpEchoServer    echo;
+    vector<uint64_t> rtt;
+    char             buffer[PING_SIZE + 1];
+    int              port = s_base_port + 1;
+
+    // Each side has a socket to receive on and a socket to send with
+    if (!receiver.create_server(port, "127.0.0.1", AF_INET)) return;
+    if (!echo.m_receiver.create_server(port + 1, "127.0.0.1", AF_INET)) return;
+    if (!sender.create_sender(port + 1, "127.0.0.1", AF_INET)) return;
+    if (!echo.m_sender.create_sender(port, "127.0.0.1", AF_INET)) return;
+
+    // Start the echo server
+    echo.spawn();
+
+    // Time each round trip.  A lost datagram ends the test rather than hanging it
+    memset(buffer, 0, sizeof buffer);
+    for (int i=0; i<s_iterations; ++i)
+    {
+        uint64_t start = now_ns();
+        sender.send(buffer, PING_SIZE);
+        if (!receiver.wait_for_data(1000)) break;
+        receiver.receive(buffer, sizeof buffer);
+        rtt.push_back(now_ns() - start);
+    }
+
+    // Shut down the echo server by sending it an empty datagram
+    sender.send(buffer, 0);
+    echo.join();
+
+    // And report the results
+    report_latency("udp_pingpong", rtt);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// TcpSink - Accepts one connection and reads fixed-size messages until the connection closes
+//==========================================================================================================
+class TcpSink : public CThread
+{
+public:
+    void main()
+    {
+        vector<char> buffer(m_size);
+        while (m_sock.receive(&buffer[0], m_size) == m_size) m_bytes += m_size;
+        m_end = now_ns();
+        m_sock.close();
+    }
+    NetSock  m_sock;
+    int      m_size;
+    uint64_t m_bytes, m_end;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bench_tcp_stream() - Measures TCP throughput with messages of a given size
+//==========================================================================================================
+static void bench_tcp_stream(int size)
+{
+    NetSock server, client;
+    TcpSink sink;
+
+    // Create the server socket and connect to it
+    if (!server.create_server(s_base_port + 3, "127.0.0.1", AF_INET)) return;
+    server.listen(1);
+    if (!client.connect("127.0.0.1", s_base_port + 3, AF_INET)) return;
+    server.accept(-1, &sink.m_sock);
+    server.close();
+
+    // Start the receiver
+    sink.m_size  = size;
+    sink.m_bytes = 0;
+    sink.spawn();
+
+    // This is how many messages we'll send
+    int64_t count = (int64_t)s_megabytes * 1024 * 1024 / size;
+
+    // Send them as fast as we can, then close the connection
+    vector<char> buffer(size, 'x');
+    uint64_t start = now_ns();
+    for (int64_t i=0; i<count; ++i) client.send(&buffer[0], size);
+    client.close();
+
+    // Wait for the receiver to see all of it
+    sink.join();
+
+    // And report the results
+    double seconds = (sink.m_end - start) / 1e9;
+    add_result("{\"name\": \"tcp_stream\", \"size\": %d, \"messages\": %lld, \"seconds\": %.3f, "
+               "\"mbytes_per_sec\": %.1f, \"msgs_per_sec\": %.0f}",
+               size, (long long)count, seconds, sink.m_bytes / seconds / 1e6, sink.m_bytes / size / seconds);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// UdpSink - Counts datagrams until none arrive for a while
+//==========================================================================================================
+class UdpSink : public CThread
+{
+public:
+    void main()
+    {
+        vector<char> buffer(m_size + 1);
+        while (m_sock.wait_for_data(250))
+        {
+            m_sock.receive(&buffer[0], buffer.size());
+            ++m_count;
+            m_end = now_ns();
+        }
+    }
+    UDPSock  m_sock;
+    int      m_size;
+    int64_t  m_count;
+    uint64_t m_end;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bench_udp_stream() - Measures UDP throughput with datagrams of a given size.   Datagrams that the
+//                      receiver can't keep up with are dropped by the kernel, and are reported as lost
+//==========================================================================================================
+static void bench_udp_stream(int size)
+{
+    UDPSock sender;
+    UdpSink sink;
+    int     port = s_base_port + 4;
+
+    // Create the receiving and sending sockets
+    if (!sink.m_sock.create_server(port, "127.0.0.1", AF_INET)) return;
+    if (!sender.create_sender(port, "127.0.0.1", AF_INET)) return;
+
+    // Start the receiver
+    sink.m_size  = size;
+    sink.m_count = 0;
+    sink.m_end   = 0;
+    sink.spawn();
+
+    // This is how many datagrams we'll send
+    int64_t count = (int64_t)s_megabytes * 1024 * 1024 / size / 4;
+
+    // Send them as fast as we can
+    vector<char> buffer(size, 'x');
+    uint64_t start = now_ns();
+    for (int64_t i=0; i<count; ++i) sender.send(&buffer[0], size);
+
+    // Wait for the receiver to stop hearing from us
+    sink.join();
+
+    // And report the results
+    double seconds = (sink.m_end > start) ? (sink.m_end - start) / 1e9 : 1e-9;
+    add_result("{\"name\": \"udp_stream\", \"size\": %d, \"sent\": %lld, \"received\": %lld, \"seconds\": %.3f, "
+               "\"mbytes_per_sec\": %.1f, \"msgs_per_sec\": %.0f}",
+               size, (long long)count, (long long)sink.m_count, seconds,
+               sink.m_count * size / seconds / 1e6, sink.m_count / seconds);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Acceptor - Accepts and immediately closes connections until it is told to stop
+//==========================================================================================================
+class Acceptor : public CThread
+{
+public:
+    void main()
+    {
+        NetSock client;
+        while (!m_is_done)
+        {
+            if (m_server.accept(100, &client)) client.close();
+        }
+    }
+    NetSock       m_server;
+    volatile bool m_is_done;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bench_connect_rate() - Measures how quickly TCP connections can be established and torn down
+//==========================================================================================================
+static void bench_connect_rate()
+{
+    Acceptor acceptor;
+    NetSock  client;
+    int      connected = 0;
+
+    // Create the server socket
+    if (!acceptor.m_server.create_server(s_base_port + 5, "127.0.0.1", AF_INET)) return;
+    acceptor.m_server.listen(1024);
+    acceptor.m_is_done = false;
+    acceptor.spawn();
+
+    // Connect and disconnect as fast as we can
+    uint64_t start = now_ns();
+    for (int i=0; i<s_connections; ++i)
+    {
+        if (client.connect("127.0.0.1", s_base_port + 5, AF_INET)) ++connected;
+        client.close();
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    // Tell the acceptor to finish, and wait for it
+    acceptor.m_is_done = true;
+    acceptor.join();
+    acceptor.m_server.close();
+
+    // And report the results
+    add_result("{\"name\": \"tcp_connect\", \"attempts\": %d, \"connected\": %d, \"seconds\": %.3f, "
+               "\"connects_per_sec\": %.0f}", s_connections, connected, seconds, connected / seconds);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bench_addrinfo() - Measures how quickly NetUtil can look up a numeric address
+//==========================================================================================================
+static void bench_addrinfo()
+{
+    vector<addrinfo_t> list;
+
+    // Look up the same address over and over
+    uint64_t start = now_ns();
+    for (int i=0; i<s_iterations; ++i) NetUtil::get_server_addrinfo(SOCK_STREAM, "127.0.0.1", 80, AF_INET, &list);
+    double seconds = (now_ns() - start) / 1e9;
+
+    // And report the results
+    add_result("{\"name\": \"get_server_addrinfo\", \"lookups\": %d, \"seconds\": %.3f, \"lookups_per_sec\": %.0f}",
+               s_iterations, seconds, s_iterations / seconds);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// write_json() - Writes every result to a JSON file
+//==========================================================================================================
+static bool write_json(string filename, string rev)
+{
+    char hostname[256] = {0};
+
+    // Open the output file
+    FILE* ofile = fopen(filename.c_str(), "w");
+    if (ofile == NULL) return false;
+
+    // Describe the run
+    gethostname(hostname, sizeof hostname - 1);
+    fprintf(ofile, "{\n  \"git_rev\": \"%s\",\n  \"hostname\": \"%s\",\n  \"timestamp\": %ld,\n  \"results\": [\n",
+            rev.c_str(), hostname, (long)time(NULL));
+
+    // Write out each result
+    for (size_t i=0; i<s_results.size(); ++i)
+    {
+        fprintf(ofile, "    %s%s\n", s_results[i].c_str(), (i + 1 < s_results.size()) ? "," : "");
+    }
+
+    // Close out the JSON object
+    fprintf(ofile, "  ]\n}\n");
+    fclose(ofile);
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - Runs every benchmark and writes the results
+//==========================================================================================================
+int main(int argc, char** argv)
+{
+    CCmdLine cmd_line;
+    string   output = "netbench.json", rev = "unknown";
+
+    // Declare our command line switches
+    cmd_line.declare_switch("-o",           CLP_REQUIRED);
+    cmd_line.declare_switch("-rev",         CLP_REQUIRED);
+    cmd_line.declare_switch("-port",        CLP_REQUIRED);
+    cmd_line.declare_switch("-iterations",  CLP_REQUIRED);
+    cmd_line.declare_switch("-megabytes",   CLP_REQUIRED);
+    cmd_line.declare_switch("-connections", CLP_REQUIRED);
+
+    // Parse the command line
+    if (!cmd_line.parse(argc, argv))
+    {
+        fprintf(stderr, "netbench: %s\n", cmd_line.error().c_str());
+        exit(1);
+    }
+
+    // Fetch our settings
+    cmd_line.has_switch("-o",           &output);
+    cmd_line.has_switch("-rev",         &rev);
+    cmd_line.has_switch("-port",        &s_base_port);
+    cmd_line.has_switch("-iterations",  &s_iterations);
+    cmd_line.has_switch("-megabytes",   &s_megabytes);
+    cmd_line.has_switch("-connections", &s_connections);
+
+    // Run the benchmarks
+    bench_tcp_latency();
+    bench_udp_latency();
+    for (int i=0; i<STREAM_SIZE_COUNT; ++i) bench_tcp_stream(STREAM_SIZES[i]);
+    for (int i=0; i<STREAM_SIZE_COUNT; ++i) bench_udp_stream(STREAM_SIZES[i] < 65000 ? STREAM_SIZES[i] : 65000);
+    bench_connect_rate();
+    bench_addrinfo();
+
+    // And write the results
+    if (!write_json(output, rev))
+    {
+        fprintf(stderr, "netbench: can't write %s\n", output.c_str());
+        exit(1);
+    }
+
+    printf("Results written to %s\n", output.c_str());
+    return 0;
+}
+//==========================================================================================================
@@ -105,3 +105,51 @@ bool CANSock::get(can_frame* p_frame, int timeout_ms)
 }
 //==========================================================================================================
 
+
+//==========================================================================================================
+// enable_rx_timestamps() - Turns on (or off) kernel timestamping of arriving messages
+//==========================================================================================================
+bool CANSock::enable_rx_timestamps(bool flag)
+{
+    return m_sd >= 0 && NetUtil::enable_rx_timestamps(m_sd, flag);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get() - Fetches the next available message from the CAN bus, along with the time it arrived
+//
+// Passed:  p_frame    = Where to store the message
+//          timeout_ms = How long to wait for a message.  -1 = Wait forever
+//          p_rx_time  = Receives the time the message arrived.  Zero if rx timestamps aren't turned on
+//
+// Returns: true if a message was fetched
+//==========================================================================================================
+bool CANSock::get(can_frame* p_frame, int timeout_ms, timespec* p_rx_time)
+{
+    char control[256];
+
+    // Wait for data to arrive.   If we timeout, tell the caller
+    if (!NetUtil::wait_for_data(timeout_ms, m_sd)) return false;
+
+    // Describe the caller's frame structure
+    iovec iov;
+    iov.iov_base = p_frame;
+    iov.iov_len  = sizeof(can_frame);
+
+    // Describe the message to recvmsg()
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+
+    // Read the CAN frame from the interface.  If that fails, tell the caller
+    if (recvmsg(m_sd, &msg, 0) < 0) return false;
+
+    // Tell the caller when the frame arrived
+    NetUtil::get_rx_timestamp(&msg, p_rx_time);
+    return true;
+}
+//==========================================================================================================
@@ -4,6 +4,7 @@
 #pragma once
 #include <sys/socket.h>
 #include <linux/can.h>
+#include <time.h>
 #include <string>
 
 /*
@@ -38,6 +39,20 @@ public:
     // Default destructor closes the interface connection
     ~CANSock() {close();}
 
+#if __cplusplus >= 201103L
+    // A socket owns its descriptor, so it can be moved but not copied
+    CANSock(const CANSock& rhs) = delete;
+    CANSock& operator=(const CANSock& rhs) = delete;
+
+    // Move constructor and move assignment.  The object moved from is left closed
+    CANSock(CANSock&& rhs) {m_sd = rhs.m_sd; rhs.m_sd = -1;}
+    CANSock& operator=(CANSock&& rhs)
+    {
+        if (&rhs != this) {close(); m_sd = rhs.m_sd; rhs.m_sd = -1;}
+        return *this;
+    }
+#endif
+
     // Call this to connect to a CAN interface
     bool    connect(std::string interface);
 
@@ -50,6 +65,15 @@ public:
     // Call this to fetch the next message from the CAN bus.  Timeout of -1 means "wait forever"
     bool    get(can_frame* p_frame, int timeout_ms = -1);
 
+    // Call this to have the kernel timestamp arriving messages with nanosecond resolution
+    bool    enable_rx_timestamps(bool flag);
+
+    // Fetches the next message from the CAN bus, along with the time the kernel received it
+    bool    get(can_frame* p_frame, int timeout_ms, timespec* p_rx_time);
+
+    // Returns the socket descriptor
+    int     get_sd() {return m_sd;}
+
 protected:
 
     // The socket descriptor
@@ -0,0 +1,288 @@
+//==========================================================================================================
+// framedsock.cpp - Implements a length-prefixed message framing layer on top of a NetSock
+//==========================================================================================================
+#include <string.h>
+#include "framedsock.h"
+#include "endian_types.h"
+using namespace std;
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+FramedSock::FramedSock(NetSock* sock, bool big_endian)
+{
+    // Use the default limit on frame sizes
+    m_max_frame_size = DEFAULT_MAX_FRAME_SIZE;
+
+    // Attach to the caller's socket
+    attach(sock, big_endian);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// attach() - Attaches this object to a connected socket
+//
+// Passed:  sock       = The socket that frames will be sent and received on
+//          big_endian = true if frame headers are big-endian, false if they're little-endian
+//==========================================================================================================
+void FramedSock::attach(NetSock* sock, bool big_endian)
+{
+    m_sock       = sock;
+    m_big_endian = big_endian;
+
+    // Throw away anything we've received or queued from a previous socket
+    m_rx_head = m_rx_tail = m_rx_delivered = 0;
+    m_tx_frame.clear();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// encode_header() - Stores a frame length into a 4-byte header
+//==========================================================================================================
+void FramedSock::encode_header(unsigned char* header, uint32_t length)
+{
+    if (m_big_endian)
+        ((be_uint32_t*)header)->set(length);
+    else
+        ((le_uint32_t*)header)->set(length);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// decode_header() - Fetches the frame length from a 4-byte header
+//==========================================================================================================
+uint32_t FramedSock::decode_header(unsigned char* header)
+{
+    return m_big_endian ? ((be_uint32_t*)header)->get() : ((le_uint32_t*)header)->get();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// extract_frame() - Checks the receive buffer for a complete frame
+//
+// Returns: 1 = *p_frame and *p_length describe a complete frame
+//          0 = There isn't a complete frame in the buffer
+//         -1 = The frame header describes a frame that is too large
+//==========================================================================================================
+int FramedSock::extract_frame(const void** p_frame, uint32_t* p_length)
+{
+    // Throw away the frame that we handed to the caller last time
+    m_rx_head     += m_rx_delivered;
+    m_rx_delivered = 0;
+
+    // Find out how many bytes are in the receive buffer
+    uint32_t available = m_rx_tail - m_rx_head;
+
+    // If we don't have a complete header yet, there's no frame
+    if (available < 4) return 0;
+
+    // Find out how long this frame is
+    uint32_t length = decode_header(&m_rx[m_rx_head]);
+
+    // If the frame is larger than we're willing to accept, it's a protocol error
+    if (length > m_max_frame_size) return -1;
+
+    // If we don't have the entire frame yet, tell the caller
+    if (available - 4 < length) return 0;
+
+    // Hand the caller a pointer to the frame, right where it sits in our buffer
+    *p_frame  = &m_rx[0] + m_rx_head + 4;
+    *p_length = length;
+
+    // The next call will throw this frame away
+    m_rx_delivered = 4 + length;
+
+    // Tell the caller that a frame is available
+    return 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// prepare_rx_buffer() - Ensures there is room in the receive buffer for the rest of the current frame
+//
+// Returns: The number of bytes that can be stored at m_rx[m_rx_tail]
+//==========================================================================================================
+int FramedSock::prepare_rx_buffer()
+{
+    // If the buffer is empty, start filling it from the front
+    if (m_rx_head == m_rx_tail) m_rx_head = m_rx_tail = 0;
+
+    // We want room for at least a reasonable sized chunk of data
+    size_t needed = RX_CHUNK_SIZE;
+
+    // If we know how long the current frame is, we want room for all of it
+    if (m_rx_tail - m_rx_head >= 4)
+    {
+        size_t frame_size = 4 + (size_t)decode_header(&m_rx[m_rx_head]);
+        if (frame_size > needed) needed = frame_size;
+    }
+
+    // If the current frame won't fit between the head of the buffer and its end, slide it to the front
+    if (m_rx_head + needed > m_rx.size() && m_rx_head > 0)
+    {
+        memmove(&m_rx[0], &m_rx[m_rx_head], m_rx_tail - m_rx_head);
+        m_rx_tail -= m_rx_head;
+        m_rx_head  = 0;
+    }
+
+    // Make sure the buffer is large enough
+    if (m_rx.size() < needed) m_rx.resize(needed);
+
+    // Tell the caller how much free space there is at the end of the buffer
+    return m_rx.size() - m_rx_tail;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_noblock() - Reads whatever data is available and checks for a complete frame
+//
+// Passed:  p_frame  = Receives a pointer to the frame payload.  It remains valid until the next call to
+//                     receive_noblock() or receive()
+//          p_length = Receives the length of the frame payload
+//
+// Returns: 1 = A frame is available
+//          0 = There isn't a complete frame available yet
+//         -1 = The socket was closed, or the peer sent a frame larger than the maximum frame size
+//
+// Note: A single read may bring in several frames, so keep calling this until it returns 0
+//==========================================================================================================
+int FramedSock::receive_noblock(const void** p_frame, uint32_t* p_length)
+{
+    // If there's already a complete frame in the buffer, we don't need to read anything
+    int status = extract_frame(p_frame, p_length);
+    if (status) return status;
+
+    // Make room for more data
+    int room = prepare_rx_buffer();
+
+    // Read as much data as is available without blocking
+    int bytes_rcvd = m_sock->receive_noblock(&m_rx[m_rx_tail], room);
+
+    // If the socket was closed, tell the caller
+    if (bytes_rcvd < 0) return -1;
+
+    // The bytes we just received are now part of the buffer
+    m_rx_tail += bytes_rcvd;
+
+    // Tell the caller whether we now have a complete frame
+    return extract_frame(p_frame, p_length);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive() - Waits for a complete frame to arrive
+//
+// Returns: The same values as receive_noblock(), except that 0 is never returned
+//==========================================================================================================
+int FramedSock::receive(const void** p_frame, uint32_t* p_length)
+{
+    while (true)
+    {
+        // If there's a complete frame in the buffer, hand it to the caller
+        int status = extract_frame(p_frame, p_length);
+        if (status) return status;
+
+        // Make room for more data
+        int room = prepare_rx_buffer();
+
+        // Wait for data to arrive, then read however much is available
+        int bytes_rcvd = m_sock->receive_fragment(&m_rx[m_rx_tail], room);
+
+        // If the socket was closed, tell the caller
+        if (bytes_rcvd < 0) return -1;
+
+        // The bytes we just received are now part of the buffer
+        m_rx_tail += bytes_rcvd;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send() - Sends a single frame, header and payload together in one system call
+//
+// Returns: The number of payload bytes sent, or -1 if an error occured
+//==========================================================================================================
+int FramedSock::send(const void* frame, uint32_t length)
+{
+    unsigned char header[4];
+
+    // Build the frame header
+    encode_header(header, length);
+
+    // Send the header and the payload together
+    int sent = m_sock->sendv(header, sizeof header, frame, length);
+
+    // If we couldn't send the entire frame, tell the caller
+    return (sent == (int)(sizeof header + length)) ? length : -1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// queue() - Queues a frame to be sent by flush().   The payload isn't copied.
+//==========================================================================================================
+void FramedSock::queue(const void* frame, uint32_t length)
+{
+    tx_frame_t entry;
+
+    // Build the frame header and remember where the payload is
+    encode_header(entry.header, length);
+    entry.payload = frame;
+    entry.length  = length;
+
+    // Add this frame to the list of queued frames
+    m_tx_frame.push_back(entry);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// flush() - Sends every queued frame, coalesced into as few system calls as possible
+//
+// Returns: The number of payload bytes sent, or -1 if an error occured
+//==========================================================================================================
+int FramedSock::flush()
+{
+    vector<iovec> iov;
+    int           payload_bytes = 0;
+    iovec         entry;
+
+    // If nothing is queued, there's nothing to do
+    if (m_tx_frame.empty()) return 0;
+
+    // Describe the header and payload of each queued frame
+    for (size_t i=0; i<m_tx_frame.size(); ++i)
+    {
+        entry.iov_base = m_tx_frame[i].header;
+        entry.iov_len  = sizeof m_tx_frame[i].header;
+        iov.push_back(entry);
+
+        entry.iov_base = (void*)m_tx_frame[i].payload;
+        entry.iov_len  = m_tx_frame[i].length;
+        iov.push_back(entry);
+
+        payload_bytes += m_tx_frame[i].length;
+    }
+
+    // Send all of them
+    int sent = m_sock->sendv(&iov[0], iov.size());
+
+    // Find out how many bytes we should have sent
+    int expected = payload_bytes + 4 * m_tx_frame.size();
+
+    // These frames are no longer queued
+    m_tx_frame.clear();
+
+    // If we couldn't send everything, tell the caller
+    return (sent == expected) ? payload_bytes : -1;
+}
+//==========================================================================================================
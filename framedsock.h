@@ -0,0 +1,93 @@
+//==========================================================================================================
+// framedsock.h - Defines a length-prefixed message framing layer on top of a NetSock
+//
+// Every frame on the wire is a 32-bit length (big-endian or little-endian) followed by that many bytes
+// of payload.  Received frames are reassembled in a re-usable buffer and handed to the caller in place,
+// without copying.  Sent frames go out with their header in a single system call, and several small
+// frames can be queued and sent together.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "netsock.h"
+
+class FramedSock
+{
+public:
+
+    // Constructor.  'sock' is the connected socket that frames are sent and received on
+    FramedSock(NetSock* sock = NULL, bool big_endian = true);
+
+    // Call this to attach to a (different) connected socket.  Any partially received data is discarded
+    void    attach(NetSock* sock, bool big_endian = true);
+
+    // Frames with a payload larger than this are treated as a protocol error
+    void    set_max_frame_size(uint32_t max_size) {m_max_frame_size = max_size;}
+
+    // Receives whatever data is available without blocking, and checks for a complete frame.
+    // Returns 1 = A frame is available, 0 = No complete frame yet, -1 = Socket closed or protocol error
+    int     receive_noblock(const void** p_frame, uint32_t* p_length);
+
+    // Blocks until a complete frame is available.  Returns the same values as receive_noblock()
+    int     receive(const void** p_frame, uint32_t* p_length);
+
+    // Sends a single frame.  Returns the number of payload bytes sent, or -1 on error
+    int     send(const void* frame, uint32_t length);
+
+    // Queues a frame to be sent by flush().  The frame isn't copied, and must remain valid until flush()
+    void    queue(const void* frame, uint32_t length);
+
+    // Sends every queued frame with as few system calls as possible.  Returns the number of payload
+    // bytes sent, or -1 on error
+    int     flush();
+
+    // Returns the number of frames waiting to be sent by flush()
+    int     queued() {return m_tx_frame.size();}
+
+protected:
+
+    // The default maximum frame size
+    enum {DEFAULT_MAX_FRAME_SIZE = 16 * 1024 * 1024};
+
+    // The smallest number of bytes we'll ask the socket for at a time
+    enum {RX_CHUNK_SIZE = 16384};
+
+    // Describes a frame that is queued for sending
+    struct tx_frame_t
+    {
+        unsigned char header[4];
+        const void*   payload;
+        uint32_t      length;
+    };
+
+    // Fills in a 4-byte frame header
+    void    encode_header(unsigned char* header, uint32_t length);
+
+    // Decodes a 4-byte frame header
+    uint32_t decode_header(unsigned char* header);
+
+    // Checks the receive buffer for a complete frame
+    int     extract_frame(const void** p_frame, uint32_t* p_length);
+
+    // Makes room in the receive buffer and returns how many bytes can be read into it
+    int     prepare_rx_buffer();
+
+    // The socket we send and receive frames on
+    NetSock* m_sock;
+
+    // True if the frame headers are big-endian, false for little-endian
+    bool    m_big_endian;
+
+    // The largest frame payload we'll accept
+    uint32_t m_max_frame_size;
+
+    // Received data lives in m_rx[m_rx_head] thru m_rx[m_rx_tail - 1]
+    std::vector<unsigned char> m_rx;
+    uint32_t m_rx_head, m_rx_tail;
+
+    // The number of bytes at m_rx_head that belong to the frame we most recently handed to the caller
+    uint32_t m_rx_delivered;
+
+    // The frames that are waiting for flush()
+    std::vector<tx_frame_t> m_tx_frame;
+};
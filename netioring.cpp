@@ -0,0 +1,583 @@
+//==========================================================================================================
+// netioring.cpp - Implements an asynchronous, batched I/O engine for sockets
+//==========================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <algorithm>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "netioring.h"
+#include "netsock.h"
+#include "udpsock.h"
+using namespace std;
+
+//----------------------------------------------------------------------------------------------------------
+// io_uring support requires both the kernel header and the system call numbers
+//----------------------------------------------------------------------------------------------------------
+#if defined(HAVE_IO_URING) && defined(__NR_io_uring_setup)
+    #include <linux/io_uring.h>
+    #define USE_IO_URING 1
+#else
+    #define USE_IO_URING 0
+#endif
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// monotonic_ms() - Returns the time of the monotonic clock in milliseconds
+//==========================================================================================================
+static uint64_t monotonic_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+NetIoRing::NetIoRing()
+{
+    // We don't have an io_uring instance yet
+    m_ring_fd = -1;
+
+    // Nothing is mapped
+    m_sq_ring = m_cq_ring = m_sqes = NULL;
+    m_sq_ring_size = m_cq_ring_size = m_sqes_size = 0;
+
+    // Nothing is queued or in flight
+    m_sq_entries = 0;
+    m_to_submit  = 0;
+    m_in_flight  = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close() - Unmaps the rings and closes the io_uring descriptor
+//==========================================================================================================
+void NetIoRing::close()
+{
+    // Unmap the submission entries
+    if (m_sqes) munmap(m_sqes, m_sqes_size);
+
+    // Unmap the completion ring if it's a separate mapping from the submission ring
+    if (m_cq_ring && m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+
+    // Unmap the submission ring
+    if (m_sq_ring) munmap(m_sq_ring, m_sq_ring_size);
+
+    // Close the io_uring descriptor
+    if (m_ring_fd >= 0) ::close(m_ring_fd);
+
+    // Nothing is open, nothing is mapped
+    m_ring_fd = -1;
+    m_sq_ring = m_cq_ring = m_sqes = NULL;
+    m_to_submit = 0;
+    m_in_flight = 0;
+
+    // Throw away anything that was queued for the fallback path
+    m_queued.clear();
+    m_pending.clear();
+    m_completed.clear();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Creates the io_uring instance, if the kernel supports it
+//
+// Passed:  queue_depth = The number of entries in the submission ring
+//
+// Returns: 'true' if io_uring is in use, 'false' if operations will be performed with ordinary system
+//          calls.  The engine is usable in both cases.
+//==========================================================================================================
+bool NetIoRing::create(int queue_depth)
+{
+    // If we're already open, start over
+    close();
+
+#if USE_IO_URING
+    io_uring_params params;
+
+    // We want the kernel to use its default settings
+    memset(&params, 0, sizeof params);
+
+    // Create the io_uring instance.  If the kernel doesn't allow it, we'll use ordinary system calls
+    m_ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+    if (m_ring_fd < 0) return false;
+
+    // Compute how large each of the shared memory regions are
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_cq_ring_size = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+    m_sqes_size    = params.sq_entries * sizeof(io_uring_sqe);
+
+    // Can the submission and completion rings share a single mapping?
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    // If so, that mapping has to be large enough for both of them
+    if (single_mmap && m_cq_ring_size > m_sq_ring_size) m_sq_ring_size = m_cq_ring_size;
+
+    // Map the submission ring
+    m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED) {m_sq_ring = NULL; close(); return false;}
+
+    // Map the completion ring (or share the submission ring's mapping)
+    if (single_mmap)
+        m_cq_ring = m_sq_ring;
+    else
+    {
+        m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED) {m_cq_ring = NULL; close(); return false;}
+    }
+
+    // Map the array of submission entries
+    m_sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {m_sqes = NULL; close(); return false;}
+
+    // Find the fields of the submission ring
+    char* sq = (char*)m_sq_ring;
+    m_sq_head  = (unsigned int*)(sq + params.sq_off.head);
+    m_sq_tail  = (unsigned int*)(sq + params.sq_off.tail);
+    m_sq_mask  = (unsigned int*)(sq + params.sq_off.ring_mask);
+    m_sq_array = (unsigned int*)(sq + params.sq_off.array);
+
+    // Find the fields of the completion ring
+    char* cq = (char*)m_cq_ring;
+    m_cq_head  = (unsigned int*)(cq + params.cq_off.head);
+    m_cq_tail  = (unsigned int*)(cq + params.cq_off.tail);
+    m_cq_mask  = (unsigned int*)(cq + params.cq_off.ring_mask);
+    m_cqes     = cq + params.cq_off.cqes;
+
+    // Keep track of how many submission entries there are
+    m_sq_entries = params.sq_entries;
+
+    // Tell the caller that io_uring is in use
+    return true;
+#else
+    // We were built without io_uring support, so we'll use ordinary system calls
+    return false;
+#endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// queue() - Queues a single operation
+//
+// Passed:  opcode  = OP_RECV, OP_SEND, OP_RECVMSG or OP_SENDMSG
+//          sd      = The socket descriptor to perform the operation on
+//          buffer  = The data buffer (or the msghdr for OP_RECVMSG/OP_SENDMSG)
+//          length  = The length of the data buffer
+//          context = An arbitrary pointer that will be handed back in the completion
+//
+// Returns: 'true' if the operation was queued
+//==========================================================================================================
+bool NetIoRing::queue(int opcode, int sd, void* buffer, int length, void* context)
+{
+    // Don't queue an operation on an invalid descriptor
+    if (sd < 0) return false;
+
+    // If we're not using io_uring, just remember the operation until submit() is called
+    if (m_ring_fd < 0)
+    {
+        op_t op = {opcode, sd, buffer, length, context};
+        m_queued.push_back(op);
+        return true;
+    }
+
+#if USE_IO_URING
+    // Fetch the current tail of the submission ring.   We're the only one that writes it
+    unsigned int tail = *m_sq_tail;
+
+    // If the submission ring is full, hand what's in it to the kernel to make room
+    __sync_synchronize();
+    if (tail - *m_sq_head >= m_sq_entries && submit() == 0) return false;
+
+    // Find the submission entry that corresponds to the tail of the ring
+    unsigned int  index = tail & *m_sq_mask;
+    io_uring_sqe* sqe   = (io_uring_sqe*)m_sqes + index;
+
+    // Fill in the submission entry
+    memset(sqe, 0, sizeof *sqe);
+    sqe->fd        = sd;
+    sqe->addr      = (unsigned long)buffer;
+    sqe->user_data = (unsigned long)context;
+
+    // Fill in the fields that are specific to this kind of operation
+    switch (opcode)
+    {
+        case OP_RECV:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->len    = length;
+            break;
+
+        case OP_SEND:
+            sqe->opcode    = IORING_OP_SEND;
+            sqe->len       = length;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+
+        case OP_RECVMSG:
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->len    = 1;
+            break;
+
+        case OP_SENDMSG:
+            sqe->opcode    = IORING_OP_SENDMSG;
+            sqe->len       = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+    }
+
+    // Place the entry into the submission ring
+    m_sq_array[index] = index;
+
+    // Make sure the entry is visible to the kernel before the new tail is
+    __sync_synchronize();
+    *m_sq_tail = tail + 1;
+
+    // Keep track of how many entries are waiting to be submitted
+    ++m_to_submit;
+#endif
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// These queue the various types of operation
+//==========================================================================================================
+bool NetIoRing::queue_recv(int sd, void* buffer, int length, void* context)
+{
+    return queue(OP_RECV, sd, buffer, length, context);
+}
+
+bool NetIoRing::queue_send(int sd, const void* buffer, int length, void* context)
+{
+    return queue(OP_SEND, sd, (void*)buffer, length, context);
+}
+
+bool NetIoRing::queue_recvmsg(int sd, msghdr* msg, void* context)
+{
+    return queue(OP_RECVMSG, sd, msg, 0, context);
+}
+
+bool NetIoRing::queue_sendmsg(int sd, const msghdr* msg, void* context)
+{
+    return queue(OP_SENDMSG, sd, (void*)msg, 0, context);
+}
+
+bool NetIoRing::queue_recv(NetSock& sock, void* buffer, int length, void* context)
+{
+    // If the socket has already read data that the caller hasn't seen, that data comes first
+    int count = sock.receive_buffered(buffer, length);
+    if (count > 0)
+    {
+        netio_completion_t completion = {context, count};
+        m_completed.push_back(completion);
+        return true;
+    }
+
+    // Otherwise, receive from the socket itself
+    return queue(OP_RECV, sock.sd(), buffer, length, context);
+}
+
+bool NetIoRing::queue_send(NetSock& sock, const void* buffer, int length, void* context)
+{
+    return queue(OP_SEND, sock.sd(), (void*)buffer, length, context);
+}
+
+bool NetIoRing::queue_recvmsg(UDPSock& sock, msghdr* msg, void* context)
+{
+    return queue(OP_RECVMSG, sock.get_sd(), msg, 0, context);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// submit() - Hands every queued operation to the kernel
+//
+// Returns: The number of operations that were submitted
+//==========================================================================================================
+int NetIoRing::submit()
+{
+    int submitted = 0;
+
+    // If we're not using io_uring, the queued operations are now in flight.  Perform the ones that can
+    // complete without blocking; wait() takes care of the rest
+    if (m_ring_fd < 0)
+    {
+        submitted = m_queued.size();
+        m_pending.insert(m_pending.end(), m_queued.begin(), m_queued.end());
+        m_in_flight += submitted;
+        m_queued.clear();
+        try_pending();
+        return submitted;
+    }
+
+#if USE_IO_URING
+    // Hand the submission entries to the kernel
+    while (m_to_submit)
+    {
+        int rc = syscall(__NR_io_uring_enter, m_ring_fd, m_to_submit, 0, 0, NULL, 0);
+
+        // If we were interrupted by a signal, try again
+        if (rc < 0 && errno == EINTR) continue;
+
+        // If the kernel couldn't accept any entries right now, give up for the moment
+        if (rc <= 0) break;
+
+        // Keep track of how many operations are in flight
+        m_to_submit -= rc;
+        m_in_flight += rc;
+        submitted   += rc;
+    }
+#endif
+
+    // Tell the caller how many operations were submitted
+    return submitted;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// reap() - Copies completions out of the completion ring
+//
+// Returns: The number of completions stored in 'results'
+//==========================================================================================================
+int NetIoRing::reap(netio_completion_t* results, int max_results)
+{
+    int count = 0;
+
+#if USE_IO_URING
+    // Find the head and tail of the completion ring
+    unsigned int head = *m_cq_head;
+    __sync_synchronize();
+    unsigned int tail = *m_cq_tail;
+
+    // Copy out as many completions as the caller has room for
+    while (head != tail && count < max_results)
+    {
+        io_uring_cqe* cqe = (io_uring_cqe*)m_cqes + (head & *m_cq_mask);
+        results[count].context = (void*)(unsigned long)cqe->user_data;
+        results[count].result  = cqe->res;
+        ++count;
+        ++head;
+    }
+
+    // Tell the kernel which completions we've consumed
+    __sync_synchronize();
+    *m_cq_head = head;
+
+    // These operations are no longer in flight
+    m_in_flight -= count;
+#endif
+
+    // Tell the caller how many completions we found
+    return count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait() - Submits queued operations and waits for completions
+//
+// Passed:  results     = Where to store the completions
+//          max_results = The maximum number of completions to store
+//          timeout_ms  = # of milliseconds to wait for a completion.  -1 = Wait forever
+//
+// Returns: The number of completions stored in 'results'.  0 = The timeout expired
+//==========================================================================================================
+int NetIoRing::wait(netio_completion_t* results, int max_results, int timeout_ms)
+{
+    // Make sure everything that's queued has been handed to the kernel
+    submit();
+
+    // If we're not using io_uring, wait for the sockets of pending operations to become ready
+    if (m_ring_fd < 0)
+    {
+        uint64_t deadline = monotonic_ms() + timeout_ms;
+
+        while (m_completed.empty() && !m_pending.empty())
+        {
+            // Find out how long we can wait.  If the timeout has expired, we're done
+            int wait_ms = -1;
+            if (timeout_ms >= 0)
+            {
+                uint64_t now = monotonic_ms();
+                if (now >= deadline) break;
+                wait_ms = deadline - now;
+            }
+
+            // Wait for a socket to become ready, then perform whatever operations can complete
+            poll_pending(wait_ms);
+            try_pending();
+        }
+
+        // Hand the caller whatever completions we have
+        return hand_over(results, max_results);
+    }
+
+    // Completions we produced ourselves (from data a NetSock had already buffered) come first
+    if (!m_completed.empty()) return hand_over(results, max_results);
+
+#if USE_IO_URING
+    // Fetch whatever completions are already available
+    int count = reap(results, max_results);
+
+    // If we found some, or there's nothing that could complete, we're done
+    if (count || m_in_flight == 0) return count;
+
+    // If the completion ring overflowed, the kernel holds completions back until we ask for them
+    syscall(__NR_io_uring_enter, m_ring_fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    count = reap(results, max_results);
+    if (count) return count;
+
+    // Wait forever for at least one completion
+    if (timeout_ms < 0)
+    {
+        while (syscall(__NR_io_uring_enter, m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+        {
+            if (errno != EINTR) return 0;
+        }
+    }
+
+    // Or wait for a finite amount of time.  The io_uring descriptor is readable when completions exist
+    else
+    {
+        pollfd pfd = {m_ring_fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) < 1) return 0;
+    }
+
+    // Hand the caller whatever completions are now available
+    return reap(results, max_results);
+#else
+    return 0;
+#endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// perform() - Performs an operation without blocking
+//
+// Returns: The number of bytes transferred, or a negated errno value
+//==========================================================================================================
+int NetIoRing::perform(const op_t& op)
+{
+    int rc = -1;
+
+    switch (op.opcode)
+    {
+        case OP_RECV:    rc = recv(op.sd, op.buffer, op.length, MSG_DONTWAIT);                    break;
+        case OP_SEND:    rc = ::send(op.sd, op.buffer, op.length, MSG_DONTWAIT | MSG_NOSIGNAL);   break;
+        case OP_RECVMSG: rc = recvmsg(op.sd, (msghdr*)op.buffer, MSG_DONTWAIT);                   break;
+        case OP_SENDMSG: rc = sendmsg(op.sd, (msghdr*)op.buffer, MSG_DONTWAIT | MSG_NOSIGNAL);    break;
+    }
+
+    // Report the result in the same form that io_uring would
+    return (rc < 0) ? -errno : rc;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// try_pending() - Performs every pending operation that can complete without blocking
+//
+// Returns: The number of operations that completed
+//
+// Once an operation on a socket would block, later operations in the same direction on that socket are
+// left alone, so that they complete in the order they were queued
+//==========================================================================================================
+int NetIoRing::try_pending()
+{
+    vector<int> blocked;
+    int         completed = 0;
+
+    for (size_t i=0; i<m_pending.size();)
+    {
+        // Get a handy reference to this operation
+        op_t& op = m_pending[i];
+
+        // Receives and sends on a socket are ordered separately
+        bool is_send = (op.opcode == OP_SEND || op.opcode == OP_SENDMSG);
+        int  key     = op.sd * 2 + is_send;
+
+        // If an earlier operation in this direction on this socket is still waiting, so is this one
+        if (find(blocked.begin(), blocked.end(), key) != blocked.end())
+        {
+            ++i;
+            continue;
+        }
+
+        // Perform the operation.  If we were interrupted by a signal, try again
+        int rc = perform(op);
+        if (rc == -EINTR) continue;
+
+        // If it would have blocked, leave it pending
+        if (rc == -EAGAIN || rc == -EWOULDBLOCK)
+        {
+            blocked.push_back(key);
+            ++i;
+            continue;
+        }
+
+        // Otherwise, it has completed
+        netio_completion_t completion = {op.context, rc};
+        m_completed.push_back(completion);
+        m_pending.erase(m_pending.begin() + i);
+        --m_in_flight;
+        ++completed;
+    }
+
+    // Tell the caller how many operations completed
+    return completed;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// poll_pending() - Waits for the socket of a pending operation to become ready
+//
+// Passed:  timeout_ms = # of milliseconds to wait.  -1 = Wait forever
+//==========================================================================================================
+void NetIoRing::poll_pending(int timeout_ms)
+{
+    vector<pollfd> pfd(m_pending.size());
+
+    // Wait for receives to become readable and sends to become writable
+    for (size_t i=0; i<m_pending.size(); ++i)
+    {
+        bool is_send = (m_pending[i].opcode == OP_SEND || m_pending[i].opcode == OP_SENDMSG);
+        pfd[i].fd      = m_pending[i].sd;
+        pfd[i].events  = is_send ? POLLOUT : POLLIN;
+        pfd[i].revents = 0;
+    }
+
+    // Errors and hang-ups are reported regardless, and are picked up when the operation is performed
+    poll(&pfd[0], pfd.size(), timeout_ms);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// hand_over() - Copies completions from m_completed to the caller
+//
+// Returns: The number of completions stored in 'results'
+//==========================================================================================================
+int NetIoRing::hand_over(netio_completion_t* results, int max_results)
+{
+    int count = (int)m_completed.size() < max_results ? m_completed.size() : max_results;
+    for (int i=0; i<count; ++i) results[i] = m_completed[i];
+    m_completed.erase(m_completed.begin(), m_completed.begin() + count);
+    return count;
+}
+//==========================================================================================================
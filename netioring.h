@@ -0,0 +1,153 @@
+//==========================================================================================================
+// netioring.h - Defines an asynchronous, batched I/O engine for sockets
+//
+// When the kernel supports io_uring, operations are queued in a submission ring and handed to the kernel
+// in batches.  When it doesn't (or the library was built without io_uring support), submit() attempts
+// each queued operation with an ordinary non-blocking system call, and wait() polls the sockets of the
+// operations that couldn't complete yet, so the API behaves the same either way.
+//
+// Buffers (and msghdr structures) handed to the queue_xxx() routines must remain valid until their
+// completion has been returned by wait().
+//==========================================================================================================
+#pragma once
+#include <sys/socket.h>
+#include <vector>
+
+class NetSock;
+class UDPSock;
+
+//==========================================================================================================
+// netio_completion_t - Describes the result of a single completed operation
+//==========================================================================================================
+struct netio_completion_t
+{
+    // This is the context pointer that was passed to queue_xxx()
+    void*   context;
+
+    // The number of bytes transferred, or a negated errno value if the operation failed
+    int     result;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// NetIoRing - Submits batches of socket operations and reaps their completions
+//==========================================================================================================
+class NetIoRing
+{
+public:
+
+    // Constructor and destructor
+    NetIoRing();
+    ~NetIoRing() {close();}
+
+#if __cplusplus >= 201103L
+    // An engine owns its io_uring and the memory mapped for it, so it can't be copied
+    NetIoRing(const NetIoRing& rhs) = delete;
+    NetIoRing& operator=(const NetIoRing& rhs) = delete;
+#endif
+
+    // Call this to create the engine.  Returns 'true' if io_uring is in use, 'false' if we fell back
+    // to ordinary system calls.   Either way, the engine is ready for use
+    bool    create(int queue_depth = 256);
+
+    // Shuts down the engine.  Safe to call if it isn't open
+    void    close();
+
+    // Returns 'true' if operations are being performed by io_uring
+    bool    is_uring() {return m_ring_fd >= 0;}
+
+    // Call these to queue an operation.  'context' is handed back in the completion
+    bool    queue_recv   (int sd, void* buffer, int length, void* context);
+    bool    queue_send   (int sd, const void* buffer, int length, void* context);
+    bool    queue_recvmsg(int sd, msghdr* msg, void* context);
+    bool    queue_sendmsg(int sd, const msghdr* msg, void* context);
+
+    // Convenience overloads for the framework's socket classes
+    bool    queue_recv   (NetSock& sock, void* buffer, int length, void* context);
+    bool    queue_send   (NetSock& sock, const void* buffer, int length, void* context);
+    bool    queue_recvmsg(UDPSock& sock, msghdr* msg, void* context);
+
+    // Hands every queued operation to the kernel.  Returns the number of operations submitted
+    int     submit();
+
+    // Submits any queued operations, then waits for completions.  Returns the number of completions
+    // stored in 'results', which is 0 if the timeout expired.  timeout_ms of -1 means "wait forever"
+    int     wait(netio_completion_t* results, int max_results, int timeout_ms = -1);
+
+    // Returns the number of operations that have been submitted but haven't completed yet
+    int     in_flight() {return m_in_flight;}
+
+protected:
+
+    // These are the kinds of operation we can queue
+    enum {OP_RECV, OP_SEND, OP_RECVMSG, OP_SENDMSG};
+
+    // Describes an operation that is queued when io_uring isn't available
+    struct op_t
+    {
+        int     opcode;
+        int     sd;
+        void*   buffer;
+        int     length;
+        void*   context;
+    };
+
+    // Queues a single operation of any type
+    bool    queue(int opcode, int sd, void* buffer, int length, void* context);
+
+    // Performs an operation without blocking.  Returns its result, or a negated errno value
+    static int perform(const op_t& op);
+
+    // Performs every pending operation that can complete without blocking.  Returns the number completed
+    int     try_pending();
+
+    // Waits up to 'timeout_ms' for the socket of a pending operation to become ready
+    void    poll_pending(int timeout_ms);
+
+    // Copies completions that we produced ourselves (rather than io_uring) to the caller
+    int     hand_over(netio_completion_t* results, int max_results);
+
+    // Copies completions out of the io_uring completion ring
+    int     reap(netio_completion_t* results, int max_results);
+
+    // The io_uring descriptor, or -1 if we're using ordinary system calls
+    int     m_ring_fd;
+
+    // The number of entries in the submission ring
+    unsigned int m_sq_entries;
+
+    // The number of operations that have been queued but not yet submitted
+    unsigned int m_to_submit;
+
+    // The number of operations that have been submitted but not yet reaped
+    int     m_in_flight;
+
+    // These describe the memory mapped submission queue, completion queue and submission entries
+    void*   m_sq_ring;
+    void*   m_cq_ring;
+    void*   m_sqes;
+    size_t  m_sq_ring_size, m_cq_ring_size, m_sqes_size;
+
+    // Pointers to the fields inside the mapped rings
+    volatile unsigned int *m_sq_head, *m_sq_tail, *m_sq_mask, *m_sq_array;
+    volatile unsigned int *m_cq_head, *m_cq_tail, *m_cq_mask;
+    void*   m_cqes;
+
+    // When io_uring isn't available, these are the operations waiting for submit(), and the operations
+    // that were submitted but couldn't complete yet
+    std::vector<op_t>               m_queued;
+    std::vector<op_t>               m_pending;
+
+    // Completions that are waiting to be handed to the caller by wait()
+    std::vector<netio_completion_t> m_completed;
+
+#if __cplusplus < 201103L
+private:
+
+    // An engine owns its io_uring and the memory mapped for it, so it can't be copied.  These are never defined
+    NetIoRing(const NetIoRing& rhs);
+    NetIoRing& operator=(const NetIoRing& rhs);
+#endif
+};
+//==========================================================================================================
@@ -0,0 +1,327 @@
+//==========================================================================================================
+// netreactor.cpp - Implements an epoll based event reactor
+//==========================================================================================================
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <stdexcept>
+#include "netreactor.h"
+#include "netsock.h"
+#include "udpsock.h"
+#include "cansock.h"
+#include "serial_port.h"
+using namespace std;
+
+// We're going to use this as a place to dump unused return values
+static volatile int bit_bucket;
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+NetReactor::NetReactor()
+{
+    // We don't have an epoll instance yet
+    m_epoll_fd = -1;
+    m_wake_fd  = -1;
+
+    // Nothing is registered and nothing is running
+    m_count      = 0;
+    m_max_events = 0;
+    m_is_running = false;
+
+    // Generation 0 belongs to the wake-up descriptor
+    m_next_generation = 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Creates the epoll instance
+//
+// Passed: max_events_per_wakeup = The maximum number of events to fetch from the kernel on each wakeup
+//
+// Throws runtime_error if something goes wrong
+//==========================================================================================================
+void NetReactor::create(int max_events_per_wakeup)
+{
+    // If we're already open, start over from scratch
+    close();
+
+    // Create the epoll instance
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    // If that failed, complain
+    if (m_epoll_fd < 0) throw runtime_error("failure on epoll_create1()");
+
+    // Create the eventfd that stop() uses to wake us up
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    // If that failed, complain
+    if (m_wake_fd < 0) throw runtime_error("failure on eventfd()");
+
+    // Register the wake-up descriptor.  It's the only one whose handler is NULL
+    epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.u64 = make_key(m_wake_fd, 0);
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev) < 0) throw runtime_error("failure on epoll_ctl()");
+
+    // Allocate the buffer that epoll_wait() will fill in
+    m_max_events = (max_events_per_wakeup > 0) ? max_events_per_wakeup : 1;
+    m_events.resize(m_max_events);
+
+    // run() will dispatch events until someone calls stop()
+    m_is_running = true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close() - Closes the epoll instance and forgets about every registered descriptor
+//==========================================================================================================
+void NetReactor::close()
+{
+    if (m_epoll_fd >= 0) ::close(m_epoll_fd);
+    if (m_wake_fd  >= 0) ::close(m_wake_fd);
+    m_epoll_fd = -1;
+    m_wake_fd  = -1;
+    m_count    = 0;
+    m_handler.clear();
+    m_generation.clear();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// to_epoll_events() - Converts our READ/WRITE/EDGE flags to epoll flags
+//==========================================================================================================
+unsigned int NetReactor::to_epoll_events(int events)
+{
+    // We always want to hear about errors and hang-ups
+    unsigned int result = EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+
+    if (events & READ ) result |= EPOLLIN;
+    if (events & WRITE) result |= EPOLLOUT;
+    if (events & EDGE ) result |= EPOLLET;
+
+    return result;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// add() - Registers a descriptor with the reactor
+//
+// Passed:  fd      = The descriptor to watch
+//          events  = Some combination of READ, WRITE and EDGE
+//          handler = The object whose on_readable()/on_writable()/on_error() will be called
+//
+// Returns: true if the descriptor was registered, otherwise false
+//==========================================================================================================
+bool NetReactor::add(int fd, int events, NetReactorHandler* handler)
+{
+    epoll_event ev;
+
+    // Don't register an invalid descriptor or a missing handler
+    if (fd < 0 || handler == NULL) return false;
+
+    // If the reactor isn't created yet, don't even try
+    if (m_epoll_fd < 0) throw runtime_error("add called on non existent reactor");
+
+    // This registration gets a generation of its own.  Generation 0 belongs to the wake-up descriptor
+    uint32_t generation = m_next_generation++;
+    if (m_next_generation == 0) m_next_generation = 1;
+
+    // Tell epoll which events we want to hear about for this descriptor
+    ev.events   = to_epoll_events(events);
+    ev.data.u64 = make_key(fd, generation);
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) return false;
+
+    // Make sure our handler tables are large enough to index by this descriptor
+    if (fd >= (int)m_handler.size())
+    {
+        m_handler.resize(fd + 1, NULL);
+        m_generation.resize(fd + 1, 0);
+    }
+
+    // Remember who services this descriptor, and which registration that is
+    m_handler[fd]    = handler;
+    m_generation[fd] = generation;
+    ++m_count;
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// add() - Convenience overloads for registering the framework's descriptor-owning classes
+//==========================================================================================================
+bool NetReactor::add(NetSock& sock, int events, NetReactorHandler* handler)
+{
+    return add(sock.sd(), events, handler);
+}
+
+bool NetReactor::add(UDPSock& sock, int events, NetReactorHandler* handler)
+{
+    return add(sock.get_sd(), events, handler);
+}
+
+bool NetReactor::add(CANSock& sock, int events, NetReactorHandler* handler)
+{
+    return add(sock.get_sd(), events, handler);
+}
+
+bool NetReactor::add(CSerialPort& port, int events, NetReactorHandler* handler)
+{
+    return add(port.get_fd(), events, handler);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// modify() - Changes the set of events that a registered descriptor is interested in
+//==========================================================================================================
+bool NetReactor::modify(int fd, int events)
+{
+    epoll_event ev;
+
+    // If this descriptor isn't registered, tell the caller
+    if (fd < 0 || fd >= (int)m_handler.size() || m_handler[fd] == NULL) return false;
+
+    // Hand the new set of events to epoll.  The registration keeps its generation
+    ev.events   = to_epoll_events(events);
+    ev.data.u64 = make_key(fd, m_generation[fd]);
+    return epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// remove() - Stops watching a descriptor.
+//
+// This is safe to call from inside a handler:  any events for this descriptor that were returned by the
+// same wakeup will be discarded, even if the descriptor is closed and registered again (perhaps as a
+// different socket) before they are dispatched.   The caller should call this before closing the descriptor.
+//==========================================================================================================
+bool NetReactor::remove(int fd)
+{
+    // If this descriptor isn't registered, tell the caller
+    if (fd < 0 || fd >= (int)m_handler.size() || m_handler[fd] == NULL) return false;
+
+    // Forget about the handler.  Pending events for this descriptor will now be ignored
+    m_handler[fd] = NULL;
+    --m_count;
+
+    // Tell epoll to stop watching this descriptor
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// run_once() - Waits for events and dispatches them to their handlers
+//
+// Passed:  timeout_ms = # of milliseconds to wait for an event.  -1 = Wait forever
+//
+// Returns: The number of descriptors that had events dispatched
+//==========================================================================================================
+int NetReactor::run_once(int timeout_ms)
+{
+    // If the reactor isn't created yet, don't even try
+    if (m_epoll_fd < 0) throw runtime_error("run_once called on non existent reactor");
+
+    // Wait for one or more descriptors to become ready
+    int ready = epoll_wait(m_epoll_fd, &m_events[0], m_max_events, timeout_ms);
+
+    // If we were interrupted by a signal, there's nothing to do
+    if (ready < 0 && errno == EINTR) return 0;
+
+    // If epoll_wait() failed for any other reason, complain
+    if (ready < 0) throw runtime_error("failure on epoll_wait()");
+
+    // This is the number of descriptors we serviced
+    int serviced = 0;
+
+    // Loop through each event that the kernel handed us...
+    for (int i=0; i<ready; ++i)
+    {
+        // Find out which descriptor this is, which registration of it, and what happened to it
+        int          fd         = (int)(m_events[i].data.u64 & 0xFFFFFFFF);
+        uint32_t     generation = (uint32_t)(m_events[i].data.u64 >> 32);
+        unsigned int flags      = m_events[i].events;
+
+        // If this is our wake-up descriptor, drain it and move on
+        if (fd == m_wake_fd)
+        {
+            uint64_t value;
+            bit_bucket = ::read(m_wake_fd, &value, sizeof value);
+            continue;
+        }
+
+        // If this descriptor was removed by an earlier handler during this wakeup, skip it.  If it was
+        // registered again since, this event belongs to the old registration, so skip it too
+        if (!is_current(fd, generation)) continue;
+
+        // Report an error condition
+        if (flags & EPOLLERR)
+        {
+            m_handler[fd]->on_error(fd);
+            if (!is_current(fd, generation)) continue;
+        }
+
+        // A hang-up is reported as "readable" so the handler will see the zero-byte read
+        if (flags & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
+        {
+            m_handler[fd]->on_readable(fd);
+            if (!is_current(fd, generation)) continue;
+        }
+
+        // Report that the descriptor is writable
+        if (flags & EPOLLOUT) m_handler[fd]->on_writable(fd);
+
+        // Keep track of how many descriptors we serviced
+        ++serviced;
+    }
+
+    // Tell the caller how many descriptors we serviced
+    return serviced;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// run() - Dispatches events until someone calls stop()
+//
+// If stop() is called before run() starts, run() returns immediately
+//==========================================================================================================
+void NetReactor::run()
+{
+    // Dispatch events until we're told to stop
+    while (m_is_running) run_once(-1);
+
+    // The next call to run() will dispatch events again
+    m_is_running = true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// stop() - Causes run() to return
+//==========================================================================================================
+void NetReactor::stop()
+{
+    uint64_t one = 1;
+
+    // Tell run() that it's time to quit
+    m_is_running = false;
+
+    // And wake up epoll_wait() in case it's sleeping
+    if (m_wake_fd >= 0) bit_bucket = ::write(m_wake_fd, &one, sizeof one);
+}
+//==========================================================================================================
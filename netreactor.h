@@ -0,0 +1,158 @@
+//==========================================================================================================
+// netreactor.h - Defines an epoll based event reactor for servicing many descriptors from one thread
+//==========================================================================================================
+#pragma once
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <vector>
+
+class NetSock;
+class UDPSock;
+class CANSock;
+class CSerialPort;
+
+//==========================================================================================================
+// NetReactorHandler - Derive from this class to receive events for the descriptors registered with a
+//                     NetReactor.  Each of these routines is called from inside NetReactor::run_once()
+//
+// Note: NetSock::getline() reads ahead into the socket's own receive buffer, and epoll can't see data that
+//       is waiting there.  A handler that reads a NetSock with getline() must keep reading in on_readable()
+//       while the socket's bytes_available() is greater than zero.  Otherwise, lines that have already
+//       arrived sit in the buffer until more data arrives from the peer.  The last line may be incomplete,
+//       so use a deadline of NetSock::deadline(0) and hang on to a partial line that comes back with
+//       RX_TIMEOUT
+//==========================================================================================================
+class NetReactorHandler
+{
+public:
+
+    // All base-classes should have virtual destructors
+    virtual ~NetReactorHandler() {}
+
+    // Called when the descriptor has data available for reading (or a peer has hung up).  See the note
+    // above about NetSock::getline()
+    virtual void on_readable(int fd) {}
+
+    // Called when the descriptor can accept more data for writing
+    virtual void on_writable(int fd) {}
+
+    // Called when an error condition has been reported on the descriptor
+    virtual void on_error(int fd) {}
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// NetReactor - Waits for events on any number of descriptors and dispatches them to handlers.  The cost of
+//              each wakeup is proportional to the number of descriptors that are ready, not the number of
+//              descriptors that are registered
+//==========================================================================================================
+class NetReactor
+{
+public:
+
+    // These are the event flags that can be passed to add() and modify()
+    enum
+    {
+        READ  = 1,
+        WRITE = 2,
+        EDGE  = 4
+    };
+
+    // Constructor and destructor
+    NetReactor();
+    ~NetReactor() {close();}
+
+#if __cplusplus >= 201103L
+    // A reactor owns its epoll and eventfd descriptors, so it can't be copied
+    NetReactor(const NetReactor& rhs) = delete;
+    NetReactor& operator=(const NetReactor& rhs) = delete;
+#endif
+
+    // Call this to create the epoll instance.  Can throw runtime_error
+    void    create(int max_events_per_wakeup = 256);
+
+    // Closes the epoll instance.  Safe to call if the reactor isn't open
+    void    close();
+
+    // Call these to register a descriptor along with the handler that will receive its events
+    bool    add(int fd, int events, NetReactorHandler* handler);
+    bool    add(NetSock&     sock, int events, NetReactorHandler* handler);
+    bool    add(UDPSock&     sock, int events, NetReactorHandler* handler);
+    bool    add(CANSock&     sock, int events, NetReactorHandler* handler);
+    bool    add(CSerialPort& port, int events, NetReactorHandler* handler);
+
+    // Call this to change which events a registered descriptor is interested in
+    bool    modify(int fd, int events);
+
+    // Call this to stop receiving events for a descriptor.  Safe to call from inside a handler
+    bool    remove(int fd);
+
+    // Waits for events and dispatches them.  Returns the number of descriptors that were serviced
+    int     run_once(int timeout_ms = -1);
+
+    // Dispatches events until stop() is called
+    void    run();
+
+    // Causes run() to return.  Safe to call from any thread
+    void    stop();
+
+    // Returns the number of descriptors that are currently registered
+    int     count() {return m_count;}
+
+    // Returns the epoll descriptor
+    int     fd() {return m_epoll_fd;}
+
+protected:
+
+    // Converts our event flags into epoll event flags
+    static unsigned int to_epoll_events(int events);
+
+    // Builds the value we store in epoll_event.data: the descriptor in the low 32 bits and the generation
+    // of its registration in the high 32 bits
+    static uint64_t make_key(int fd, uint32_t generation) {return ((uint64_t)generation << 32) | (uint32_t)fd;}
+
+    // Returns true if 'fd' is registered, and 'generation' is the generation of that registration
+    bool    is_current(int fd, uint32_t generation)
+    {
+        return fd >= 0 && fd < (int)m_handler.size() && m_handler[fd] && m_generation[fd] == generation;
+    }
+
+    // The epoll descriptor
+    int     m_epoll_fd;
+
+    // This is an eventfd that is used to wake the reactor up when stop() is called
+    int     m_wake_fd;
+
+    // This will be false when it's time for run() to return
+    volatile bool m_is_running;
+
+    // The number of descriptors that are currently registered
+    int     m_count;
+
+    // The maximum number of events that we'll fetch on a single wakeup
+    int     m_max_events;
+
+    // This is the buffer that epoll_wait() stores events into
+    std::vector<epoll_event> m_events;
+
+    // This maps a descriptor to the handler that services it
+    std::vector<NetReactorHandler*> m_handler;
+
+    // This maps a descriptor to the generation of its current registration.  Every add() gets a new
+    // generation, so an event that was fetched for an earlier registration of a reused descriptor can be
+    // recognized and thrown away
+    std::vector<uint32_t> m_generation;
+
+    // The generation that the next add() will use
+    uint32_t m_next_generation;
+
+#if __cplusplus < 201103L
+private:
+
+    // A reactor owns its epoll and eventfd descriptors, so it can't be copied.  These are never defined
+    NetReactor(const NetReactor& rhs);
+    NetReactor& operator=(const NetReactor& rhs);
+#endif
+};
+//==========================================================================================================
@@ -0,0 +1,503 @@
+//==========================================================================================================
+// netresolver.cpp - Implements a caching, asynchronous host-name resolver
+//==========================================================================================================
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "netresolver.h"
+#include "mstimer.h"
+using namespace std;
+
+
+//==========================================================================================================
+// resolver_key_t::operator<() - Orders keys so they can be used in a std::map
+//==========================================================================================================
+bool NetResolver::resolver_key_t::operator<(const resolver_key_t& rhs) const
+{
+    if (type   != rhs.type  ) return type   < rhs.type;
+    if (family != rhs.family) return family < rhs.family;
+    return host < rhs.host;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resolver_entry_t constructor - A new entry has never been resolved
+//==========================================================================================================
+NetResolver::resolver_entry_t::resolver_entry_t()
+{
+    is_found   = false;
+    is_pending = false;
+    refresh_at = 0;
+    expires_at = 0;
+    generation = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor
+//
+// Passed:  ttl_ms          = How long a successful lookup is cached
+//          negative_ttl_ms = How long a failed lookup is cached
+//          max_entries     = When the cache grows larger than this, expired entries are thrown away
+//==========================================================================================================
+NetResolver::NetResolver(int ttl_ms, int negative_ttl_ms, int max_entries)
+{
+    // Create our mutex and condition variables
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_work_cond, NULL);
+    pthread_cond_init(&m_done_cond, NULL);
+
+    // The worker thread isn't running yet
+    m_is_running = false;
+
+    // Save our settings.  By default, callers wait as long as it takes
+    m_ttl_ms          = ttl_ms;
+    m_negative_ttl_ms = negative_ttl_ms;
+    m_max_entries     = max_entries;
+    m_timeout_ms      = -1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Destructor - Stops the worker thread
+//==========================================================================================================
+NetResolver::~NetResolver()
+{
+    stop();
+    pthread_cond_destroy(&m_done_cond);
+    pthread_cond_destroy(&m_work_cond);
+    pthread_mutex_destroy(&m_mutex);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_ttl() - Sets how long successful and failed lookups are cached.  Affects future lookups only
+//==========================================================================================================
+void NetResolver::set_ttl(int ttl_ms, int negative_ttl_ms)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_ttl_ms          = ttl_ms;
+    m_negative_ttl_ms = negative_ttl_ms;
+    pthread_mutex_unlock(&m_mutex);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_timeout() - Sets the longest time resolve() waits for the worker thread to resolve a name that
+//                 isn't in the cache.  -1 = Wait forever
+//==========================================================================================================
+void NetResolver::set_timeout(int timeout_ms)
+{
+    pthread_mutex_lock(&m_mutex);
+    m_timeout_ms = timeout_ms;
+    pthread_mutex_unlock(&m_mutex);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// start() - Starts the worker thread
+//
+// Returns: true if the worker thread is running
+//==========================================================================================================
+bool NetResolver::start()
+{
+    // If the worker thread is already running, there's nothing to do
+    if (m_is_running) return true;
+
+    // Spawn the worker thread
+    m_is_running = true;
+    if (spawn() != 0) m_is_running = false;
+
+    // Tell the caller whether it worked
+    return m_is_running;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// stop() - Stops the worker thread and waits for it to exit.  Lookups still work, in the caller's thread
+//==========================================================================================================
+void NetResolver::stop()
+{
+    // If the worker thread isn't running, there's nothing to do
+    if (!m_is_running) return;
+
+    // Tell the worker thread to exit, and wake up anyone waiting on it
+    pthread_mutex_lock(&m_mutex);
+    m_is_running = false;
+    pthread_cond_broadcast(&m_work_cond);
+    pthread_cond_broadcast(&m_done_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    // Wait for the worker thread to exit
+    join();
+
+    // Nothing that was waiting for the worker thread is going to be resolved now
+    pthread_mutex_lock(&m_mutex);
+    m_queue.clear();
+    map<resolver_key_t, resolver_entry_t>::iterator it;
+    for (it = m_cache.begin(); it != m_cache.end(); ++it) it->second.is_pending = false;
+    pthread_mutex_unlock(&m_mutex);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - The worker thread.  Resolves queued entries until stop() is called
+//==========================================================================================================
+void NetResolver::main()
+{
+    vector<addrinfo_t> list;
+
+    pthread_mutex_lock(&m_mutex);
+
+    while (m_is_running)
+    {
+        // If there's nothing to do, wait for something to do
+        if (m_queue.empty())
+        {
+            pthread_cond_wait(&m_work_cond, &m_mutex);
+            continue;
+        }
+
+        // Fetch the next entry to resolve
+        resolver_key_t key = m_queue.front();
+        m_queue.pop_front();
+
+        // Don't hold the lock while we're waiting on the DNS server
+        pthread_mutex_unlock(&m_mutex);
+        bool found = lookup(key, &list);
+        pthread_mutex_lock(&m_mutex);
+
+        // Save the result, and tell anyone waiting on it
+        store(key, found, list);
+        pthread_cond_broadcast(&m_done_cond);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// lookup() - Calls getaddrinfo() and returns every address it finds, with a port number of zero
+//
+// Returns: true if the host resolved to at least one address
+//==========================================================================================================
+bool NetResolver::lookup(const resolver_key_t& key, vector<addrinfo_t>* p_list)
+{
+    struct addrinfo hints, *p_res, *ai;
+    addrinfo_t entry;
+
+    // If we fail, the caller's list will be empty
+    p_list->clear();
+
+    // Tell getaddrinfo about the socket family and type
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = key.family;
+    hints.ai_socktype = key.type;
+
+    // Get information about this host.  The port number gets filled in when the entry is used
+    if (getaddrinfo(key.host.c_str(), NULL, &hints, &p_res) != 0) return false;
+
+    // Save a copy of every result
+    for (ai = p_res; ai; ai = ai->ai_next)
+    {
+        entry = *ai;
+        p_list->push_back(entry);
+    }
+
+    // Free the memory that was allocated by getaddrinfo
+    if (p_res) freeaddrinfo(p_res);
+
+    // Tell the caller whether we found any addresses for this host
+    return !p_list->empty();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// store() - Stores the result of a lookup in the cache.  m_mutex must be locked
+//==========================================================================================================
+void NetResolver::store(const resolver_key_t& key, bool found, const vector<addrinfo_t>& list)
+{
+    uint64_t now = msTimer::millis();
+
+    // Find (or create) the entry for this key
+    resolver_entry_t& entry = m_cache[key];
+
+    // If we found addresses, they're good for the full time-to-live, and get refreshed before then
+    if (found)
+    {
+        entry.addr       = list;
+        entry.is_found   = true;
+        entry.expires_at = now + m_ttl_ms;
+        entry.refresh_at = now + m_ttl_ms - m_ttl_ms / 4;
+    }
+
+    // If the lookup failed, remember that for a while.  If we had addresses from an earlier lookup, we
+    // keep handing those out in the meantime rather than turning a DNS hiccup into an outage
+    else
+    {
+        entry.expires_at = now + m_negative_ttl_ms;
+        entry.refresh_at = entry.expires_at;
+    }
+
+    // This entry is no longer waiting to be resolved, and has changed
+    entry.is_pending = false;
+    ++entry.generation;
+
+    // Don't let the cache grow without bound.  The entry we just stored has to survive, even if it has
+    // already expired (as it has when the time-to-live is zero), because the caller is about to use it
+    if ((int)m_cache.size() > m_max_entries) purge(key);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// queue_lookup() - Hands the worker thread an entry to resolve.  m_mutex must be locked
+//==========================================================================================================
+void NetResolver::queue_lookup(const resolver_key_t& key, resolver_entry_t& entry)
+{
+    // If this entry is already waiting to be resolved, there's nothing to do
+    if (entry.is_pending) return;
+
+    // Add it to the queue and wake up the worker thread
+    entry.is_pending = true;
+    m_queue.push_back(key);
+    pthread_cond_signal(&m_work_cond);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// copy_out() - Copies the addresses in a cache entry to the caller, with the port number filled in
+//
+// Returns: true if the entry has any usable addresses
+//==========================================================================================================
+bool NetResolver::copy_out(const resolver_entry_t& entry, int port, vector<addrinfo_t>* p_list)
+{
+    // If this entry is a cached failure, the caller gets an empty list
+    if (!entry.is_found)
+    {
+        p_list->clear();
+        return false;
+    }
+
+    // Hand the caller a copy of the addresses
+    *p_list = entry.addr;
+
+    // And fill in the port number of each one
+    for (size_t i=0; i<p_list->size(); ++i)
+    {
+        sockaddr_storage& addr = (*p_list)[i].addr;
+        if (addr.ss_family == AF_INET ) ((sockaddr_in* )&addr)->sin_port  = htons(port);
+        if (addr.ss_family == AF_INET6) ((sockaddr_in6*)&addr)->sin6_port = htons(port);
+    }
+
+    // Tell the caller whether there are any addresses
+    return !p_list->empty();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// purge() - Throws away every expired entry that isn't waiting to be resolved.  m_mutex must be locked
+//
+// Passed:  keep = The key of an entry that is never thrown away
+//==========================================================================================================
+void NetResolver::purge(const resolver_key_t& keep)
+{
+    uint64_t now = msTimer::millis();
+    map<resolver_key_t, resolver_entry_t>::iterator it = m_cache.begin();
+    map<resolver_key_t, resolver_entry_t>::iterator kept = m_cache.find(keep);
+
+    while (it != m_cache.end())
+    {
+        if (now >= it->second.expires_at && !it->second.is_pending && it != kept)
+            m_cache.erase(it++);
+        else
+            ++it;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resolve() - Fetches every address for a host, from the cache if possible
+//
+// Passed:  type   = SOCK_STREAM or SOCK_DGRAM
+//          host   = The name or IP address of the host
+//          port   = The port number to fill into each address
+//          family = AF_UNSPEC, AF_INET, or AF_INET6
+//          p_list = Receives the addresses, in the order that getaddrinfo() prefers them
+//
+// Returns: true if the host resolved to at least one address
+//
+// If the worker thread is running and the host isn't cached, this waits for the worker thread for up
+// to the timeout set by set_timeout().  If that expires, addresses from an expired entry are used if
+// there are any.  If the worker thread isn't running, the lookup happens in the caller's thread.
+//==========================================================================================================
+bool NetResolver::resolve(int type, string host, int port, int family, vector<addrinfo_t>* p_list)
+{
+    vector<addrinfo_t> list;
+    bool               is_timed_out = false;
+    timespec           deadline;
+
+    // Build the key that identifies this host
+    resolver_key_t key;
+    key.host   = host;
+    key.type   = type;
+    key.family = family;
+
+    pthread_mutex_lock(&m_mutex);
+
+    // If the caller is only willing to wait so long, figure out when to give up
+    if (m_timeout_ms >= 0)
+    {
+        timeval tv;
+        gettimeofday(&tv, NULL);
+        uint64_t usec    = (uint64_t)tv.tv_usec + (uint64_t)m_timeout_ms * 1000;
+        deadline.tv_sec  = tv.tv_sec + usec / 1000000;
+        deadline.tv_nsec = (usec % 1000000) * 1000;
+    }
+
+    while (true)
+    {
+        uint64_t now = msTimer::millis();
+
+        // Look for this host in the cache
+        map<resolver_key_t, resolver_entry_t>::iterator it = m_cache.find(key);
+
+        // If we have an entry that hasn't expired...
+        if (it != m_cache.end() && now < it->second.expires_at)
+        {
+            resolver_entry_t& entry = it->second;
+
+            // If it's getting old, have the worker thread refresh it in the background
+            if (now >= entry.refresh_at && m_is_running) queue_lookup(key, entry);
+
+            // Hand the caller the cached addresses
+            bool found = copy_out(entry, port, p_list);
+            pthread_mutex_unlock(&m_mutex);
+            return found;
+        }
+
+        // If there's no worker thread, look up the host ourselves, without holding the lock
+        if (!m_is_running)
+        {
+            pthread_mutex_unlock(&m_mutex);
+            bool found = lookup(key, &list);
+            pthread_mutex_lock(&m_mutex);
+
+            // Cache the result and hand it to the caller
+            store(key, found, list);
+            found = copy_out(m_cache[key], port, p_list);
+            pthread_mutex_unlock(&m_mutex);
+            return found;
+        }
+
+        // Find (or create) the entry for this host
+        resolver_entry_t& entry = m_cache[key];
+
+        // If we've waited as long as we're allowed to, use whatever the entry holds, even if it's stale
+        if (is_timed_out)
+        {
+            bool found = copy_out(entry, port, p_list);
+            pthread_mutex_unlock(&m_mutex);
+            return found;
+        }
+
+        // Ask the worker thread to resolve it
+        queue_lookup(key, entry);
+
+        // Wait for the entry to change
+        uint32_t generation = entry.generation;
+        while (m_is_running && !is_timed_out)
+        {
+            // Wait for the worker thread to resolve something
+            if (m_timeout_ms < 0)
+                pthread_cond_wait(&m_done_cond, &m_mutex);
+            else
+                is_timed_out = (pthread_cond_timedwait(&m_done_cond, &m_mutex, &deadline) == ETIMEDOUT);
+
+            // If our entry was thrown away by flush(), go look at it again
+            it = m_cache.find(key);
+            if (it == m_cache.end()) break;
+
+            // If the worker thread has stored a result, hand it to the caller, even if it has already
+            // expired (as it has when the time-to-live is zero).  Otherwise we'd just queue it again
+            if (it->second.generation != generation)
+            {
+                bool found = copy_out(it->second, port, p_list);
+                pthread_mutex_unlock(&m_mutex);
+                return found;
+            }
+        }
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// prefetch() - Starts resolving a host in the background, so that a later resolve() finds it cached
+//==========================================================================================================
+void NetResolver::prefetch(int type, string host, int family)
+{
+    // Build the key that identifies this host
+    resolver_key_t key;
+    key.host   = host;
+    key.type   = type;
+    key.family = family;
+
+    pthread_mutex_lock(&m_mutex);
+
+    // Find (or create) the entry for this host
+    resolver_entry_t& entry = m_cache[key];
+
+    // If the worker thread is running and the entry needs resolving, hand it to the worker thread
+    if (m_is_running && msTimer::millis() >= entry.refresh_at) queue_lookup(key, entry);
+
+    pthread_mutex_unlock(&m_mutex);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// flush() - Throws away every cached entry that isn't waiting to be resolved
+//==========================================================================================================
+void NetResolver::flush()
+{
+    pthread_mutex_lock(&m_mutex);
+
+    map<resolver_key_t, resolver_entry_t>::iterator it = m_cache.begin();
+    while (it != m_cache.end())
+    {
+        if (!it->second.is_pending)
+            m_cache.erase(it++);
+        else
+            ++it;
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// size() - Returns the number of entries in the cache
+//==========================================================================================================
+int NetResolver::size()
+{
+    pthread_mutex_lock(&m_mutex);
+    int count = m_cache.size();
+    pthread_mutex_unlock(&m_mutex);
+    return count;
+}
+//==========================================================================================================
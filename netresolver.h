@@ -0,0 +1,138 @@
+//==========================================================================================================
+// netresolver.h - Defines a caching, asynchronous host-name resolver
+//
+// Lookups are cached with a time-to-live.  Failed lookups are cached too (with a shorter time-to-live)
+// so that a name that doesn't resolve doesn't cost a DNS round trip on every attempt.  Entries that are
+// approaching the end of their time-to-live are refreshed by a worker thread while callers continue to
+// use the cached addresses, so a busy name never makes a caller wait on the DNS server.
+//
+// Every address getaddrinfo() returns is kept, in the order it prefers them, so callers can fail over
+// from one address to the next without resolving the name again.
+//
+// Install one with NetUtil::set_resolver() and NetUtil::get_server_addrinfo() (and everything that uses
+// it, such as NetSock::connect() and UDPSock::create_sender()) will go through the cache.
+//
+// This class is thread-safe.
+//==========================================================================================================
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include "netutil.h"
+#include "cthread.h"
+
+class NetResolver : public CThread
+{
+public:
+
+    // Constructor and destructor
+    NetResolver(int ttl_ms = 60000, int negative_ttl_ms = 5000, int max_entries = 1024);
+    ~NetResolver();
+
+#if __cplusplus >= 201103L
+    // A resolver owns its worker thread, mutex and condition variables, so it can't be copied
+    NetResolver(const NetResolver& rhs) = delete;
+    NetResolver& operator=(const NetResolver& rhs) = delete;
+#endif
+
+    // Call this to change how long successful and failed lookups are cached
+    void    set_ttl(int ttl_ms, int negative_ttl_ms);
+
+    // Call this to limit how long resolve() waits for a name that isn't cached.  -1 = Wait forever
+    void    set_timeout(int timeout_ms);
+
+    // Starts the worker thread.  Without it, lookups that miss the cache run in the caller's thread
+    bool    start();
+
+    // Stops the worker thread and waits for it to exit
+    void    stop();
+
+    // Fetches every address for a host.  Returns false if the host doesn't resolve
+    bool    resolve(int type, std::string host, int port, int family, std::vector<addrinfo_t>* p_list);
+
+    // Starts resolving a host in the background, so a later resolve() finds it in the cache
+    void    prefetch(int type, std::string host, int family);
+
+    // Throws away every cached entry
+    void    flush();
+
+    // Returns the number of cached entries
+    int     size();
+
+protected:
+
+    // This identifies a cache entry
+    struct resolver_key_t
+    {
+        std::string host;
+        int         type;
+        int         family;
+        bool        operator<(const resolver_key_t& rhs) const;
+    };
+
+    // This is a cache entry
+    struct resolver_entry_t
+    {
+        resolver_entry_t();
+
+        // The addresses the host resolves to, with a port number of zero
+        std::vector<addrinfo_t> addr;
+
+        // True if the addresses are usable (i.e., the most recent successful lookup found some)
+        bool        is_found;
+
+        // True if this entry is waiting in the queue for the worker thread
+        bool        is_pending;
+
+        // After 'refresh_at' the worker refreshes the entry.  After 'expires_at', it can't be used
+        uint64_t    refresh_at, expires_at;
+
+        // This is incremented every time the entry is updated
+        uint32_t    generation;
+    };
+
+    // This is the entry point of the worker thread
+    void    main();
+
+    // Calls getaddrinfo() for the host described by 'key'
+    static bool lookup(const resolver_key_t& key, std::vector<addrinfo_t>* p_list);
+
+    // Stores the result of a lookup in the cache.  m_mutex must be locked
+    void    store(const resolver_key_t& key, bool found, const std::vector<addrinfo_t>& list);
+
+    // Hands the worker thread an entry to resolve.  m_mutex must be locked
+    void    queue_lookup(const resolver_key_t& key, resolver_entry_t& entry);
+
+    // Copies an entry's addresses to the caller with the port number filled in
+    static bool copy_out(const resolver_entry_t& entry, int port, std::vector<addrinfo_t>* p_list);
+
+    // Throws away expired entries (other than 'keep') when the cache is too large.  m_mutex must be locked
+    void    purge(const resolver_key_t& keep);
+
+    // Protects every member variable.  The worker waits on m_work_cond, callers wait on m_done_cond
+    pthread_mutex_t m_mutex;
+    pthread_cond_t  m_work_cond, m_done_cond;
+
+    // The cache
+    std::map<resolver_key_t, resolver_entry_t> m_cache;
+
+    // The entries waiting to be resolved by the worker thread
+    std::deque<resolver_key_t> m_queue;
+
+    // True while the worker thread is running
+    bool    m_is_running;
+
+    // Our time-to-live values, the longest a caller waits, and the size at which we purge the cache
+    int     m_ttl_ms, m_negative_ttl_ms, m_timeout_ms, m_max_entries;
+
+#if __cplusplus < 201103L
+private:
+
+    // A resolver owns its worker thread, mutex and condition variables, so it can't be copied.  These are never defined
+    NetResolver(const NetResolver& rhs);
+    NetResolver& operator=(const NetResolver& rhs);
+#endif
+};
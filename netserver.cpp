@@ -0,0 +1,279 @@
+//==========================================================================================================
+// netserver.cpp - Implements a multi-threaded TCP server that shards connections across workers
+//==========================================================================================================
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <stdexcept>
+#include "netserver.h"
+using namespace std;
+
+
+//==========================================================================================================
+// on_readable() - Called by the reactor when connections are waiting on the listening socket, or when the
+//                 retry timer says it's time to start accepting them again
+//==========================================================================================================
+void NetServerListener::on_readable(int fd)
+{
+    if (fd == m_worker->m_retry_fd)
+        m_worker->resume_listener();
+    else
+        m_worker->accept_batch();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+NetServerWorker::NetServerWorker()
+{
+    // We're not pinned to a CPU until told otherwise
+    m_cpu = -1;
+
+    // We don't have a retry timer until create() is called
+    m_retry_fd = -1;
+
+    // Our listener handler needs to know who we are
+    m_listener_handler.m_worker = this;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Creates this worker's listening socket and event loop
+//
+// Passed:  port    = The TCP port number to listen on
+//          bind_to = The IP address of the network card to bind to (optional)
+//          family  = AF_UNSPEC, AF_INET, or AF_INET6
+//          cpu     = The CPU core to pin this worker's thread to.  -1 = Don't pin it
+//
+// Returns: true if the listening socket was created, otherwise false.  On failure, the listening socket
+//          is closed, so that the kernel doesn't route connections to it
+//==========================================================================================================
+bool NetServerWorker::create(int port, string bind_to, int family, int cpu)
+{
+    bool ok;
+
+    // If we were created before, start over
+    close_listener();
+
+    // Remember which CPU core we're supposed to run on
+    m_cpu = cpu;
+
+    // NetReactor and NetSock report some failures by throwing
+    try
+    {
+        // Create our event loop
+        m_reactor.create();
+
+        // Create a listening socket that shares its port with the other workers
+        ok = m_listener.create_server(port, bind_to, family, true);
+
+        // Start listening with the largest backlog the system allows
+        if (ok) m_listener.listen(SOMAXCONN);
+    }
+    catch (const runtime_error&)
+    {
+        ok = false;
+    }
+
+    // accept_batch() relies on accept4() telling us when there are no more connections waiting
+    int sd = m_listener.sd();
+    if (ok) ok = fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK) == 0;
+
+    // Create the timer that tells us when to retry accepting after we run out of descriptors
+    if (ok)
+    {
+        m_retry_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ok = (m_retry_fd >= 0 && m_reactor.add(m_retry_fd, NetReactor::READ, &m_listener_handler));
+    }
+
+    // And have our event loop tell us when connections arrive
+    if (ok) ok = m_reactor.add(sd, NetReactor::READ, &m_listener_handler);
+
+    // If anything failed, don't leave a listening socket open that nobody will accept from
+    if (!ok) close_listener();
+    return ok;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close_listener() - Stops watching the listening socket and closes it, so the kernel no longer routes
+//                    connections to it
+//==========================================================================================================
+void NetServerWorker::close_listener()
+{
+    // Close the listening socket
+    if (m_listener.sd() >= 0) m_reactor.remove(m_listener.sd());
+    m_listener.close();
+
+    // And the retry timer
+    if (m_retry_fd >= 0)
+    {
+        m_reactor.remove(m_retry_fd);
+        ::close(m_retry_fd);
+        m_retry_fd = -1;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - The entry point of the worker's thread
+//==========================================================================================================
+void NetServerWorker::main()
+{
+    // If we're supposed to run on a specific CPU core, pin ourselves to it
+    if (m_cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(m_cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+    }
+
+    // Service our listener and our connections until we're told to stop
+    m_reactor.run();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// accept_batch() - Accepts every connection that is waiting, up to ACCEPT_BATCH of them
+//==========================================================================================================
+void NetServerWorker::accept_batch()
+{
+    for (int i=0; i<ACCEPT_BATCH; ++i)
+    {
+        // Accept a connection, with the new socket already non-blocking and close-on-exec
+        int sd = accept4(m_listener.sd(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        // If we've run out of descriptors, the connection stays queued and the listener stays readable.
+        // Stop watching it for a while, rather than spinning until a descriptor is freed
+        if (sd < 0 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM))
+        {
+            pause_listener();
+            break;
+        }
+
+        // If there are no more connections waiting (or accept failed), we're done for now
+        if (sd < 0) break;
+
+        // Hand the new connection to the derived class
+        on_accept(sd);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// pause_listener() - Stops watching the listening socket, and arms the timer that starts watching it again
+//==========================================================================================================
+void NetServerWorker::pause_listener()
+{
+    itimerspec when = {{0, 0}, {0, 0}};
+
+    // Stop listening for connections.  Any that arrive in the meantime wait in the backlog
+    m_reactor.modify(m_listener.sd(), 0);
+
+    // And have the timer go off once ACCEPT_RETRY_MS from now
+    when.it_value.tv_nsec = ACCEPT_RETRY_MS * 1000000;
+    timerfd_settime(m_retry_fd, 0, &when, NULL);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resume_listener() - Called when the retry timer goes off.  Starts watching the listening socket again
+//==========================================================================================================
+void NetServerWorker::resume_listener()
+{
+    uint64_t expirations;
+
+    // Acknowledge the timer, so it stops being readable
+    if (read(m_retry_fd, &expirations, sizeof expirations) < 0) return;
+
+    // And start accepting connections again
+    m_reactor.modify(m_listener.sd(), NetReactor::READ);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// start() - Creates the listeners and spawns the worker threads
+//
+// Passed:  workers = An array of pointers to workers
+//          count   = The number of entries in 'workers'
+//          port    = The TCP port number to listen on
+//          bind_to = The IP address of the network card to bind to (optional)
+//          family  = AF_UNSPEC, AF_INET, or AF_INET6
+//          pin     = If true, each worker is pinned to one of the CPU cores this process may run on
+//
+// Returns: true if every worker was started, otherwise false
+//==========================================================================================================
+bool NetServer::start(NetServerWorker** workers, int count, int port, string bind_to, int family, bool pin)
+{
+    vector<int> cpus;
+    cpu_set_t   allowed;
+    int         i;
+
+    // Find out which CPU cores this process may run on, so we can spread the workers across them
+    if (pin && sched_getaffinity(0, sizeof allowed, &allowed) == 0)
+    {
+        for (int cpu=0; cpu<CPU_SETSIZE; ++cpu) if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+    }
+
+    // If we couldn't find out, we won't pin the workers
+    if (cpus.empty()) pin = false;
+
+    // Keep track of our workers
+    m_worker.assign(workers, workers + count);
+
+    // Create every listener before spawning any threads, so that a failure leaves nothing running
+    for (i=0; i<count; ++i)
+    {
+        int cpu = pin ? cpus[i % cpus.size()] : -1;
+        if (!m_worker[i]->create(port, bind_to, family, cpu)) break;
+    }
+
+    // If a listener couldn't be created, close the ones that were, or the kernel would keep routing
+    // connections to sockets that nobody will ever accept them from
+    if (i < count)
+    {
+        for (int j=0; j<=i; ++j) m_worker[j]->close_listener();
+        return false;
+    }
+
+    // Spawn the worker threads
+    for (i=0; i<count; ++i) m_worker[i]->spawn();
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// stop() - Tells every worker to stop
+//==========================================================================================================
+void NetServer::stop()
+{
+    for (size_t i=0; i<m_worker.size(); ++i) m_worker[i]->stop();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// join() - Waits for every worker thread to exit
+//==========================================================================================================
+void NetServer::join()
+{
+    for (size_t i=0; i<m_worker.size(); ++i) m_worker[i]->join();
+}
+//==========================================================================================================
@@ -0,0 +1,130 @@
+//==========================================================================================================
+// netserver.h - Defines a multi-threaded TCP server that shards incoming connections across workers
+//
+// Each worker owns its own SO_REUSEPORT listening socket, its own NetReactor event loop and its own
+// thread, optionally pinned to a CPU core.  The kernel distributes incoming connections among the
+// listeners, so accepting and servicing connections scales with the number of workers.
+//
+// To use this, derive a class from NetServerWorker and override on_accept().  A typical on_accept()
+// registers the new connection with reactor() so that the same worker services it from then on.
+//==========================================================================================================
+#pragma once
+#include <string>
+#include <vector>
+#include "cthread.h"
+#include "netsock.h"
+#include "netreactor.h"
+
+class NetServerWorker;
+
+//==========================================================================================================
+// NetServerListener - Services the listening socket on behalf of a NetServerWorker
+//==========================================================================================================
+class NetServerListener : public NetReactorHandler
+{
+public:
+
+    // Called when connections are waiting to be accepted, or when it's time to start accepting them again
+    void    on_readable(int fd);
+
+    // The worker that owns the listening socket
+    NetServerWorker* m_worker;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// NetServerWorker - A thread that owns a listening socket and an event loop
+//==========================================================================================================
+class NetServerWorker : public CThread
+{
+    friend class NetServerListener;
+
+public:
+
+    // Constructor
+    NetServerWorker();
+
+    // Creates this worker's listening socket and event loop.  Returns false (with nothing left open) if
+    // that fails
+    bool    create(int port, std::string bind_to = "", int family = AF_UNSPEC, int cpu = -1);
+
+    // Closes the listening socket created by create().  Only call this while the thread isn't running
+    void    close_listener();
+
+    // Causes the worker's event loop to exit.  Safe to call from any thread
+    void    stop() {m_reactor.stop();}
+
+    // Returns the event loop that this worker's connections should be registered with
+    NetReactor& reactor() {return m_reactor;}
+
+    // Returns the CPU core this worker is pinned to, or -1 if it isn't pinned
+    int     get_cpu() {return m_cpu;}
+
+protected:
+
+    // This is the maximum number of connections we'll accept on a single wakeup
+    enum {ACCEPT_BATCH = 64};
+
+    // When we run out of descriptors, this is how long we stop accepting connections for
+    enum {ACCEPT_RETRY_MS = 100};
+
+    // Called in the worker's thread for each accepted connection.  'sd' is a non-blocking socket
+    // descriptor that the derived class now owns
+    virtual void on_accept(int sd) = 0;
+
+    // This is the entry point of the worker's thread
+    void    main();
+
+    // Accepts every connection that is waiting on the listening socket, up to ACCEPT_BATCH of them
+    void    accept_batch();
+
+    // Stops watching the listening socket for ACCEPT_RETRY_MS, and starts watching it again
+    void    pause_listener();
+    void    resume_listener();
+
+    // Our SO_REUSEPORT listening socket
+    NetSock m_listener;
+
+    // Services m_listener (and m_retry_fd) on our behalf
+    NetServerListener m_listener_handler;
+
+    // A timerfd that tells us when to resume accepting connections after pause_listener()
+    int     m_retry_fd;
+
+    // This worker's event loop
+    NetReactor m_reactor;
+
+    // The CPU core to pin this thread to, or -1
+    int     m_cpu;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// NetServer - Starts and stops a group of NetServerWorker objects that share a single port
+//==========================================================================================================
+class NetServer
+{
+public:
+
+    // Creates a listener for each worker and spawns the worker threads.  If 'pin' is true, each worker is
+    // pinned to its own CPU core
+    bool    start(NetServerWorker** workers, int count, int port, std::string bind_to = "",
+                  int family = AF_UNSPEC, bool pin = true);
+
+    // Tells every worker to stop
+    void    stop();
+
+    // Waits for every worker thread to exit
+    void    join();
+
+    // Returns the number of workers
+    int     count() {return m_worker.size();}
+
+protected:
+
+    // The workers that were handed to start()
+    std::vector<NetServerWorker*> m_worker;
+};
+//==========================================================================================================
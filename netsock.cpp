@@ -6,12 +6,145 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <netinet/tcp.h>
+#include <linux/errqueue.h>
 #include "netsock.h"
 #include "netutil.h"
 using namespace std;
 
+//----------------------------------------------------------------------------------------------------------
+// Older system headers may not define the zero-copy constants
+//----------------------------------------------------------------------------------------------------------
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// stats_clock_us() - Returns a timestamp in microseconds, for measuring how long we wait for data.  It comes
+//                    from the monotonic clock, so a change to the wall-clock time doesn't skew the waits
+//==========================================================================================================
+static uint64_t stats_clock_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// monotonic_ms() - Returns the time of the monotonic clock in milliseconds.  Receive and connect deadlines
+//                  are measured on this clock so that they aren't thrown off when the wall-clock time is
+//                  changed
+//==========================================================================================================
+static uint64_t monotonic_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// make_unix_address() - Builds the address of a Unix-domain socket
+//
+// Passed:  path     = The path of the socket.  A leading '@' names a socket in the abstract namespace
+//          p_addr   = Receives the address
+//          p_length = Receives the length of the address
+//
+// Returns: false if the path is empty or too long
+//==========================================================================================================
+static bool make_unix_address(const string& path, sockaddr_un* p_addr, socklen_t* p_length)
+{
+    // Start out with an empty address
+    memset(p_addr, 0, sizeof *p_addr);
+    p_addr->sun_family = AF_UNIX;
+
+    // If the path won't fit, it can't be used.  (sun_path doesn't need a terminating nul byte)
+    if (path.empty() || path.size() > sizeof p_addr->sun_path) return false;
+
+    // Fill in the path.  An abstract name starts with a nul byte instead of an '@'
+    memcpy(p_addr->sun_path, path.c_str(), path.size());
+    if (path[0] == '@') p_addr->sun_path[0] = 0;
+
+    // The address is as long as the path, which lets abstract names contain any bytes at all
+    *p_length = offsetof(sockaddr_un, sun_path) + path.size();
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// unix_path_to_string() - Returns the path of a Unix-domain socket address.  Abstract names are returned
+//                         with a leading '@', and unnamed sockets are returned as an empty string
+//==========================================================================================================
+static string unix_path_to_string(const sockaddr_un* p_addr, socklen_t length)
+{
+    // Find out how long the path is
+    int path_length = (int)length - (int)offsetof(sockaddr_un, sun_path);
+
+    // If there isn't one, the socket is unnamed
+    if (path_length <= 0) return "";
+
+    // An abstract name starts with a nul byte
+    if (p_addr->sun_path[0] == 0) return "@" + string(p_addr->sun_path + 1, path_length - 1);
+
+    // A filesystem path may or may not include its terminating nul byte
+    return string(p_addr->sun_path, strnlen(p_addr->sun_path, path_length));
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// These are used by connect_all() to race connection attempts against each other
+//==========================================================================================================
+
+// This is how long a connection attempt gets as a head start before we race the next address against it
+static const int ATTEMPT_DELAY_MS = 250;
+
+// Describes the state of the race for a single outbound connection
+struct connect_race_t
+{
+    std::vector<addrinfo_t> addr;
+    size_t      next;
+    uint64_t    last_start;
+    int         in_flight;
+    bool        is_resolved;
+    bool        is_connected;
+};
+
+// Describes a single connection attempt that is in progress
+struct connect_attempt_t
+{
+    int         request;
+    int         sd;
+};
+//==========================================================================================================
+
 
 
 //==========================================================================================================
@@ -24,6 +157,29 @@ NetSock::NetSock()
 
     // This socket has not yet been created
     m_is_created = false;
+
+    // The receive buffer starts out empty
+    m_rx_head = m_rx_tail = 0;
+
+    // Zero-copy sends are off until someone turns them on
+    m_zc_enabled   = false;
+    m_zc_threshold = 16384;
+    m_zc_next_seq  = 0;
+
+    // The send queue starts out empty, with no handler
+    m_tx_queued     = 0;
+    m_tx_low_water  = 256 * 1024;
+    m_tx_high_water = 1024 * 1024;
+    m_tx_congested  = false;
+    m_tx_handler    = NULL;
+
+    // Receive timestamps are off until someone turns them on
+    m_rx_timestamps = false;
+    memset(&m_rx_time, 0, sizeof m_rx_time);
+
+    // Statistics are off until someone turns them on
+    m_stats = NULL;
+    m_rx_wait_counted = false;
 }
 //==========================================================================================================
 
@@ -37,8 +193,119 @@ void NetSock::copy_object(const NetSock& rhs)
     m_is_created = rhs.m_is_created;
     m_error      = rhs.m_error;
     m_error_str  = rhs.m_error_str;
+    m_rx_buf     = rhs.m_rx_buf;
+    m_rx_head    = rhs.m_rx_head;
+    m_rx_tail    = rhs.m_rx_tail;
+
+    // Copy the zero-copy settings.  Pending sends belong to the original object
+    m_zc_enabled   = rhs.m_zc_enabled;
+    m_zc_threshold = rhs.m_zc_threshold;
+    m_zc_next_seq  = rhs.m_zc_next_seq;
+
+    // Copy the send queue watermarks.  Queued data (and the handler) belong to the original object
+    m_tx_queue.clear();
+    m_tx_queued     = 0;
+    m_tx_low_water  = rhs.m_tx_low_water;
+    m_tx_high_water = rhs.m_tx_high_water;
+    m_tx_congested  = false;
+    m_tx_handler    = NULL;
+
+    // Copy the receive-timestamp setting
+    m_rx_timestamps = rhs.m_rx_timestamps;
+    m_rx_time       = rhs.m_rx_time;
+
+    // If the other object is keeping statistics, we get our own copy of them
+    netsock_stats_t* stats = rhs.m_stats ? new netsock_stats_t(*rhs.m_stats) : NULL;
+    delete m_stats;
+    m_stats = stats;
+    m_rx_wait_counted = rhs.m_rx_wait_counted;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// move_object() - Takes ownership of another object's socket, receive buffer, pending zero-copy sends and
+//                 statistics.  Nothing is copied that can be handed over instead, and the other object is
+//                 left closed
+//==========================================================================================================
+void NetSock::move_object(NetSock& rhs)
+{
+    // Moving an object onto itself changes nothing
+    if (&rhs == this) return;
+
+    // Give up whatever socket we already have
+    close();
+
+    // Take over the other object's socket
+    m_sd         = rhs.m_sd;
+    m_is_created = rhs.m_is_created;
+    m_error      = rhs.m_error;
+    m_error_str.swap(rhs.m_error_str);
+
+    // Take over the data it has buffered
+    m_rx_buf.swap(rhs.m_rx_buf);
+    m_rx_head    = rhs.m_rx_head;
+    m_rx_tail    = rhs.m_rx_tail;
+
+    // Take over its zero-copy settings and the sends that are still pending
+    m_zc_enabled   = rhs.m_zc_enabled;
+    m_zc_threshold = rhs.m_zc_threshold;
+    m_zc_next_seq  = rhs.m_zc_next_seq;
+    m_zc_pending.swap(rhs.m_zc_pending);
+
+    // Take over its send queue, its watermarks, and its send queue handler
+    m_tx_queue.swap(rhs.m_tx_queue);
+    m_tx_spare.swap(rhs.m_tx_spare);
+    m_tx_queued     = rhs.m_tx_queued;
+    m_tx_low_water  = rhs.m_tx_low_water;
+    m_tx_high_water = rhs.m_tx_high_water;
+    m_tx_congested  = rhs.m_tx_congested;
+    m_tx_handler    = rhs.m_tx_handler;
+
+    // Take over its receive-timestamp setting
+    m_rx_timestamps = rhs.m_rx_timestamps;
+    m_rx_time       = rhs.m_rx_time;
+
+    // Take over its statistics
+    delete m_stats;
+    m_stats     = rhs.m_stats;
+    rhs.m_stats = NULL;
+    m_rx_wait_counted = rhs.m_rx_wait_counted;
+
+    // The other object no longer owns a socket
+    rhs.m_sd         = -1;
+    rhs.m_is_created = false;
+    rhs.m_rx_head    = rhs.m_rx_tail = 0;
+    rhs.m_zc_enabled = false;
+    rhs.m_zc_next_seq = 0;
+    rhs.m_tx_queued   = 0;
+    rhs.m_tx_congested = false;
+    rhs.m_tx_handler  = NULL;
+    rhs.m_rx_timestamps = false;
+}
+//==========================================================================================================
+
+
+#if __cplusplus >= 201103L
+//==========================================================================================================
+// Move constructor - Takes ownership of another object's socket
+//==========================================================================================================
+NetSock::NetSock(NetSock&& rhs)
+{
+    // We start out without a socket, so that move_object() has nothing to close
+    m_sd = -1;
+    m_rx_head = m_rx_tail = 0;
+    m_tx_queued = 0;
+    m_tx_congested = false;
+    m_rx_timestamps = false;
+    m_stats = NULL;
+    m_rx_wait_counted = false;
+
+    // And take ownership of the other object's socket
+    move_object(rhs);
 }
 //==========================================================================================================
+#endif
 
 
 //==========================================================================================================
@@ -46,8 +313,25 @@ void NetSock::copy_object(const NetSock& rhs)
 //==========================================================================================================
 void NetSock::close()
 {
+    // Give the kernel a chance to finish with the buffers of pending zero-copy sends
+    drain_zerocopy();
+
     if (m_sd >= 0) ::close(m_sd);
     m_sd = -1;
+
+    // Any data that was buffered from this socket is no longer valid
+    m_rx_head = m_rx_tail = 0;
+
+    // A new socket will have zero-copy turned off, and will number its sends from zero
+    m_zc_enabled  = false;
+    m_zc_next_seq = 0;
+
+    // Data that was queued for sending can never be sent now
+    discard_tx_queue();
+
+    // A new socket won't have receive timestamps turned on
+    m_rx_timestamps = false;
+    memset(&m_rx_time, 0, sizeof m_rx_time);
 }
 //==========================================================================================================
 
@@ -59,6 +343,9 @@ bool NetSock::connect(std::string server, int port, int family)
 {
     addrinfo_t info;
 
+    // If this is a Unix-domain socket, 'server' is its path
+    if (family == AF_UNIX) return connect_unix(server);
+
     // The socket is not yet created
     m_is_created = false;
 
@@ -95,19 +382,329 @@ bool NetSock::connect(std::string server, int port, int family)
 
 
 
+//==========================================================================================================
+// connect() - Connects to a server with a deadline, racing every address that the server resolves to
+//
+// Passed:  server     = The name or IP address of the server
+//          port       = The TCP port number to connect to
+//          family     = AF_UNSPEC (race IPv6 and IPv4 addresses), AF_INET, or AF_INET6
+//          timeout_ms = # of milliseconds to wait for a connection.  -1 = Wait forever
+//
+// Returns: true if a connection was established, otherwise false
+//==========================================================================================================
+bool NetSock::connect(string server, int port, int family, int timeout_ms)
+{
+    connect_t request;
+
+    // If this is a Unix-domain socket, 'server' is its path, and it connects (or doesn't) immediately
+    if (family == AF_UNIX) return connect_unix(server);
+
+    // Describe the connection we want to make
+    request.sock   = this;
+    request.server = server;
+    request.port   = port;
+    request.family = family;
+
+    // And make it
+    return connect_all(&request, 1, timeout_ms) == 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// interleave_families() - Re-orders a list of addresses so that the address families alternate, starting
+//                         with the family of the most preferred address
+//==========================================================================================================
+static void interleave_families(vector<addrinfo_t>& list)
+{
+    vector<addrinfo_t> preferred, other, result;
+
+    // If there's nothing to re-order, don't bother
+    if (list.empty()) return;
+
+    // Split the list into the preferred family and everything else, keeping the original order
+    for (size_t i=0; i<list.size(); ++i)
+    {
+        if (list[i].family == list[0].family)
+            preferred.push_back(list[i]);
+        else
+            other.push_back(list[i]);
+    }
+
+    // Merge the two lists back together, alternating between them
+    for (size_t i=0; i<preferred.size() || i<other.size(); ++i)
+    {
+        if (i < preferred.size()) result.push_back(preferred[i]);
+        if (i < other.size())     result.push_back(other[i]);
+    }
+
+    // Hand the caller the re-ordered list
+    list.swap(result);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// connect_all() - Establishes many outbound connections concurrently
+//
+// For each connection, every address the server resolves to is tried using non-blocking sockets.  The
+// first address gets a short head start, then the next address is raced against it, and so on.  The
+// first attempt to succeed wins, and the rest are abandoned.   All of the connections proceed at the
+// same time, bounded by a single deadline.
+//
+// Passed:  list       = An array of connections to make
+//          count      = The number of entries in 'list'
+//          timeout_ms = # of milliseconds to wait for the connections.  -1 = Wait forever
+//
+// Returns: The number of connections that were established.  Each socket that couldn't connect has its
+//          error information set and can be queried with get_error()
+//==========================================================================================================
+int NetSock::connect_all(connect_t* list, int count, int timeout_ms)
+{
+    vector<connect_race_t>    race(count);
+    vector<connect_attempt_t> attempt, pending;
+    vector<pollfd>            pfd;
+    int                       i, connected = 0;
+    bool                      timed_out = false;
+
+    // Compute the time at which we give up
+    uint64_t deadline = monotonic_ms() + timeout_ms;
+
+    // Find the addresses of every server we're supposed to connect to
+    for (i=0; i<count; ++i)
+    {
+        NetSock&        sock = *list[i].sock;
+        connect_race_t& r    = race[i];
+
+        // This socket isn't connected to anything yet
+        sock.m_is_created = false;
+        sock.close();
+
+        // We haven't tried any of the addresses yet
+        r.next         = 0;
+        r.last_start   = 0;
+        r.in_flight    = 0;
+        r.is_connected = false;
+        r.is_resolved  = false;
+
+        // Unix-domain sockets connect (or fail) immediately, so there's nothing to race
+        if (list[i].family == AF_UNIX)
+        {
+            r.is_connected = sock.connect_unix(list[i].server);
+            if (r.is_connected) ++connected;
+            continue;
+        }
+
+        // Fetch the list of addresses for this server
+        r.is_resolved = NetUtil::get_server_addrinfo(SOCK_STREAM, list[i].server, list[i].port, list[i].family, &r.addr);
+
+        // If we can't find any information about that server, record the error
+        if (!r.is_resolved)
+        {
+            sock.m_error_str = "no such server: "+list[i].server;
+            sock.m_error     = NO_SUCH_SERVER;
+            continue;
+        }
+
+        // Alternate between IPv6 and IPv4 addresses so that a broken family can't stall us
+        interleave_families(r.addr);
+    }
+
+    // Loop until every connection is established, every address has failed, or we run out of time
+    while (true)
+    {
+        // Find out what time it is
+        uint64_t now = monotonic_ms();
+
+        // If we've hit the deadline, we're done
+        if (timeout_ms >= 0 && now >= deadline)
+        {
+            timed_out = true;
+            break;
+        }
+
+        // This is how long we can sleep before we need to start another attempt.  -1 = Forever
+        int wait_ms = -1;
+
+        // Start any connection attempts that are due to start
+        for (i=0; i<count; ++i)
+        {
+            connect_race_t& r = race[i];
+
+            // Keep starting attempts while there are untried addresses and the newest attempt has had its head start
+            while (!r.is_connected && r.next < r.addr.size() && (r.in_flight == 0 || now - r.last_start >= ATTEMPT_DELAY_MS))
+            {
+                // Fetch the next address to try
+                addrinfo_t& ai = r.addr[r.next++];
+
+                // Create a non-blocking socket for this address
+                int sd = socket(ai.family, ai.socktype | SOCK_NONBLOCK, ai.protocol);
+                if (sd < 0) continue;
+
+                // Remember when we started this attempt
+                r.last_start = now;
+
+                // Start connecting.  If it connected immediately, this race is over
+                if (::connect(sd, ai, ai.addrlen) == 0)
+                {
+                    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) & ~O_NONBLOCK);
+                    list[i].sock->m_sd = sd;
+                    r.is_connected = true;
+                    ++connected;
+                    break;
+                }
+
+                // If the connection attempt failed outright, move on to the next address
+                if (errno != EINPROGRESS)
+                {
+                    ::close(sd);
+                    continue;
+                }
+
+                // This connection attempt is in progress
+                connect_attempt_t entry = {i, sd};
+                attempt.push_back(entry);
+                ++r.in_flight;
+            }
+
+            // If there are more addresses to try, we need to wake up in time to start the next one
+            if (!r.is_connected && r.next < r.addr.size() && r.in_flight)
+            {
+                int until_next = (int)(r.last_start + ATTEMPT_DELAY_MS - now);
+                if (wait_ms < 0 || until_next < wait_ms) wait_ms = until_next;
+            }
+        }
+
+        // Throw away any attempts that belong to a race that has already been won
+        pending.clear();
+        for (size_t j=0; j<attempt.size(); ++j)
+        {
+            if (race[attempt[j].request].is_connected)
+                ::close(attempt[j].sd);
+            else
+                pending.push_back(attempt[j]);
+        }
+        attempt.swap(pending);
+
+        // If nothing is in progress, every race has either been won or has run out of addresses
+        if (attempt.empty()) break;
+
+        // Don't sleep past the deadline
+        if (timeout_ms >= 0)
+        {
+            int until_deadline = (int)(deadline - now);
+            if (wait_ms < 0 || until_deadline < wait_ms) wait_ms = until_deadline;
+        }
+
+        // Build the list of sockets we're waiting on
+        pfd.resize(attempt.size());
+        for (size_t j=0; j<attempt.size(); ++j)
+        {
+            pfd[j].fd      = attempt[j].sd;
+            pfd[j].events  = POLLOUT;
+            pfd[j].revents = 0;
+        }
+
+        // Wait for one or more connection attempts to finish
+        if (poll(&pfd[0], pfd.size(), wait_ms) < 1) continue;
+
+        // Loop through each connection attempt...
+        pending.clear();
+        for (size_t j=0; j<attempt.size(); ++j)
+        {
+            connect_attempt_t& a = attempt[j];
+            connect_race_t&    r = race[a.request];
+
+            // If this attempt is still in progress, keep waiting on it
+            if (pfd[j].revents == 0)
+            {
+                pending.push_back(a);
+                continue;
+            }
+
+            // This attempt is no longer in progress
+            --r.in_flight;
+
+            // If another attempt already won this race, this one is no longer needed
+            if (r.is_connected)
+            {
+                ::close(a.sd);
+                continue;
+            }
+
+            // Find out whether the connection succeeded
+            int       error = 0;
+            socklen_t len   = sizeof error;
+            if (getsockopt(a.sd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) error = errno;
+
+            // If it failed, the next address can be tried immediately
+            if (error)
+            {
+                ::close(a.sd);
+                r.last_start = 0;
+                continue;
+            }
+
+            // This attempt won the race.  Make it a normal blocking socket and hand it to the caller
+            fcntl(a.sd, F_SETFL, fcntl(a.sd, F_GETFL) & ~O_NONBLOCK);
+            list[a.request].sock->m_sd = a.sd;
+            r.is_connected = true;
+            ++connected;
+        }
+        attempt.swap(pending);
+    }
+
+    // Abandon any attempts that are still in progress
+    for (size_t j=0; j<attempt.size(); ++j) ::close(attempt[j].sd);
+
+    // Record the error for every connection that didn't succeed
+    for (i=0; i<count; ++i)
+    {
+        connect_race_t& r    = race[i];
+        NetSock&        sock = *list[i].sock;
+
+        // If this one connected, or the server didn't exist, there's nothing to record
+        if (r.is_connected || !r.is_resolved) continue;
+
+        // Did we run out of time, or run out of addresses?
+        if (timed_out && (r.in_flight || r.next < r.addr.size()))
+        {
+            sock.m_error_str = "timeout connecting to "+list[i].server;
+            sock.m_error     = CONNECT_TIMEOUT;
+        }
+        else
+        {
+            sock.m_error_str = "can't connect to "+list[i].server;
+            sock.m_error     = CANT_CONNECT;
+        }
+    }
+
+    // Tell the caller how many connections were established
+    return connected;
+}
+//==========================================================================================================
+
+
+
 //==========================================================================================================
 // create_server() - Creates a server socket
 //
-// Passed:  port    = The TCP port number to create the socket on
-//          bind_to = The IP address of the network card to bind to (optional)
-//          family  = AF_UNSPEC, AF_INET, or AF_INET6
+// Passed:  port       = The TCP port number to create the socket on
+//          bind_to    = The IP address of the network card to bind to (optional).  For AF_UNIX, this is
+//                       the path of the socket, and 'port' is ignored
+//          family     = AF_UNSPEC, AF_INET, AF_INET6, or AF_UNIX
+//          reuse_port = If true, other sockets may bind to the same port with SO_REUSEPORT and the
+//                       kernel will distribute incoming connections among them
 //
 // Returns: 'true'  = The server socket was created succesfully.
 //          'false' = The call to "bind" failed, typically because another socket is already
 //                    bound to that port.
 //==========================================================================================================
-bool NetSock::create_server(int port, string bind_to, int family)
+bool NetSock::create_server(int port, string bind_to, int family, bool reuse_port)
 {
+    // If this is a Unix-domain socket, 'bind_to' is its path
+    if (family == AF_UNIX) return create_unix_server(bind_to);
+
     // The socket is not yet created
     m_is_created = false;
 
@@ -130,6 +727,9 @@ bool NetSock::create_server(int port, string bind_to, int family)
     int optval = 1;
     setsockopt(m_sd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
 
+    // If the caller wants to share this port with other listeners, tell the kernel
+    if (reuse_port) setsockopt(m_sd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof optval);
+
     // Bind it to the port we passed in to getaddrinfo():
     if (bind(m_sd, server, server.addrlen) < 0)
     {
@@ -148,6 +748,127 @@ bool NetSock::create_server(int port, string bind_to, int family)
 //==========================================================================================================
 
 
+//==========================================================================================================
+// create_unix_server() - Creates a Unix-domain server socket
+//
+// Passed:  path = The filesystem path of the socket, or '@' followed by a name in the abstract namespace
+//          type = SOCK_STREAM or SOCK_SEQPACKET
+//
+// If a filesystem socket with that path already exists but nobody is listening on it (i.e., it was left
+// behind by a process that exited), it is removed and replaced.
+//
+// Returns: 'true'  = The server socket was created succesfully.
+//          'false' = The call to "bind" failed, typically because another server is using that path
+//==========================================================================================================
+bool NetSock::create_unix_server(string path, int type)
+{
+    sockaddr_un addr;
+    socklen_t   addr_len;
+
+    // The socket is not yet created
+    m_is_created = false;
+
+    // Close this socket if it happens to be open
+    close();
+
+    // Build the address of the socket
+    if (!make_unix_address(path, &addr, &addr_len))
+    {
+        m_error_str = "invalid unix socket path: "+path;
+        m_error     = BIND_FAILED;
+        return false;
+    }
+
+    // Create the socket
+    m_sd = socket(AF_UNIX, type, 0);
+
+    // If the socket() call fails, complain
+    if (m_sd < 0) throw runtime_error("failure on socket()");
+
+    // Bind the socket to its path
+    int status = bind(m_sd, (sockaddr*)&addr, addr_len);
+
+    // If a filesystem socket with this path already exists, find out whether anyone is using it
+    if (status < 0 && errno == EADDRINUSE && path[0] != '@')
+    {
+        int  probe  = socket(AF_UNIX, type, 0);
+        bool in_use = (probe < 0 || ::connect(probe, (sockaddr*)&addr, addr_len) == 0 || errno != ECONNREFUSED);
+        if (probe >= 0) ::close(probe);
+
+        // If nobody is listening on it, it's stale.  Replace it
+        if (!in_use)
+        {
+            unlink(path.c_str());
+            status = bind(m_sd, (sockaddr*)&addr, addr_len);
+        }
+    }
+
+    // If we couldn't bind the socket to its path, tell the caller
+    if (status < 0)
+    {
+        m_error_str = "failure on bind()";
+        m_error     = BIND_FAILED;
+        close();
+        return false;
+    }
+
+    // This socket has been created
+    m_is_created = true;
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// connect_unix() - Creates a Unix-domain socket and connects it to a server on this machine
+//
+// Passed:  path = The filesystem path of the server's socket, or '@' followed by an abstract name
+//          type = SOCK_STREAM or SOCK_SEQPACKET
+//
+// Returns: true if the connection was established, otherwise false
+//==========================================================================================================
+bool NetSock::connect_unix(string path, int type)
+{
+    sockaddr_un addr;
+    socklen_t   addr_len;
+
+    // The socket is not yet created
+    m_is_created = false;
+
+    // Close this socket if it happens to be open
+    close();
+
+    // Build the address of the server's socket
+    if (!make_unix_address(path, &addr, &addr_len))
+    {
+        m_error_str = "invalid unix socket path: "+path;
+        m_error     = NO_SUCH_SERVER;
+        return false;
+    }
+
+    // Create the socket
+    m_sd = socket(AF_UNIX, type, 0);
+
+    // If the socket() call fails, complain
+    if (m_sd < 0) throw runtime_error("failure on socket()");
+
+    // Attempt to connect to the server
+    if (::connect(m_sd, (sockaddr*)&addr, addr_len) < 0)
+    {
+        m_error_str = "can't connect to "+path;
+        m_error     = CANT_CONNECT;
+        close();
+        return false;
+    }
+
+    // If we get here, we have a connected socket
+    return true;
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // listen() - Starts listening for connections on a server socket.   
 //
@@ -189,11 +910,26 @@ bool NetSock::accept(int timeout_ms, NetSock* dest_sock)
     // If accept() failed, tell the caller
     if (new_sd < 0) throw runtime_error("failure on accept()");
 
-    // If the caller passed us a socket object to clone ourselves into...
+    // If the caller passed us a socket object to hand the new connection to...
     if (dest_sock)
     {
-        *dest_sock = *this;
-        dest_sock->m_sd = new_sd;
+        // Close whatever that object had open.  Its receive buffer is kept for re-use
+        dest_sock->close();
+
+        // The new connection inherits our settings, but none of our state
+        dest_sock->m_sd           = new_sd;
+        dest_sock->m_is_created   = m_is_created;
+        dest_sock->m_zc_enabled   = m_zc_enabled;
+        dest_sock->m_zc_threshold = m_zc_threshold;
+        dest_sock->set_watermarks(m_tx_low_water, m_tx_high_water);
+
+        // The kernel copies SO_TIMESTAMPNS from the listening socket to the new one
+        dest_sock->m_rx_timestamps = m_rx_timestamps;
+
+        // If we're keeping statistics, so does the new connection.  (Statistics the caller turned on for
+        // it stay on.)  Either way, the new connection starts with empty statistics
+        if (m_stats) dest_sock->enable_stats(true);
+        dest_sock->reset_stats();
     }
 
     // Otherwise, the new socket-descriptor is the one we'll read and write on
@@ -210,12 +946,31 @@ bool NetSock::accept(int timeout_ms, NetSock* dest_sock)
 
 
 
+#if __cplusplus >= 201103L
 //==========================================================================================================
-// listen_and_accept() - Convience method for waiting for a single incoming connection
-// 
+// accept_connection() - Waits for someone to connect to a server socket and returns the new connection
+//                       by value, so connections can be stored directly in containers
+//
 // Passed: timeout_ms = # of milliseconds to wait for incoming connection.  -1 = Wait forever
 //
-// Returns: true if a client connected to our server, otherwise false
+// Returns: The new connection.  If nobody connected before the timeout expired, it isn't open
+//==========================================================================================================
+NetSock NetSock::accept_connection(int timeout_ms)
+{
+    NetSock new_sock;
+    accept(timeout_ms, &new_sock);
+    return new_sock;
+}
+//==========================================================================================================
+#endif
+
+
+//==========================================================================================================
+// listen_and_accept() - Convience method for waiting for a single incoming connection
+// 
+// Passed: timeout_ms = # of milliseconds to wait for incoming connection.  -1 = Wait forever
+//
+// Returns: true if a client connected to our server, otherwise false
 //==========================================================================================================
 bool NetSock::listen_and_accept(int timeout_ms)
 {
@@ -242,6 +997,9 @@ string NetSock::get_peer_address()
     // Fetch the IP address of the machine on the other side of the socket
     if (getpeername(m_sd, p_peer, &addr_size) < 0) return "unknown";
 
+    // If this is a Unix-domain socket, hand the caller the path of the peer
+    if (peer_addr.ss_family == AF_UNIX) return unix_path_to_string((sockaddr_un*)p_peer, addr_size);
+
     // Hand the caller the IP address    
     return NetUtil::ip_to_string(p_peer);
 }
@@ -270,7 +1028,20 @@ void NetSock::set_nagling(bool flag)
 //==========================================================================================================
 bool NetSock::wait_for_data(int timeout_ms)
 {
-    return NetUtil::wait_for_data(timeout_ms, m_sd);
+    // If there's data already waiting in our receive buffer, there's no need to wait
+    if (rx_buffered()) return true;
+
+    // If we're not keeping statistics, just wait for data to arrive on the socket
+    if (m_stats == NULL) return NetUtil::wait_for_data(timeout_ms, m_sd);
+
+    // Otherwise, wait for data to arrive and keep track of how long we waited
+    uint64_t wait_start_us = stats_clock_us();
+    bool     is_ready      = NetUtil::wait_for_data(timeout_ms, m_sd);
+    count_rx_wait(wait_start_us);
+
+    // If data arrived, the read that fetches it won't be counted as a second wait
+    m_rx_wait_counted = is_ready;
+    return is_ready;
 }
 //==========================================================================================================
 
@@ -282,7 +1053,44 @@ int NetSock::bytes_available()
 {
     int count = 0;
     ioctl(m_sd, FIONREAD, &count);
-    return count;
+    return count + rx_buffered();
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// is_alive() - Checks whether the socket is still connected to its peer, without blocking and without
+//              removing any data from the socket
+//
+// Passed:  p_has_unread_data = If not NULL, this is set to true when there is data waiting to be read
+//
+// Returns: false if the socket isn't open or the peer has closed it, otherwise true
+//==========================================================================================================
+bool NetSock::is_alive(bool* p_has_unread_data)
+{
+    char c;
+
+    // Assume for the moment that there is no data waiting
+    if (p_has_unread_data) *p_has_unread_data = false;
+
+    // If the socket isn't open, it certainly isn't alive
+    if (m_sd < 0) return false;
+
+    // Peek at the socket to see what state it's in
+    int rc = recv(m_sd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    // If there's data waiting (either in the socket or in our receive buffer), tell the caller
+    if (p_has_unread_data) *p_has_unread_data = (rc > 0 || rx_buffered() > 0);
+
+    // If the peer has sent us data, it's alive
+    if (rc > 0) return true;
+
+    // If there's simply nothing to read right now, it's alive
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+
+    // Otherwise the peer closed the socket or the socket is in an error state
+    return false;
 }
 //==========================================================================================================
 
@@ -304,20 +1112,42 @@ int NetSock::receive(void* buffer, int length, bool peek)
     // Don't attempt to recv zero bytes
     if (length == 0) return 0;
 
-    // This is the set of flags that we're going to pass to recv
-    int flags = peek ?  MSG_PEEK : 0;
+    // If we're peeking, the data has to stay in our receive buffer after we hand a copy to the caller
+    if (peek)
+    {
+        // Keep reading from the socket until our receive buffer holds as much data as the caller wants
+        while (rx_buffered() < length)
+        {
+            // Fetch some bytes from the socket
+            int bytes_rcvd = fill_rx_buffer(0, length);
+
+            // If the read failed, tell the caller
+            if (bytes_rcvd < 0) return -1;
+
+            // If the socket is closed, tell the caller
+            if (bytes_rcvd == 0) return 0;
+        }
+
+        // Hand the caller a copy of the data without removing it from the buffer
+        memcpy(buffer, &m_rx_buf[m_rx_head], length);
+        return length;
+    }
 
     // Get a byte-pointer to the caller's buffer
     unsigned char* ptr = (unsigned char*)buffer;
 
+    // Anything that is already in our receive buffer gets handed to the caller first
+    int bytes_buffered = drain_rx_buffer(ptr, length);
+
     // Keep track of how many bytes we have left to read
-    int bytes_remaining = length;
+    int bytes_remaining = length - bytes_buffered;
+    ptr += bytes_buffered;
 
     // Loop until there are no more bytes to read...
     while (bytes_remaining)
     {
         // Fetch some bytes from the socket
-        int bytes_rcvd = recv(m_sd, ptr, bytes_remaining, flags);
+        int bytes_rcvd = sys_recv(ptr, bytes_remaining, 0);
 
         // If the read failed, tell the caller
         if (bytes_rcvd < 0) return -1;
@@ -349,9 +1179,11 @@ int NetSock::receive(void* buffer, int length, bool peek)
 //==========================================================================================================
 int NetSock::receive_fragment(void* buffer, size_t bufsize)
 {
+    // If there's data waiting in our receive buffer, hand the caller that instead of calling recv()
+    if (rx_buffered() && bufsize) return drain_rx_buffer(buffer, bufsize);
 
     // Fetch some bytes from the socket
-    int bytes_rcvd = recv(m_sd, buffer, bufsize, 0);
+    int bytes_rcvd = sys_recv(buffer, bufsize, 0);
 
     // Return either the number of bytes received, or -1 to signal "socket was closed"
     return (bytes_rcvd < 1) ? -1 : bytes_rcvd;
@@ -374,26 +1206,267 @@ int NetSock::receive_noblock(void* buffer, int length)
     // Don't attempt to recv zero bytes
     if (length == 0) return 0;
 
+    // Anything that is already in our receive buffer gets handed to the caller first
+    int bytes_buffered = drain_rx_buffer(buffer, length);
+
+    // If that satisfied the caller, we're done
+    if (bytes_buffered == length) return length;
+
     // Fetch as many bytes from the socket as we can
-    int bytes_rcvd = recv(m_sd, buffer, length, MSG_DONTWAIT);
+    int bytes_rcvd = sys_recv((char*)buffer + bytes_buffered, length - bytes_buffered, MSG_DONTWAIT);
 
     // If we got an error indicator...
     if (bytes_rcvd == -1)
     {
-        // If the error was "no data available", tell the caller "no bytes received"
-        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
-        
+        // If the error was "no data available", tell the caller how many buffered bytes he got
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return bytes_buffered;
+
+        // If we already have data for the caller, he'll see the error on his next call
+        if (bytes_buffered) return bytes_buffered;
+
         // Otherwise, a true error occured (i.e., the peer closed the socket)
         close();
         return -1;
     }
 
+    // If the peer closed the socket and we have nothing else for the caller, tell him
+    if (bytes_rcvd == 0 && bytes_buffered == 0)
+    {
+        close();
+        return -1;
+    }
+
     // Tell the caller how many bytes were received
+    return bytes_buffered + bytes_rcvd;
+}
+//==========================================================================================================
+
+
+
+
+//==========================================================================================================
+// receive() - Receives a fixed amount of data from the socket, giving up if the deadline passes first
+//
+// Passed:  buffer      = Pointer to the place to store the received data
+//          length      = The number of bytes to read in
+//          deadline_ms = The time at which to give up, as returned by deadline()
+//          p_received  = If not NULL, receives the number of bytes that were stored in the buffer
+//
+// Returns: RX_COMPLETE = All 'length' bytes were read
+//          RX_TIMEOUT  = The deadline passed before all of the data arrived
+//          RX_CLOSED   = The socket was closed by the other side before all of the data arrived
+//          RX_FAILED   = An error occured
+//==========================================================================================================
+NetSock::rx_status_t NetSock::receive(void* buffer, int length, uint64_t deadline_ms, int* p_received)
+{
+    // Get a byte-pointer to the caller's buffer
+    unsigned char* ptr = (unsigned char*)buffer;
+
+    // Anything that is already in our receive buffer gets handed to the caller first
+    int bytes_received = drain_rx_buffer(ptr, length);
+
+    // Until we find out otherwise, we'll get all of the data
+    rx_status_t status = RX_COMPLETE;
+
+    // Loop until there are no more bytes to read...
+    while (bytes_received < length)
+    {
+        // Fetch whatever bytes are available without blocking
+        int bytes_rcvd = sys_recv(ptr + bytes_received, length - bytes_received, MSG_DONTWAIT);
+
+        // If we got some, keep track of them and go back for more
+        if (bytes_rcvd > 0)
+        {
+            bytes_received += bytes_rcvd;
+            continue;
+        }
+
+        // If the socket is closed, tell the caller
+        if (bytes_rcvd == 0)
+        {
+            status = RX_CLOSED;
+            break;
+        }
+
+        // If we were interrupted, just try again
+        if (errno == EINTR) continue;
+
+        // If the failure wasn't merely "no data yet", tell the caller
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            status = RX_FAILED;
+            break;
+        }
+
+        // Wait for more data to arrive.  If the deadline passes first, tell the caller
+        if (!wait_until(deadline_ms))
+        {
+            status = RX_TIMEOUT;
+            break;
+        }
+    }
+
+    // Tell the caller how many bytes are in his buffer, and whether that's all of them
+    if (p_received) *p_received = bytes_received;
+    return status;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// deadline() - Returns the monotonic clock time that is 'timeout_ms' from now.  -1 = Never
+//==========================================================================================================
+uint64_t NetSock::deadline(int timeout_ms)
+{
+    if (timeout_ms < 0) return NO_DEADLINE;
+    return monotonic_ms() + timeout_ms;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_until() - Waits for the socket to become readable (or for the peer to hang up)
+//
+// Returns: true if the socket is readable, false if the deadline passed first
+//==========================================================================================================
+bool NetSock::wait_until(uint64_t deadline_ms)
+{
+    // If we're keeping statistics, this is the time we started waiting
+    uint64_t wait_start_us = m_stats ? stats_clock_us() : 0;
+
+    pollfd pfd = {m_sd, POLLIN, 0};
+    int    result;
+
+    // Loop until the socket is readable, the deadline passes, or poll() fails
+    while (true)
+    {
+        // How many milliseconds remain until the deadline?  A far-off deadline is waited for in pieces
+        int timeout_ms = -1;
+        uint64_t now = 0;
+        if (deadline_ms != NO_DEADLINE)
+        {
+            now = monotonic_ms();
+            if (now >= deadline_ms)
+                timeout_ms = 0;
+            else
+                timeout_ms = (deadline_ms - now > INT_MAX) ? INT_MAX : (int)(deadline_ms - now);
+        }
+
+        // Wait for the socket to become readable
+        result = poll(&pfd, 1, timeout_ms);
+
+        // If we were interrupted, wait for whatever time is left
+        if (result < 0 && errno == EINTR) continue;
+
+        // If poll() gave up before the deadline arrived, wait for whatever time is left
+        if (result == 0 && timeout_ms > 0 && monotonic_ms() < deadline_ms) continue;
+        break;
+    }
+
+    // Record how long we waited
+    if (m_stats) count_rx_wait(wait_start_us);
+
+    // If poll() failed, we treat it as readable so that the caller's recv() reports the error
+    return result != 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// fill_rx_buffer_by() - Reads data into the receive buffer, waiting for it to arrive no later than the
+//                       deadline
+//
+// Returns: RX_COMPLETE if data was read, otherwise the reason why none was
+//==========================================================================================================
+NetSock::rx_status_t NetSock::fill_rx_buffer_by(uint64_t deadline_ms)
+{
+    while (true)
+    {
+        // If there's no deadline, we can simply block in recv().  Otherwise, don't block at all
+        int bytes_rcvd = fill_rx_buffer(deadline_ms == NO_DEADLINE ? 0 : MSG_DONTWAIT);
+
+        // If we got some data, we're done
+        if (bytes_rcvd > 0) return RX_COMPLETE;
+
+        // If the socket is closed, tell the caller
+        if (bytes_rcvd == 0) return RX_CLOSED;
+
+        // If we were interrupted, just try again
+        if (errno == EINTR) continue;
+
+        // If the failure wasn't merely "no data yet", tell the caller
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return RX_FAILED;
+
+        // Wait for data to arrive.  If the deadline passes first, tell the caller
+        if (!wait_until(deadline_ms)) return RX_TIMEOUT;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// fill_rx_buffer() - Reads as much data from the socket as will fit into our receive buffer
+//
+// Passed:  flags        = The flags to pass to recv()
+//          min_capacity = The buffer will be enlarged if necessary to hold at least this many bytes
+//
+// Returns: The value returned by recv()
+//==========================================================================================================
+int NetSock::fill_rx_buffer(int flags, int min_capacity)
+{
+    // If the buffer is empty, start filling it from the beginning
+    if (m_rx_head == m_rx_tail) m_rx_head = m_rx_tail = 0;
+
+    // Make sure the buffer has been allocated and is at least as large as we need
+    if (m_rx_buf.size() < RX_BUFFER_SIZE) m_rx_buf.resize(RX_BUFFER_SIZE);
+    if ((int)m_rx_buf.size() < min_capacity) m_rx_buf.resize(min_capacity);
+
+    // If there's no room at the end of the buffer, slide the valid data down to the front of it
+    if (m_rx_tail == (int)m_rx_buf.size() && m_rx_head > 0)
+    {
+        memmove(&m_rx_buf[0], &m_rx_buf[m_rx_head], rx_buffered());
+        m_rx_tail -= m_rx_head;
+        m_rx_head  = 0;
+    }
+
+    // Fetch as much data as will fit into the free space at the end of the buffer
+    int bytes_rcvd = sys_recv(&m_rx_buf[m_rx_tail], m_rx_buf.size() - m_rx_tail, flags);
+
+    // If we received data, it's now part of the buffer
+    if (bytes_rcvd > 0) m_rx_tail += bytes_rcvd;
+
+    // Hand the caller the result of recv()
     return bytes_rcvd;
 }
 //==========================================================================================================
 
 
+//==========================================================================================================
+// drain_rx_buffer() - Removes data from the receive buffer and hands it to the caller
+//
+// Passed:  buffer = Pointer to the place to store the data
+//          length = The maximum number of bytes to store
+//
+// Returns: The number of bytes that were copied into the caller's buffer
+//==========================================================================================================
+int NetSock::drain_rx_buffer(void* buffer, int length)
+{
+    // Find out how many bytes we can hand to the caller
+    int count = rx_buffered();
+    if (count > length) count = length;
+
+    // If there's nothing to hand over, we're done
+    if (count == 0) return 0;
+
+    // Copy the data into the caller's buffer and remove it from ours
+    memcpy(buffer, &m_rx_buf[m_rx_head], count);
+    m_rx_head += count;
+
+    // Tell the caller how many bytes we gave him
+    return count;
+}
+//==========================================================================================================
+
 
 
 //==========================================================================================================
@@ -402,11 +1475,37 @@ int NetSock::receive_noblock(void* buffer, int length)
 // The result buffer doesn't include the terminating carriage-return/linefeed
 //==========================================================================================================
 bool NetSock::getline(void* buffer, size_t buff_size)
+{
+    return getline(buffer, buff_size, NO_DEADLINE) == RX_COMPLETE;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// getline() - Fetches a line of text from the socket, giving up if the deadline passes first
+//
+// Passed:  buffer      = Pointer to the place to store the line.  It is always nul-terminated
+//          buff_size   = The size of the buffer.  Characters that don't fit are thrown away
+//          deadline_ms = The time at which to give up, as returned by deadline()
+//          p_length    = If not NULL, receives the number of characters stored in the buffer
+//
+// Returns: RX_COMPLETE = A whole line was read
+//          RX_TIMEOUT  = The deadline passed.  The buffer holds the portion of the line that was read
+//          RX_CLOSED   = The socket was closed by the other side before the line was complete
+//          RX_FAILED   = An error occured
+//
+// The result buffer doesn't include the terminating carriage-return/linefeed
+//==========================================================================================================
+NetSock::rx_status_t NetSock::getline(void* buffer, size_t buff_size, uint64_t deadline_ms, int* p_length)
 {
     char c, *ptr, *origin;
+    int  i;
+
+    // Assume for the moment that we won't store any characters
+    if (p_length) *p_length = 0;
 
     // Don't let the caller pass us a buffer size of zero
-    if (buff_size == 0) return false;
+    if (buff_size == 0) return RX_FAILED;
 
     // Reduce the buffer size by 1 to allow for appending the nul-byte to the end of it
     --buff_size;
@@ -414,34 +1513,66 @@ bool NetSock::getline(void* buffer, size_t buff_size)
     // Get a byte pointer to the caller's buffer
     origin = ptr = (char*) buffer;
 
+    // Until we find out otherwise, the line will be complete
+    rx_status_t status = RX_COMPLETE;
+
     // Loop until either an error or until we see a linefeed
     while (true)
     {
-        // Fetch a single byte from the socket
-        if (recv(m_sd, &c, 1, 0) < 1) return false;
+        // If our receive buffer is empty, fetch a chunk of data from the socket
+        if (rx_buffered() == 0)
+        {
+            status = fill_rx_buffer_by(deadline_ms);
+            if (status != RX_COMPLETE) break;
+        }
+
+        // Point to the data in the receive buffer
+        char* start = &m_rx_buf[m_rx_head];
+        int   count = rx_buffered();
 
-        // If it's a carriage-return, throw it away
-        if (c == '\r') continue;
+        // Find the line-feed that terminates this line, if it's in the buffer
+        char* eol = (char*)memchr(start, '\n', count);
 
-        // Handle backspace, in case the client is a human-being typing
-        if (c == 8)
+        // This is how many characters we're going to process on this pass
+        int span = eol ? (eol - start) : count;
+
+        // Loop through each character that precedes the line-feed...
+        for (i=0; i<span; ++i)
         {
-            if (ptr > origin) --ptr;
-            continue;            
+            // Fetch this character
+            c = start[i];
+
+            // If it's a carriage-return, throw it away
+            if (c == '\r') continue;
+
+            // Handle backspace, in case the client is a human-being typing
+            if (c == 8)
+            {
+                if (ptr > origin) --ptr;
+                continue;            
+            }
+
+            // If this character will fit into the caller's buffer, append it there
+            if ((ptr - origin) < buff_size) *ptr++ = c;
         }
 
-        // If it's a line-feed, it's the end of the line
-        if (c == '\n') break;
+        // Remove the characters we just processed from the receive buffer
+        m_rx_head += span;
 
-        // If this character will fit into the caller's buffer, append it there
-        if ((ptr - origin) < buff_size) *ptr++ = c;
+        // If we found the line-feed, throw it away.  It's the end of the line
+        if (eol)
+        {
+            ++m_rx_head;
+            break;
+        }
     }
 
-    // We've encountered the end of the line.  Terminate the output string
+    // Terminate the output string, whether or not we've reached the end of the line
     *ptr = 0;
 
-    // And tell the caller that he has a line of data waiting in his buffer
-    return true;
+    // Tell the caller how many characters are in his buffer, and whether they form a complete line
+    if (p_length) *p_length = ptr - origin;
+    return status;
 }
 //==========================================================================================================
 
@@ -475,6 +1606,9 @@ int NetSock::send(const void* buffer, int length)
     // If the socket descriptor isn't open, don't try to send anything
     if (m_sd < 0) return -1;
 
+    // Anything that send_async() queued has to go out ahead of this data
+    if (m_tx_queued && !drain_tx_queue()) return -1;
+
     // Get a byte pointer to the caller's buffer
     unsigned char* ptr = (unsigned char*)buffer;
 
@@ -485,7 +1619,7 @@ int NetSock::send(const void* buffer, int length)
     while (bytes_remaining)
     {
         // Attempt to send all of the bytes
-        int sent = ::send(m_sd, ptr, bytes_remaining, MSG_NOSIGNAL);
+        int sent = sys_send(ptr, bytes_remaining, MSG_NOSIGNAL);
 
         // If an error occured, tell the caller
         if (sent < 0) return -1;
@@ -505,6 +1639,1261 @@ int NetSock::send(const void* buffer, int length)
 
 
 
+//==========================================================================================================
+// sendv() - Sends a list of buffers to the other side of a connected socket (scatter/gather)
+//
+// Passed:  iov   = An array of iovec structures, each describing a buffer to send
+//          count = The number of entries in the 'iov' array
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually sent.  Every byte of every buffer will
+//                  always be sent unless the socket was closed by the other side
+//==========================================================================================================
+int NetSock::sendv(const iovec* iov, int count)
+{
+    // This is the maximum number of buffers we'll hand to sendmsg() at a time
+    const int MAX_IOV = 64;
+
+    // This is a scratch copy of the iovec entries, since partial sends require us to adjust them
+    iovec local[MAX_IOV];
+
+    // If the socket descriptor isn't open, don't try to send anything
+    if (m_sd < 0) return -1;
+
+    // Anything that send_async() queued has to go out ahead of this data
+    if (m_tx_queued && !drain_tx_queue()) return -1;
+
+    // This is the index of the next buffer to send, and how many of its bytes have already been sent
+    int    index  = 0;
+    size_t offset = 0;
+
+    // This is the total number of bytes we have sent
+    int    total_sent = 0;
+
+    // Loop until every buffer has been sent...
+    while (index < count)
+    {
+        int n = 0;
+
+        // Build a list of the unsent portions of as many buffers as we can
+        for (int i=index; i<count && n < MAX_IOV; ++i)
+        {
+            // How many bytes at the front of this buffer have already been sent?
+            size_t skip = (i == index) ? offset : 0;
+
+            // Zero-length buffers don't need to be sent
+            if (iov[i].iov_len == skip) continue;
+
+            // Describe the unsent portion of this buffer
+            local[n].iov_base = (char*)iov[i].iov_base + skip;
+            local[n].iov_len  = iov[i].iov_len - skip;
+            ++n;
+        }
+
+        // If there's nothing left to send, we're done
+        if (n == 0) break;
+
+        // Describe the buffers to sendmsg()
+        msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov    = local;
+        msg.msg_iovlen = n;
+
+        // Attempt to send all of the bytes
+        int sent = sys_sendmsg(&msg, MSG_NOSIGNAL);
+
+        // If an error occured, tell the caller
+        if (sent < 0) return -1;
+
+        // If the socket is closed, we're done
+        if (sent == 0) break;
+
+        // Keep track of how many bytes we've sent in total
+        total_sent += sent;
+
+        // Step past the buffers (or portions of buffers) that were just sent
+        while (sent > 0)
+        {
+            // How many bytes of the current buffer remain unsent?
+            size_t remaining = iov[index].iov_len - offset;
+
+            // If this whole buffer was sent, move on to the next one
+            if ((size_t)sent >= remaining)
+            {
+                sent  -= remaining;
+                offset = 0;
+                ++index;
+            }
+
+            // Otherwise, only part of this buffer was sent
+            else
+            {
+                offset += sent;
+                sent    = 0;
+            }
+        }
+    }
+
+    // Tell the caller how many bytes we sent
+    return total_sent;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sendv() - Sends two buffers (typically a header and a payload) with a single system call
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually sent.  
+//==========================================================================================================
+int NetSock::sendv(const void* buffer1, int length1, const void* buffer2, int length2)
+{
+    iovec iov[2];
+
+    // Describe the two buffers
+    iov[0].iov_base = (void*)buffer1;
+    iov[0].iov_len  = length1;
+    iov[1].iov_base = (void*)buffer2;
+    iov[1].iov_len  = length2;
+
+    // And send them both
+    return sendv(iov, 2);
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// send_async() - Sends a string without blocking, queueing whatever the kernel won't accept right away
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes sent or queued, which is always the entire string
+//==========================================================================================================
+int NetSock::send_async(string s)
+{
+    return send_async(s.c_str(), s.size());
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_async() - Sends a buffer without blocking, queueing whatever the kernel won't accept right away.
+//                Queued data is sent by flush() (or by the next blocking send), in order
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes sent or queued, which is always 'length'
+//==========================================================================================================
+int NetSock::send_async(const void* buffer, int length)
+{
+    // Don't attempt to send zero bytes
+    if (length == 0) return 0;
+
+    // If the socket descriptor isn't open, don't try to send anything
+    if (m_sd < 0) return -1;
+
+    // Get a byte pointer to the caller's buffer
+    const char* ptr = (const char*)buffer;
+
+    // Keep track of how many bytes have to be queued
+    int bytes_remaining = length;
+
+    // If nothing is queued ahead of this data, hand the kernel as much of it as it will take
+    if (m_tx_queued == 0)
+    {
+        int sent = sys_send(ptr, bytes_remaining, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        // If the kernel has no room right now, that's fine.  Any other error is a real one
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return -1;
+            sent = 0;
+        }
+
+        // Adjust the pointer and the count of bytes remaining to be sent
+        ptr             += sent;
+        bytes_remaining -= sent;
+    }
+
+    // Queue whatever the kernel didn't accept
+    if (bytes_remaining) queue_tx(ptr, bytes_remaining);
+
+    // Tell the caller that every byte was either sent or queued
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// flush() - Sends as much of the send queue as the kernel will accept without blocking.  Call this when
+//           the socket becomes writable
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes that are still queued
+//==========================================================================================================
+int NetSock::flush()
+{
+    // This is the maximum number of chunks we'll hand to sendmsg() at a time
+    const int MAX_IOV = 64;
+
+    // If the socket descriptor isn't open, don't try to send anything
+    if (m_sd < 0) return -1;
+
+    // Loop until the queue is empty or the kernel has no more room...
+    while (m_tx_queued)
+    {
+        iovec iov[MAX_IOV];
+        int   n = 0;
+
+        // Describe the unsent portion of as many chunks as we can
+        deque<tx_chunk_t>::iterator it;
+        for (it = m_tx_queue.begin(); it != m_tx_queue.end() && n < MAX_IOV; ++it, ++n)
+        {
+            iov[n].iov_base = &it->data[it->head];
+            iov[n].iov_len  = it->tail - it->head;
+        }
+
+        // Describe the chunks to sendmsg()
+        msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = n;
+
+        // Send as much as the kernel will take
+        int sent = sys_sendmsg(&msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        // If the kernel has no room, we'll try again when the socket becomes writable
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        // If we were interrupted, just try again
+        if (sent < 0 && errno == EINTR) continue;
+
+        // Any other error is a real one
+        if (sent < 0) return -1;
+
+        // Keep track of how much is left in the queue
+        m_tx_queued -= sent;
+
+        // Throw away the chunks (or portions of chunks) that were just sent
+        while (sent > 0)
+        {
+            tx_chunk_t& chunk = m_tx_queue.front();
+
+            // How many bytes remain unsent in this chunk?
+            int remaining = chunk.tail - chunk.head;
+
+            // If only part of this chunk was sent, we're done
+            if (sent < remaining)
+            {
+                chunk.head += sent;
+                break;
+            }
+
+            // The whole chunk was sent.  Keep its storage for re-use, and throw it away
+            sent -= remaining;
+            m_tx_spare.swap(chunk.data);
+            m_tx_queue.pop_front();
+        }
+    }
+
+    // If the queue has drained far enough, producers may start sending again
+    check_watermarks();
+
+    // Tell the caller how much is still queued
+    return m_tx_queued;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_watermarks() - Sets the send queue depths at which the socket becomes congested (high) and stops
+//                    being congested (low)
+//==========================================================================================================
+void NetSock::set_watermarks(int low_bytes, int high_bytes)
+{
+    // The low watermark can't be higher than the high watermark
+    if (low_bytes > high_bytes) low_bytes = high_bytes;
+
+    // Store the new watermarks
+    m_tx_low_water  = low_bytes;
+    m_tx_high_water = high_bytes;
+
+    // The queue might already be past one of them
+    check_watermarks();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// queue_tx() - Appends data to the send queue, filling the last chunk before starting a new one
+//==========================================================================================================
+void NetSock::queue_tx(const char* buffer, int length)
+{
+    while (length)
+    {
+        // If there's no room in the last chunk, start a new one, re-using spare storage if we have it
+        if (m_tx_queue.empty() || m_tx_queue.back().tail == TX_CHUNK_SIZE)
+        {
+            m_tx_queue.push_back(tx_chunk_t());
+            tx_chunk_t& chunk = m_tx_queue.back();
+            chunk.data.swap(m_tx_spare);
+            chunk.data.resize(TX_CHUNK_SIZE);
+            chunk.head = chunk.tail = 0;
+        }
+
+        // This is the chunk we're filling
+        tx_chunk_t& chunk = m_tx_queue.back();
+
+        // Copy as much as will fit into it
+        int count = TX_CHUNK_SIZE - chunk.tail;
+        if (count > length) count = length;
+        memcpy(&chunk.data[chunk.tail], buffer, count);
+
+        // Keep track of what we've copied
+        chunk.tail  += count;
+        buffer      += count;
+        length      -= count;
+        m_tx_queued += count;
+    }
+
+    // If the queue has grown too deep, producers should stop sending
+    check_watermarks();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// drain_tx_queue() - Sends every byte in the send queue, waiting for the socket to become writable as
+//                    often as needed
+//
+// Returns: false if an error occured
+//==========================================================================================================
+bool NetSock::drain_tx_queue()
+{
+    while (true)
+    {
+        // Send whatever the kernel will accept
+        int queued = flush();
+
+        // If an error occured, tell the caller
+        if (queued < 0) return false;
+
+        // If the queue is empty, we're done
+        if (queued == 0) return true;
+
+        // Wait for the socket to become writable
+        pollfd pfd = {m_sd, POLLOUT, 0};
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return false;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// discard_tx_queue() - Throws away the send queue
+//==========================================================================================================
+void NetSock::discard_tx_queue()
+{
+    m_tx_queue.clear();
+    m_tx_queued    = 0;
+    m_tx_congested = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// check_watermarks() - Checks the depth of the send queue against the watermarks and, when the socket
+//                      becomes congested or stops being congested, tells the handler
+//==========================================================================================================
+void NetSock::check_watermarks()
+{
+    // If the queue has reached the high watermark, the socket is congested
+    if (!m_tx_congested && m_tx_queued >= m_tx_high_water)
+    {
+        m_tx_congested = true;
+        if (m_tx_handler) m_tx_handler->on_congested(this);
+    }
+
+    // If the queue has drained to the low watermark, the socket is no longer congested
+    else if (m_tx_congested && m_tx_queued <= m_tx_low_water)
+    {
+        m_tx_congested = false;
+        if (m_tx_handler) m_tx_handler->on_drained(this);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sigpipe_blocker_t - Blocks SIGPIPE in the calling thread for as long as it exists.
+//
+// sendfile(), splice() and write() have no equivalent of MSG_NOSIGNAL, so a write to a socket or pipe whose
+// other end has gone away raises SIGPIPE.  While this object exists that signal is held pending instead.  When it goes out of
+// scope, a SIGPIPE that we caused is consumed and the thread's original signal mask is restored
+//==========================================================================================================
+struct sigpipe_blocker_t
+{
+    sigpipe_blocker_t()
+    {
+        sigset_t pending;
+
+        // Block SIGPIPE, remembering the signal mask we'll restore later
+        sigemptyset(&m_pipe_set);
+        sigaddset(&m_pipe_set, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &m_pipe_set, &m_old_set);
+
+        // If a SIGPIPE was already pending, it isn't ours to consume
+        sigpending(&pending);
+        m_was_pending = sigismember(&pending, SIGPIPE);
+    }
+
+    ~sigpipe_blocker_t()
+    {
+        sigset_t pending;
+        timespec no_wait = {0, 0};
+
+        // The caller may want to look at errno after we're gone
+        int saved_errno = errno;
+
+        // If we raised a SIGPIPE, throw it away
+        sigpending(&pending);
+        if (!m_was_pending && sigismember(&pending, SIGPIPE)) sigtimedwait(&m_pipe_set, NULL, &no_wait);
+
+        // Restore the signal mask the thread had before
+        pthread_sigmask(SIG_SETMASK, &m_old_set, NULL);
+        errno = saved_errno;
+    }
+
+    sigset_t    m_pipe_set, m_old_set;
+    bool        m_was_pending;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_file() - Sends the contents of a file (or pipe) to the other side of a connected socket without
+//               copying the data through user space
+//
+// Passed:  fd     = The descriptor of an open file or pipe
+//          offset = The file offset to start sending from.  -1 = Start at (and advance) the current file
+//                   position.   Ignored when 'fd' is a pipe
+//          length = The number of bytes to send.  -1 = Send until the end of the file or pipe
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually sent.  This will be less than 'length'
+//                  if the end of the file was reached or the socket was closed by the other side
+//
+// Note: Like send(), this expects a blocking socket.  Like send(), writing to a socket whose peer has
+//       closed it fails with EPIPE rather than raising SIGPIPE
+//==========================================================================================================
+int64_t NetSock::send_file(int fd, off_t offset, int64_t length)
+{
+    struct stat info;
+
+    // This is the largest number of bytes we'll ask the kernel to move at once
+    const int64_t MAX_CHUNK = 0x40000000;
+
+    // If the socket descriptor isn't open, don't try to send anything
+    if (m_sd < 0) return -1;
+
+    // Anything that send_async() queued has to go out ahead of this data
+    if (m_tx_queued && !drain_tx_queue()) return -1;
+
+    // Find out what kind of descriptor we're sending from
+    if (fstat(fd, &info) < 0) return -1;
+
+    // Is the caller's descriptor a pipe?
+    bool is_pipe = S_ISFIFO(info.st_mode);
+
+    // If the caller wants the rest of a regular file, figure out how much that is
+    if (length < 0 && !is_pipe)
+    {
+        off_t start = (offset < 0) ? lseek(fd, 0, SEEK_CUR) : offset;
+        if (start < 0) return -1;
+        length = (info.st_size > start) ? info.st_size - start : 0;
+    }
+
+    // If the other side has gone away, we want EPIPE, not SIGPIPE
+    sigpipe_blocker_t sigpipe_blocker;
+
+    // This is the total number of bytes we've sent
+    int64_t total_sent = 0;
+
+    // Loop until we've sent all of the bytes the caller wanted...
+    while (length < 0 || total_sent < length)
+    {
+        // Figure out how many bytes we'll try to send this time
+        int64_t chunk = (length < 0) ? MAX_CHUNK : length - total_sent;
+        if (chunk > MAX_CHUNK) chunk = MAX_CHUNK;
+
+        // Move the data from the pipe or file directly into the socket
+        ssize_t sent;
+        if (is_pipe)
+            sent = splice(fd, NULL, m_sd, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else
+            sent = sendfile(m_sd, fd, (offset < 0) ? NULL : &offset, chunk);
+
+        // If we're keeping statistics, record what happened.  An open-ended pipe read is never "partial"
+        if (m_stats) count_tx(sent, (length < 0) ? sent : chunk);
+
+        // If an error occured, tell the caller
+        if (sent < 0) return -1;
+
+        // If we've hit the end of the file or pipe, we're done
+        if (sent == 0) break;
+
+        // Keep track of how many bytes we've sent
+        total_sent += sent;
+    }
+
+    // Tell the caller how many bytes we sent
+    return total_sent;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_file() - Receives data from the socket and stores it into a file (or pipe) without copying
+//                  the data through user space
+//
+// Passed:  fd     = The descriptor of an open file or pipe
+//          offset = The file offset to start writing at.  -1 = Write at (and advance) the current file
+//                   position.   Ignored when 'fd' is a pipe
+//          length = The number of bytes to receive.  -1 = Receive until the socket is closed
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually received.  This will be less than
+//                  'length' if the socket was closed by the other side
+//
+// Note: If 'fd' is a pipe whose reader has closed it, this fails with EPIPE rather than raising SIGPIPE
+//==========================================================================================================
+int64_t NetSock::receive_file(int fd, off_t offset, int64_t length)
+{
+    struct stat info;
+    int         pipe_fd[2];
+
+    // This is the largest number of bytes we'll ask the kernel to move at once
+    const int64_t MAX_CHUNK = 0x100000;
+
+    // If the socket descriptor isn't open, don't try to receive anything
+    if (m_sd < 0) return -1;
+
+    // Find out what kind of descriptor we're writing to
+    if (fstat(fd, &info) < 0) return -1;
+
+    // Is the caller's descriptor a pipe?
+    bool is_pipe = S_ISFIFO(info.st_mode);
+
+    // If this is a pipe, the offset is meaningless
+    if (is_pipe) offset = -1;
+
+    // If the reader of the caller's pipe has gone away, we want EPIPE, not SIGPIPE
+    sigpipe_blocker_t sigpipe_blocker;
+
+    // This is the total number of bytes we've received
+    int64_t total_rcvd = 0;
+
+    // Data that is already sitting in our receive buffer has to be written the old-fashioned way
+    while (rx_buffered() && (length < 0 || total_rcvd < length))
+    {
+        // Figure out how many buffered bytes to write
+        int count = rx_buffered();
+        if (length >= 0 && count > length - total_rcvd) count = length - total_rcvd;
+
+        // Write them to the file or pipe
+        ssize_t written = (offset < 0) ? write(fd, &m_rx_buf[m_rx_head], count)
+                                       : pwrite(fd, &m_rx_buf[m_rx_head], count, offset);
+
+        // If that failed, tell the caller
+        if (written < 0) return -1;
+
+        // Remove those bytes from our receive buffer
+        m_rx_head  += written;
+        total_rcvd += written;
+        if (offset >= 0) offset += written;
+    }
+
+    // If the caller's descriptor isn't a pipe, we need a pipe to splice through
+    if (!is_pipe && pipe2(pipe_fd, O_CLOEXEC) < 0) return -1;
+
+    // Loop until we've received all of the bytes the caller wanted...
+    while (length < 0 || total_rcvd < length)
+    {
+        // Figure out how many bytes we'll try to receive this time
+        int64_t chunk = (length < 0) ? MAX_CHUNK : length - total_rcvd;
+        if (chunk > MAX_CHUNK) chunk = MAX_CHUNK;
+
+        // Move data from the socket directly into the caller's pipe, or into our own
+        int out_fd = is_pipe ? fd : pipe_fd[1];
+        ssize_t rcvd = splice(m_sd, NULL, out_fd, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        // If we're keeping statistics, record what happened
+        if (m_stats) count_rx(rcvd, 0);
+
+        // If an error occured or the socket was closed, we're done
+        if (rcvd <= 0)
+        {
+            if (rcvd < 0) total_rcvd = -1;
+            break;
+        }
+
+        // If we spliced through our own pipe, move that data from the pipe into the file
+        for (ssize_t remaining = rcvd; !is_pipe && remaining > 0;)
+        {
+            // Move the data from our pipe to the caller's file
+            ssize_t moved = splice(pipe_fd[0], NULL, fd, (offset < 0) ? NULL : &offset, remaining, SPLICE_F_MOVE);
+
+            // If that failed, give up
+            if (moved <= 0) 
+            {
+                ::close(pipe_fd[0]);
+                ::close(pipe_fd[1]);
+                return -1;
+            }
+
+            // Keep track of how many bytes still need to be moved
+            remaining -= moved;
+        }
+
+        // Keep track of how many bytes we've received
+        total_rcvd += rcvd;
+    }
+
+    // If we created a pipe, close it
+    if (!is_pipe)
+    {
+        ::close(pipe_fd[0]);
+        ::close(pipe_fd[1]);
+    }
+
+    // Tell the caller how many bytes we received
+    return total_rcvd;
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// send_fd() - Hands an open descriptor to the process on the other end of a Unix-domain socket
+//
+// Passed:  fd = The descriptor to send.  The caller still owns (and should eventually close) it
+//
+// Returns: true if the descriptor was sent
+//
+// The descriptor travels with a single byte of data, which receive_fd() consumes
+//==========================================================================================================
+bool NetSock::send_fd(int fd)
+{
+    char   byte = 0;
+    iovec  iov;
+    msghdr msg;
+
+    // This is the ancillary data that carries the descriptor, aligned the way the kernel wants it
+    union
+    {
+        cmsghdr align;
+        char    buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    // If the socket descriptor isn't open, don't try to send anything
+    if (m_sd < 0) return false;
+
+    // A descriptor has to travel with at least one byte of real data
+    iov.iov_base = &byte;
+    iov.iov_len  = 1;
+
+    // Describe the message
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buffer;
+    msg.msg_controllen = sizeof control.buffer;
+
+    // Attach the descriptor to it
+    cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_RIGHTS;
+    cm->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    // And send it
+    return sys_sendmsg(&msg, MSG_NOSIGNAL) == 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_fd() - Waits for a descriptor sent by send_fd() on the other end of a Unix-domain socket
+//
+// Returns: The new descriptor (with close-on-exec set), or -1 if the socket was closed, an error
+//          occured, or the byte we received didn't carry a descriptor
+//
+// Note: Descriptors arrive attached to data, so don't mix this with receive() and friends unless your
+//       protocol ensures that no descriptor is in flight when they're called, or the descriptor will be
+//       lost (and closed) when its byte is read into our receive buffer
+//==========================================================================================================
+int NetSock::receive_fd()
+{
+    char   byte;
+    iovec  iov;
+    msghdr msg;
+    int    fd = -1;
+
+    // This is where the ancillary data that carries the descriptor will land
+    union
+    {
+        cmsghdr align;
+        char    buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    // If the socket descriptor isn't open, don't try to receive anything
+    if (m_sd < 0) return -1;
+
+    // The descriptor travels with a single byte of data
+    iov.iov_base = &byte;
+    iov.iov_len  = 1;
+
+    // Describe where we want the message to go
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buffer;
+    msg.msg_controllen = sizeof control.buffer;
+
+    // Wait for the message to arrive
+    if (recvmsg(m_sd, &msg, MSG_CMSG_CLOEXEC) < 1) return -1;
+
+    // Look for the descriptor that came with it
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+    }
+
+    // Hand the caller the descriptor we received
+    return fd;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_zerocopy() - Turns zero-copy transmission (MSG_ZEROCOPY) on or off for this socket
+//
+// Passed:  flag      = true to turn zero-copy transmission on
+//          threshold = Sends shorter than this are copied as usual, since for small buffers copying is
+//                      cheaper than page pinning and completion notifications
+//
+// Returns: true if zero-copy transmission is now on, false if it's off or the kernel doesn't support it
+//==========================================================================================================
+bool NetSock::enable_zerocopy(bool flag, int threshold)
+{
+    int one = 1;
+
+    // Save the threshold
+    m_zc_threshold = threshold;
+
+    // If the caller is turning zero-copy off, we'll simply stop asking for it
+    if (!flag)
+    {
+        m_zc_enabled = false;
+        return false;
+    }
+
+    // Ask the kernel to allow zero-copy sends on this socket
+    m_zc_enabled = (m_sd >= 0 && setsockopt(m_sd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) == 0);
+
+    // Tell the caller whether zero-copy is now on
+    return m_zc_enabled;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_zerocopy() - Sends a buffer to the other side of a connected socket without copying it
+//
+// Passed:  buffer  = The data to send.   It must not be modified or freed until the handler is notified
+//          length  = The number of bytes to send
+//          handler = Its on_send_complete() is called once the kernel no longer needs the buffer
+//          context = An arbitrary pointer that is handed to on_send_complete()
+//
+// If zero-copy isn't enabled or the send is smaller than the threshold, the data is copied as usual and
+// the handler is notified before this returns.  Otherwise, the handler is notified from inside
+// process_zerocopy_completions() or close().
+//
+// Returns either : -1 = An error occured
+//                  Anything else = the number of bytes actually sent
+//==========================================================================================================
+int NetSock::send_zerocopy(const void* buffer, int length, NetZeroCopyHandler* handler, void* context)
+{
+    zc_pending_t entry;
+
+    // If the socket descriptor isn't open, don't try to send anything
+    if (m_sd < 0) return -1;
+
+    // Anything that send_async() queued has to go out ahead of this data
+    if (m_tx_queued && !drain_tx_queue()) return -1;
+
+    // Small sends are copied, and the buffer is immediately free for re-use
+    if (!m_zc_enabled || length < m_zc_threshold)
+    {
+        int sent = send(buffer, length);
+        if (handler) handler->on_send_complete(context);
+        return sent;
+    }
+
+    // Get a byte pointer to the caller's buffer
+    unsigned char* ptr = (unsigned char*)buffer;
+
+    // Keep track of how many bytes remain to be sent
+    int bytes_remaining = length;
+
+    // The kernel will number our zero-copy send calls starting with this one
+    entry.first_seq   = m_zc_next_seq;
+    entry.outstanding = 0;
+    entry.handler     = handler;
+    entry.context     = context;
+
+    // Loop until there are no more bytes to send...
+    while (bytes_remaining)
+    {
+        // Attempt to send all of the bytes without copying them
+        int sent = sys_send(ptr, bytes_remaining, MSG_NOSIGNAL | MSG_ZEROCOPY);
+
+        // If the kernel has run out of memory for tracking zero-copy sends, copy this part instead
+        if (sent < 0 && errno == ENOBUFS)
+            sent = sys_send(ptr, bytes_remaining, MSG_NOSIGNAL);
+
+        // Otherwise, each successful zero-copy call gets a sequence number from the kernel
+        else if (sent > 0)
+        {
+            ++m_zc_next_seq;
+            ++entry.outstanding;
+        }
+
+        // If an error occured or the socket is closed, we're done
+        if (sent <= 0) break;
+
+        // Adjust the pointer and the count of bytes remaining to be sent
+        ptr             += sent;
+        bytes_remaining -= sent;
+    }
+
+    // If the kernel is using our buffer, we'll notify the handler when it's finished with it
+    if (entry.outstanding)
+    {
+        entry.last_seq = m_zc_next_seq - 1;
+        m_zc_pending.push_back(entry);
+    }
+
+    // Otherwise, the buffer is already free
+    else if (handler) handler->on_send_complete(context);
+
+    // If nothing was sent at all, tell the caller an error occured
+    if (bytes_remaining == length) return -1;
+
+    // Tell the caller how many bytes we sent
+    return (length - bytes_remaining);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// seq_overlap() - Returns how many sequence numbers the range [first, last] has in common with the
+//                 range [lo, hi].  Sequence numbers are 32-bit values that wrap around
+//==========================================================================================================
+static uint32_t seq_overlap(uint32_t first, uint32_t last, uint32_t lo, uint32_t hi)
+{
+    // Express everything as offsets from 'lo'
+    int64_t start = (int32_t)(first - lo);
+    int64_t end   = (int32_t)(last  - lo);
+    int64_t top   = hi - lo;
+
+    // Clip our range to the range [0, top]
+    if (start < 0  ) start = 0;
+    if (end   > top) end   = top;
+
+    // Tell the caller how many sequence numbers are in both ranges
+    return (end >= start) ? (uint32_t)(end - start + 1) : 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// process_zerocopy_completions() - Reads zero-copy completion notifications from the socket's error
+//                                  queue and notifies the handler of each send that has completed
+//
+// Passed:  timeout_ms = # of milliseconds to wait for a notification.  0 = Don't wait.  -1 = Wait forever
+//
+// Returns: The number of zero-copy sends that completed
+//==========================================================================================================
+int NetSock::process_zerocopy_completions(int timeout_ms)
+{
+    char                 control[128];
+    msghdr               msg;
+    vector<zc_pending_t> finished;
+
+    // If there's nothing pending, there's nothing to do
+    if (m_sd < 0 || m_zc_pending.empty()) return 0;
+
+    // If the caller is willing to wait, wait for the error queue to become non-empty
+    if (timeout_ms != 0)
+    {
+        pollfd pfd = {m_sd, 0, 0};
+        poll(&pfd, 1, timeout_ms);
+    }
+
+    // Loop through every notification waiting in the error queue...
+    while (true)
+    {
+        // We want the ancillary data, not the payload
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof control;
+
+        // Fetch the next notification.  If there isn't one, we're done
+        if (recvmsg(m_sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+        // Loop through each control message in the notification...
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            // We're only interested in extended error reports
+            bool is_recverr = (cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR)
+                           || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!is_recverr) continue;
+
+            // Get a pointer to the error report
+            sock_extended_err* err = (sock_extended_err*)CMSG_DATA(cm);
+
+            // If this isn't a zero-copy completion, ignore it
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            // This notification covers the sends numbered ee_info thru ee_data
+            for (size_t i=0; i<m_zc_pending.size();)
+            {
+                zc_pending_t& entry = m_zc_pending[i];
+
+                // Account for the sends in this entry that just completed
+                entry.outstanding -= seq_overlap(entry.first_seq, entry.last_seq, err->ee_info, err->ee_data);
+
+                // If every send in this entry has completed, the buffer is free
+                if (entry.outstanding == 0)
+                {
+                    finished.push_back(entry);
+                    m_zc_pending.erase(m_zc_pending.begin() + i);
+                }
+                else ++i;
+            }
+        }
+    }
+
+    // Tell the handlers that their buffers are free.  We do this last because a handler may send again
+    for (size_t i=0; i<finished.size(); ++i)
+    {
+        if (finished[i].handler) finished[i].handler->on_send_complete(finished[i].context);
+    }
+
+    // Tell the caller how many sends completed
+    return finished.size();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// drain_zerocopy() - Called when the socket is about to be closed.  Waits (for a bounded time) for the
+//                    kernel to finish with the buffers of pending zero-copy sends, notifying their handlers
+//
+// Once the socket is closed no more notifications can arrive, but the kernel may still be transmitting
+// from the pinned pages of a pending send.  Telling the handler that such a buffer is free would let it be
+// overwritten while it's on the wire, so sends that are still pending when we give up are forgotten
+// without notifying their handlers
+//==========================================================================================================
+void NetSock::drain_zerocopy()
+{
+    // Wait for completion notifications a slice at a time, until there are none pending or we give up
+    for (int waited = 0; m_sd >= 0 && !m_zc_pending.empty() && waited < ZC_CLOSE_WAIT_MS; waited += 10)
+    {
+        process_zerocopy_completions(10);
+    }
+
+    // Forget about any sends that still haven't completed
+    m_zc_pending.clear();
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// enable_stats() - Turns per-socket I/O statistics on or off
+//
+// When statistics are off, the only cost is a NULL-pointer check on each system call
+//==========================================================================================================
+void NetSock::enable_stats(bool flag)
+{
+    // If we're turning statistics on and they're not already on, start them out at zero
+    if (flag && m_stats == NULL)
+    {
+        m_stats = new netsock_stats_t;
+        reset_stats();
+    }
+
+    // If we're turning statistics off, throw them away
+    if (!flag)
+    {
+        delete m_stats;
+        m_stats = NULL;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_stats() - Fetches a snapshot of the I/O statistics, along with a sample of TCP_INFO
+//
+// Returns: true if statistics are being kept, otherwise false
+//==========================================================================================================
+bool NetSock::get_stats(netsock_stats_t* p_stats)
+{
+    // Fetch the counters, or zeroes if we're not keeping them
+    if (m_stats)
+        *p_stats = *m_stats;
+    else
+        memset(p_stats, 0, sizeof *p_stats);
+
+    // Find out what the kernel thinks of the connection
+    sample_tcp_info(&p_stats->tcp);
+
+    // Tell the caller whether the counters are meaningful
+    return m_stats != NULL;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// reset_stats() - Clears the I/O statistics
+//==========================================================================================================
+void NetSock::reset_stats()
+{
+    if (m_stats) memset(m_stats, 0, sizeof *m_stats);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sample_tcp_info() - Fetches round-trip time, retransmit and congestion-window information from the
+//                     kernel.  This works whether or not statistics are turned on
+//
+// Returns: true if the information was fetched, false if the socket isn't an open TCP socket
+//==========================================================================================================
+bool NetSock::sample_tcp_info(netsock_tcp_info_t* p_info)
+{
+    tcp_info  info;
+    socklen_t length = sizeof info;
+
+    // Start out with everything zeroed
+    memset(p_info, 0, sizeof *p_info);
+
+    // Ask the kernel about the connection.  If it can't tell us, we're done
+    if (m_sd < 0 || getsockopt(m_sd, IPPROTO_TCP, TCP_INFO, &info, &length) < 0) return false;
+
+    // Hand the caller the fields he's interested in
+    p_info->valid         = true;
+    p_info->rtt_us        = info.tcpi_rtt;
+    p_info->rttvar_us     = info.tcpi_rttvar;
+    p_info->retransmits   = info.tcpi_retransmits;
+    p_info->total_retrans = info.tcpi_total_retrans;
+    p_info->snd_cwnd      = info.tcpi_snd_cwnd;
+    p_info->unacked       = info.tcpi_unacked;
+    p_info->lost          = info.tcpi_lost;
+    p_info->snd_mss       = info.tcpi_snd_mss;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sys_recv() - Calls recv() on our socket and, if we're keeping statistics, records what happened
+//
+// Returns: The value returned by recv(), with errno intact
+//==========================================================================================================
+int NetSock::sys_recv(void* buffer, size_t length, int flags)
+{
+    // If we're not keeping statistics, this is just a system call
+    if (m_stats == NULL) return recv_data(buffer, length, flags);
+
+    // If this call is allowed to block, we'll time how long it waits, unless wait_for_data() just counted
+    // the wait for this data
+    bool is_counted = (flags & MSG_DONTWAIT) || m_rx_wait_counted;
+    uint64_t wait_start_us = is_counted ? 0 : stats_clock_us();
+    m_rx_wait_counted = false;
+
+    // Fetch the data and record the result
+    int bytes_rcvd = recv_data(buffer, length, flags);
+    count_rx(bytes_rcvd, wait_start_us);
+    return bytes_rcvd;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// recv_data() - Calls recv() on our socket or, if we're fetching receive timestamps, recvmsg()
+//
+// Returns: The value returned by recv(), with errno intact
+//==========================================================================================================
+int NetSock::recv_data(void* buffer, size_t length, int flags)
+{
+    char control[256];
+
+    // If we're not fetching timestamps, this is just a system call
+    if (!m_rx_timestamps) return recv(m_sd, buffer, length, flags);
+
+    // Describe the caller's buffer
+    iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len  = length;
+
+    // Describe the message to recvmsg()
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+
+    // Fetch the data
+    int bytes_rcvd = recvmsg(m_sd, &msg, flags);
+
+    // If we got some, keep track of when it arrived
+    if (bytes_rcvd > 0)
+    {
+        timespec rx_time;
+        if (NetUtil::get_rx_timestamp(&msg, &rx_time)) m_rx_time = rx_time;
+    }
+
+    // Hand the caller the result of recvmsg()
+    return bytes_rcvd;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_rx_timestamps() - Turns on (or off) kernel timestamping of arriving data
+//==========================================================================================================
+bool NetSock::enable_rx_timestamps(bool flag)
+{
+    // If the socket isn't open or the kernel won't do it, tell the caller
+    if (m_sd < 0 || !NetUtil::enable_rx_timestamps(m_sd, flag)) return false;
+
+    // From now on, reads will fetch the timestamps
+    m_rx_timestamps = flag;
+    memset(&m_rx_time, 0, sizeof m_rx_time);
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_rx_timestamp() - Fetches the time the kernel received the most recently read data
+//
+// Returns: false if rx timestamps aren't turned on, or no data has arrived yet
+//==========================================================================================================
+bool NetSock::get_rx_timestamp(timespec* p_rx_time)
+{
+    *p_rx_time = m_rx_time;
+    return m_rx_timestamps && (m_rx_time.tv_sec || m_rx_time.tv_nsec);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sys_send() - Calls send() on our socket and, if we're keeping statistics, records what happened
+//
+// Returns: The value returned by send(), with errno intact
+//==========================================================================================================
+int NetSock::sys_send(const void* buffer, size_t length, int flags)
+{
+    int sent = ::send(m_sd, buffer, length, flags);
+    if (m_stats) count_tx(sent, length);
+    return sent;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sys_sendmsg() - Calls sendmsg() on our socket and, if we're keeping statistics, records what happened
+//
+// Returns: The value returned by sendmsg(), with errno intact
+//==========================================================================================================
+int NetSock::sys_sendmsg(const msghdr* msg, int flags)
+{
+    int sent = sendmsg(m_sd, msg, flags);
+
+    // If we're keeping statistics, add up how many bytes we asked to send, and record the result
+    if (m_stats)
+    {
+        int64_t requested = 0;
+        for (size_t i=0; i<msg->msg_iovlen; ++i) requested += msg->msg_iov[i].iov_len;
+        count_tx(sent, requested);
+    }
+
+    // Hand the caller the result of sendmsg()
+    return sent;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// count_rx() - Records the result of a system call that received data
+//
+// Passed:  result        = The value returned by the system call (errno must still be intact)
+//          wait_start_us = The time the call started, or 0 if it wasn't allowed to block
+//==========================================================================================================
+void NetSock::count_rx(int64_t result, uint64_t wait_start_us)
+{
+    ++m_stats->rx_calls;
+    if (result > 0) m_stats->rx_bytes += result;
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ++m_stats->rx_eagain;
+    if (wait_start_us) count_rx_wait(wait_start_us);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// count_tx() - Records the result of a system call that sent data
+//
+// Passed:  result    = The value returned by the system call (errno must still be intact)
+//          requested = The number of bytes we asked the system call to send
+//==========================================================================================================
+void NetSock::count_tx(int64_t result, int64_t requested)
+{
+    ++m_stats->tx_calls;
+    if (result > 0) m_stats->tx_bytes += result;
+    if (result > 0 && result < requested) ++m_stats->tx_partial;
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ++m_stats->tx_eagain;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// count_rx_wait() - Adds the time since 'wait_start_us' to the receive-wait statistics
+//==========================================================================================================
+void NetSock::count_rx_wait(uint64_t wait_start_us)
+{
+    uint64_t now = stats_clock_us();
+
+    // If the clock was set backwards, call it a zero-length wait
+    uint64_t elapsed = (now > wait_start_us) ? now - wait_start_us : 0;
+
+    // Find the histogram bucket for this wait: bucket 'n' holds waits of 2^n thru 2^(n+1)-1 microseconds
+    int bucket = 0;
+    while ((elapsed >> (bucket + 1)) && bucket < NETSOCK_WAIT_BUCKETS - 1) ++bucket;
+
+    // Record the wait
+    ++m_stats->rx_waits;
+    m_stats->rx_wait_us += elapsed;
+    ++m_stats->rx_wait_hist[bucket];
+}
+//==========================================================================================================
+
+
+
 //==========================================================================================================
 // sendf() - Sends a printf-style formatt data to the the other side of a connected socket
 //
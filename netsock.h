@@ -5,9 +5,121 @@
 //==========================================================================================================
 #pragma once
 #include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <time.h>
 #include <string>
+#include <vector>
+#include <deque>
 #include <stdexcept>
 
+class NetSock;
+
+//==========================================================================================================
+// NetZeroCopyHandler - Derive from this class to find out when the kernel no longer needs a buffer that
+//                      was handed to NetSock::send_zerocopy()
+//==========================================================================================================
+class NetZeroCopyHandler
+{
+public:
+
+    // All base-classes should have virtual destructors
+    virtual ~NetZeroCopyHandler() {}
+
+    // Called once the buffer may be modified or freed
+    virtual void on_send_complete(void* context) = 0;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// NetSendQueueHandler - Derive from this class to find out when a socket's asynchronous send queue grows
+//                       past its high watermark, and when it drains back down to its low watermark
+//==========================================================================================================
+class NetSendQueueHandler
+{
+public:
+
+    // All base-classes should have virtual destructors
+    virtual ~NetSendQueueHandler() {}
+
+    // Called when the queue grows to the high watermark.  Producers should stop sending
+    virtual void on_congested(NetSock* sock) {}
+
+    // Called when the queue drains to the low watermark.  Producers may start sending again
+    virtual void on_drained(NetSock* sock) {}
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// netsock_tcp_info_t - A sample of the kernel's view of a TCP connection (from TCP_INFO)
+//==========================================================================================================
+struct netsock_tcp_info_t
+{
+    // True if the sample was taken.  The rest of the fields are zero when this is false
+    bool        valid;
+
+    // The smoothed round-trip time and its variance, in microseconds
+    uint32_t    rtt_us;
+    uint32_t    rttvar_us;
+
+    // The number of retransmits of the oldest unacknowledged segment, and the total over the connection
+    uint32_t    retransmits;
+    uint32_t    total_retrans;
+
+    // The congestion window, in segments
+    uint32_t    snd_cwnd;
+
+    // The number of segments that have been sent but not acknowledged, and how many of them are lost
+    uint32_t    unacked;
+    uint32_t    lost;
+
+    // The maximum segment size we're sending with
+    uint32_t    snd_mss;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// netsock_stats_t - Per-socket I/O counters, maintained when NetSock::enable_stats() has been called
+//==========================================================================================================
+
+// The number of buckets in the receive-wait histogram
+enum {NETSOCK_WAIT_BUCKETS = 32};
+
+struct netsock_stats_t
+{
+    // The number of bytes received, and the number of system calls that received them
+    uint64_t    rx_bytes;
+    uint64_t    rx_calls;
+
+    // The number of bytes sent, and the number of system calls that sent them
+    uint64_t    tx_bytes;
+    uint64_t    tx_calls;
+
+    // The number of sends that accepted only part of the data they were handed
+    uint64_t    tx_partial;
+
+    // The number of system calls that failed with EAGAIN/EWOULDBLOCK
+    uint64_t    rx_eagain;
+    uint64_t    tx_eagain;
+
+    // The number of times we blocked waiting for data, and the total number of microseconds spent waiting
+    uint64_t    rx_waits;
+    uint64_t    rx_wait_us;
+
+    // Histogram of receive-wait times.  Bucket 0 counts waits of less than 2 microseconds, and bucket 'n'
+    // counts waits of 2^n thru 2^(n+1)-1 microseconds.  The last bucket counts everything longer
+    uint64_t    rx_wait_hist[NETSOCK_WAIT_BUCKETS];
+
+    // Filled in by get_stats() from TCP_INFO
+    netsock_tcp_info_t tcp;
+};
+//==========================================================================================================
+
+
 class NetSock
 {
 public:
@@ -17,22 +129,54 @@ public:
     {
         BIND_FAILED,
         NO_SUCH_SERVER,
-        CANT_CONNECT
+        CANT_CONNECT,
+        CONNECT_TIMEOUT
+    };
+
+    // These are the results of the versions of receive() and getline() that take a deadline
+    enum rx_status_t
+    {
+        RX_COMPLETE,
+        RX_TIMEOUT,
+        RX_CLOSED,
+        RX_FAILED
+    };
+
+    // Describes a single outbound connection for connect_all()
+    struct connect_t
+    {
+        NetSock*    sock;
+        std::string server;
+        int         port;
+        int         family;
     };
 
 
     // Constructor and Destructor
     NetSock();
-    ~NetSock() {close();}
+    ~NetSock() {close(); delete m_stats;}
 
+#if __cplusplus >= 201103L
+    // A socket owns its descriptor, so it can be moved but not copied
+    NetSock(const NetSock& rhs) = delete;
+    NetSock& operator=(const NetSock& rhs) = delete;
+
+    // Move constructor and move assignment.  The object moved from is left closed
+    NetSock(NetSock&& rhs);
+    NetSock& operator=(NetSock&& rhs) {move_object(rhs); return *this;}
+#else
     // Copy constructor
-    NetSock(const NetSock& rhs) {copy_object(rhs);}
+    NetSock(const NetSock& rhs) {m_stats = NULL; copy_object(rhs);}
     
     // Assignment 
     NetSock& operator=(const NetSock& rhs) {copy_object(rhs); return *this;}
+#endif
 
     // Call this to create a server socket
-    bool    create_server(int port, std::string bind_to = "", int family = AF_UNSPEC);
+    bool    create_server(int port, std::string bind_to = "", int family = AF_UNSPEC, bool reuse_port = false);
+
+    // Call this to create a Unix-domain server socket.  A leading '@' names an abstract-namespace socket
+    bool    create_unix_server(std::string path, int type = SOCK_STREAM);
 
     // Call this to start listening for connections.  Can throw runtime_error
     void    listen(int concurrent_connections = 1);
@@ -40,12 +184,27 @@ public:
     // Call this to wait for someone to connect to a server socket
     bool    accept(int timeout_ms = -1, NetSock* new_sock = NULL);
 
+#if __cplusplus >= 201103L
+    // Waits for someone to connect to a server socket and returns the new connection.  On timeout, the
+    // socket that is returned isn't open
+    NetSock accept_connection(int timeout_ms = -1);
+#endif
+
     // Convenience call for waiting for a single incoming connection
     bool    listen_and_accept(int timeout_ms = -1);
 
     // Call this to connect to a server
     bool    connect(std::string server_name, int port, int family = AF_INET);
 
+    // Call this to connect to a server, racing every address it resolves to, with a deadline
+    bool    connect(std::string server_name, int port, int family, int timeout_ms);
+
+    // Call this to connect to a Unix-domain server socket.  'type' is SOCK_STREAM or SOCK_SEQPACKET
+    bool    connect_unix(std::string path, int type = SOCK_STREAM);
+
+    // Call this to establish many outbound connections at once.  Returns the number that connected
+    static int connect_all(connect_t* list, int count, int timeout_ms);
+
     // Call this to turn Nagle's algorithm on or off
     void    set_nagling(bool flag);
 
@@ -58,9 +217,26 @@ public:
     // Returns the number of bytes available for reading 
     int     bytes_available();
 
+    // Cheaply checks whether the peer is still connected without blocking or consuming any data
+    bool    is_alive(bool* p_has_unread_data = NULL);
+
     // Call this to receive a fixed amount of data from the socket
     int     receive(void* buffer, int length, bool peek = false);
 
+    // Call this to receive a fixed amount of data, giving up at 'deadline_ms' (a time from deadline()).  If
+    // 'p_received' isn't NULL, it is set to the number of bytes stored in the buffer, even when the result
+    // isn't RX_COMPLETE
+    rx_status_t receive(void* buffer, int length, uint64_t deadline_ms, int* p_received);
+
+    // Call this to fetch a line of text, giving up at 'deadline_ms'.  If 'p_length' isn't NULL, it is set to
+    // the number of characters stored in the buffer.  On timeout, the buffer holds the partial line.  Data
+    // read past the end of the line is kept in our receive buffer, where epoll can't see it, so a NetReactor
+    // handler must keep calling this while bytes_available() > 0
+    rx_status_t getline(void* buffer, size_t buff_size, uint64_t deadline_ms, int* p_length = NULL);
+
+    // Returns the deadline (on the monotonic clock) that is 'timeout_ms' milliseconds from now
+    static uint64_t deadline(int timeout_ms);
+
     // Call this to receive however many bytes are available for reading. Returns the
     // the number of bytes received, or -1 if the socket was closed by the other side.
     int     receive_noblock(void* buffer, int length);
@@ -75,6 +251,78 @@ public:
     int     send(std::string s);
     int     send(const void* buffer, int length);
 
+    // Call these to send several buffers (i.e., a header and a payload) with a single system call
+    int     sendv(const iovec* iov, int count);
+    int     sendv(const void* buffer1, int length1, const void* buffer2, int length2);
+
+    // Call these to send without blocking.  Whatever the kernel won't accept right away is queued and sent
+    // by flush().  Returns the number of bytes sent or queued, or -1 if an error occured
+    int     send_async(std::string s);
+    int     send_async(const void* buffer, int length);
+
+    // Sends as much queued data as the kernel will accept without blocking.  Call this when the socket
+    // becomes writable.  Returns the number of bytes still queued, or -1 if an error occured
+    int     flush();
+
+    // Returns true if there is queued data waiting for the socket to become writable.  An epoll loop
+    // should watch for writability only while this is true
+    bool    wants_write() {return m_tx_queued > 0;}
+
+    // Returns the number of bytes in the send queue
+    int     queued_bytes() {return m_tx_queued;}
+
+    // Call this to set the queue depths at which a socket becomes congested, and stops being congested
+    void    set_watermarks(int low_bytes, int high_bytes);
+
+    // Returns true from the time the queue reaches the high watermark until it drains to the low watermark
+    bool    is_congested() {return m_tx_congested;}
+
+    // Call this to be notified when the socket becomes congested and stops being congested
+    void    set_send_queue_handler(NetSendQueueHandler* handler) {m_tx_handler = handler;}
+
+    // Call this to send data from a file or pipe without copying it through user space
+    int64_t send_file(int fd, off_t offset, int64_t length);
+
+    // Call this to receive data directly into a file or pipe without copying it through user space
+    int64_t receive_file(int fd, off_t offset, int64_t length);
+
+    // Call this to turn on zero-copy transmission for sends of at least 'threshold' bytes
+    bool    enable_zerocopy(bool flag, int threshold = 16384);
+
+    // Sends a buffer without copying it.  The buffer must not be modified until handler is notified.  If
+    // the socket is closed before the kernel is done with the buffer, the handler is never notified, so
+    // the buffer must outlive the socket
+    int     send_zerocopy(const void* buffer, int length, NetZeroCopyHandler* handler, void* context = NULL);
+
+    // Reads zero-copy completion notifications and notifies handlers.  Returns the number completed
+    int     process_zerocopy_completions(int timeout_ms = 0);
+
+    // Returns the number of zero-copy sends whose buffers the kernel is still using
+    int     zerocopy_pending() {return m_zc_pending.size();}
+
+    // Call this to turn per-socket I/O statistics on or off.  They cost next to nothing when off
+    void    enable_stats(bool flag);
+
+    // Fetches a snapshot of the statistics.  Returns false (and zeroes the counters) if they're off
+    bool    get_stats(netsock_stats_t* p_stats);
+
+    // Clears the statistics
+    void    reset_stats();
+
+    // Samples the kernel's TCP_INFO for this connection.  Returns false if it isn't available
+    bool    sample_tcp_info(netsock_tcp_info_t* p_info);
+
+    // Call this to have the kernel record when data arrives, with nanosecond resolution
+    bool    enable_rx_timestamps(bool flag);
+
+    // Fetches the time the kernel received the most recently read data.  Returns false if there isn't one
+    bool    get_rx_timestamp(timespec* p_rx_time);
+
+    // Call these to hand an open descriptor to (or receive one from) the process on the other end of a
+    // Unix-domain socket.  receive_fd() returns the new descriptor, or -1 on error
+    bool    send_fd(int fd);
+    int     receive_fd();
+
     // Call this to send data using print-style formatting
     int     sendf(const char* fmt, ...);
 
@@ -87,11 +335,97 @@ public:
     // Returns the socket descriptor
     int     sd() {return m_sd;}
 
+    // Returns true if the socket is open
+    bool    is_open() {return m_sd >= 0;}
+
+    // Copies data that has already been read from the socket (but not yet handed to the caller) into a
+    // buffer, without touching the socket.  Returns the number of bytes copied, 0 if none are buffered
+    int     receive_buffered(void* buffer, int length) {return drain_rx_buffer(buffer, length);}
+
 protected:
 
     // Copy another object of this type
     void    copy_object(const NetSock& rhs);
 
+    // Takes ownership of another object's socket, leaving that object closed
+    void    move_object(NetSock& rhs);
+
+    // This is the size of the chunks that we read into our receive buffer
+    enum {RX_BUFFER_SIZE = 16384};
+
+    // Reads as much data as is available into the receive buffer
+    int     fill_rx_buffer(int flags, int min_capacity = 0);
+
+    // Moves data from the receive buffer into a caller's buffer
+    int     drain_rx_buffer(void* buffer, int length);
+
+    // Returns the number of bytes waiting in the receive buffer
+    int     rx_buffered() {return m_rx_tail - m_rx_head;}
+
+    // This is the deadline that never arrives
+    static const uint64_t NO_DEADLINE = ~(uint64_t)0;
+
+    // Reads data into the receive buffer, waiting no later than the deadline for it to arrive
+    rx_status_t fill_rx_buffer_by(uint64_t deadline_ms);
+
+    // Waits for the socket to become readable.  Returns false if the deadline passes first
+    bool    wait_until(uint64_t deadline_ms);
+
+    // System calls that keep the statistics up to date
+    int     sys_recv(void* buffer, size_t length, int flags);
+    int     sys_send(const void* buffer, size_t length, int flags);
+    int     sys_sendmsg(const msghdr* msg, int flags);
+
+    // Receives data, fetching the kernel's receive timestamp when they're turned on
+    int     recv_data(void* buffer, size_t length, int flags);
+
+    // Records the result of a system call that received or sent data
+    void    count_rx(int64_t result, uint64_t wait_start_us);
+    void    count_tx(int64_t result, int64_t requested);
+
+    // Records the length of time we spent waiting for data to arrive
+    void    count_rx_wait(uint64_t wait_start_us);
+
+    // Waits a bounded time for the kernel to finish with every pending zero-copy send.  Sends that are
+    // still pending afterwards are forgotten without notifying their handlers
+    void    drain_zerocopy();
+
+    // The longest close() waits for pending zero-copy sends to complete
+    enum {ZC_CLOSE_WAIT_MS = 1000};
+
+    // This is the size of the chunks that make up the send queue
+    enum {TX_CHUNK_SIZE = 16384};
+
+    // Appends data to the send queue
+    void    queue_tx(const char* buffer, int length);
+
+    // Sends every byte in the send queue, waiting for the socket to become writable as often as needed.
+    // Returns false if an error occured
+    bool    drain_tx_queue();
+
+    // Throws away the send queue
+    void    discard_tx_queue();
+
+    // Checks the queue depth against the watermarks, and tells the handler when congestion changes
+    void    check_watermarks();
+
+    // One chunk of the send queue.  Valid data is in data[head] thru data[tail - 1]
+    struct tx_chunk_t
+    {
+        std::vector<char> data;
+        int     head, tail;
+    };
+
+    // Describes a zero-copy send whose buffer the kernel may still be using
+    struct zc_pending_t
+    {
+        uint32_t            first_seq;
+        uint32_t            last_seq;
+        uint32_t            outstanding;
+        NetZeroCopyHandler* handler;
+        void*               context;
+    };
+
     // Most recent error
     std::string m_error_str;
     int     m_error;
@@ -101,4 +435,41 @@ protected:
 
     // The socket descriptor of our socket
     int     m_sd;
+
+    // Data that has been read from the socket but not yet handed to the caller lives here.
+    // Valid data is in m_rx_buf[m_rx_head] thru m_rx_buf[m_rx_tail - 1]
+    std::vector<char> m_rx_buf;
+    int     m_rx_head, m_rx_tail;
+
+    // Zero-copy sends are used when this is true and the send is at least m_zc_threshold bytes long
+    bool    m_zc_enabled;
+    int     m_zc_threshold;
+
+    // The kernel numbers each zero-copy send call.  This is the number the next one will get
+    uint32_t m_zc_next_seq;
+
+    // The zero-copy sends whose completion notifications haven't arrived yet
+    std::vector<zc_pending_t> m_zc_pending;
+
+    // Data that send_async() couldn't send right away, and the total number of bytes in it
+    std::deque<tx_chunk_t> m_tx_queue;
+    int     m_tx_queued;
+
+    // The storage of the most recently emptied chunk, kept so the queue doesn't allocate in steady state
+    std::vector<char> m_tx_spare;
+
+    // The send queue watermarks, whether we're between them, and who to tell when that changes
+    int     m_tx_low_water, m_tx_high_water;
+    bool    m_tx_congested;
+    NetSendQueueHandler* m_tx_handler;
+
+    // When this is true, every read fetches the kernel's receive timestamp into m_rx_time
+    bool    m_rx_timestamps;
+    timespec m_rx_time;
+
+    // The I/O statistics.  This is NULL when statistics are turned off
+    netsock_stats_t* m_stats;
+
+    // True when wait_for_data() has counted the wait for data that the next read will fetch
+    bool    m_rx_wait_counted;
 };
@@ -0,0 +1,288 @@
+//==========================================================================================================
+// netsockpool.cpp - Implements a pool of re-usable outbound NetSock connections
+//==========================================================================================================
+#include <string.h>
+#include "netsockpool.h"
+using namespace std;
+
+
+//==========================================================================================================
+// pool_key_t::operator<() - Orders keys so they can be used in a std::map
+//==========================================================================================================
+bool NetSockPool::pool_key_t::operator<(const pool_key_t& rhs) const
+{
+    if (port   != rhs.port  ) return port   < rhs.port;
+    if (family != rhs.family) return family < rhs.family;
+    return host < rhs.host;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+NetSockPool::NetSockPool(int max_idle_per_key, int max_idle, int idle_timeout_ms)
+{
+    // There are no idle sockets yet
+    m_idle_count = 0;
+
+    // Save our limits
+    set_limits(max_idle_per_key, max_idle, idle_timeout_ms);
+
+    // Start out with our statistics at zero
+    reset_stats();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Destructor - Closes every idle socket
+//==========================================================================================================
+NetSockPool::~NetSockPool()
+{
+    map<pool_key_t, vector<idle_t> >::iterator it;
+
+    for (it = m_idle.begin(); it != m_idle.end(); ++it)
+    {
+        for (size_t i=0; i<it->second.size(); ++i) discard(it->second[i].sock);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_limits() - Sets the size limits and idle timeout of the pool
+//
+// Passed:  max_idle_per_key = The maximum number of idle sockets to keep for any one (host, port, family)
+//          max_idle         = The maximum number of idle sockets to keep in total
+//          idle_timeout_ms  = Idle sockets are closed after being idle for this many milliseconds
+//==========================================================================================================
+void NetSockPool::set_limits(int max_idle_per_key, int max_idle, int idle_timeout_ms)
+{
+    UniqueLock lock(m_mutex);
+    m_max_idle_per_key = max_idle_per_key;
+    m_max_idle         = max_idle;
+    m_idle_timeout_ms  = idle_timeout_ms;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// discard() - Closes and deletes a socket
+//==========================================================================================================
+void NetSockPool::discard(NetSock* sock)
+{
+    sock->close();
+    delete sock;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// acquire() - Returns a connected socket
+//
+// Passed:  host       = The name or IP address of the server
+//          port       = The TCP port number of the server
+//          family     = AF_UNSPEC, AF_INET, or AF_INET6
+//          timeout_ms = If a new connection is required, how long to wait for it.  -1 = Wait forever
+//
+// Returns: A connected socket that must eventually be handed to release(), or NULL if no connection
+//          could be established
+//==========================================================================================================
+NetSock* NetSockPool::acquire(string host, int port, int family, int timeout_ms)
+{
+    bool has_unread_data;
+
+    // Build the key that identifies this kind of connection
+    pool_key_t key;
+    key.host   = host;
+    key.port   = port;
+    key.family = family;
+
+    // We need exclusive access to the pool
+    UniqueLock lock(m_mutex);
+
+    // Find the idle sockets for this key
+    vector<idle_t>& idle = m_idle[key];
+
+    // Look for a healthy idle socket, starting with the most recently used one
+    while (!idle.empty())
+    {
+        // Remove the most recently used socket from the idle list
+        idle_t entry = idle.back();
+        idle.pop_back();
+        --m_idle_count;
+
+        // If it's been idle too long, get rid of it
+        if (entry.timer.is_expired())
+        {
+            discard(entry.sock);
+            ++m_stats.timeout_evictions;
+            continue;
+        }
+
+        // If the peer closed it, or sent us data we didn't ask for, it can't be re-used
+        if (!entry.sock->is_alive(&has_unread_data) || has_unread_data)
+        {
+            discard(entry.sock);
+            ++m_stats.dead_evictions;
+            continue;
+        }
+
+        // We found a socket we can re-use
+        ++m_stats.hits;
+        m_in_use[entry.sock] = key;
+        return entry.sock;
+    }
+
+    // If we get here, we need a new connection
+    ++m_stats.misses;
+
+    // Don't hold the lock while we're waiting for the connection to be established
+    lock.unlock();
+
+    // Create a new socket and connect it to the server
+    NetSock* sock = new NetSock;
+    uint64_t start_time = msTimer::millis();
+    bool     connected  = sock->connect(host, port, family, timeout_ms);
+    uint64_t elapsed    = msTimer::millis() - start_time;
+
+    // We need exclusive access to the pool again
+    lock.lock();
+
+    // Keep track of how long it took to connect
+    m_stats.connect_ms += elapsed;
+
+    // If we couldn't connect, tell the caller
+    if (!connected)
+    {
+        ++m_stats.connect_failures;
+        delete sock;
+        return NULL;
+    }
+
+    // Keep track of where this socket is connected to, and hand it to the caller
+    m_in_use[sock] = key;
+    return sock;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// release() - Returns a socket to the pool
+//
+// Passed:  sock     = A socket that was returned by acquire()
+//          reusable = Pass false if the connection is in an unknown state and shouldn't be re-used
+//==========================================================================================================
+void NetSockPool::release(NetSock* sock, bool reusable)
+{
+    // Ignore NULL pointers, so the result of a failed acquire() can be released
+    if (sock == NULL) return;
+
+    // We need exclusive access to the pool
+    UniqueLock lock(m_mutex);
+
+    // Find out where this socket is connected to
+    map<NetSock*, pool_key_t>::iterator it = m_in_use.find(sock);
+
+    // If this isn't one of ours, leave it alone
+    if (it == m_in_use.end()) return;
+
+    // Get a handy reference to the idle sockets for this key
+    vector<idle_t>& idle = m_idle[it->second];
+
+    // This socket is no longer in use
+    m_in_use.erase(it);
+
+    // If the caller doesn't want this socket re-used, or the socket is closed, get rid of it
+    if (!reusable || sock->sd() < 0)
+    {
+        discard(sock);
+        return;
+    }
+
+    // If there's no room in the pool for it, get rid of it
+    if ((int)idle.size() >= m_max_idle_per_key || m_idle_count >= m_max_idle)
+    {
+        discard(sock);
+        ++m_stats.overflow_evictions;
+        return;
+    }
+
+    // Add this socket to the idle list, and start its idle timer
+    idle_t entry;
+    entry.sock = sock;
+    entry.timer.start(m_idle_timeout_ms);
+    idle.push_back(entry);
+    ++m_idle_count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// evict_expired() - Closes every idle socket that has been idle longer than the idle timeout
+//==========================================================================================================
+void NetSockPool::evict_expired()
+{
+    map<pool_key_t, vector<idle_t> >::iterator it;
+
+    // We need exclusive access to the pool
+    UniqueLock lock(m_mutex);
+
+    // Loop through the idle list for each key...
+    for (it = m_idle.begin(); it != m_idle.end(); ++it)
+    {
+        vector<idle_t>& idle = it->second;
+        vector<idle_t>  keep;
+
+        // Keep the idle sockets that haven't timed out, discard the rest
+        for (size_t i=0; i<idle.size(); ++i)
+        {
+            if (idle[i].timer.is_expired())
+            {
+                discard(idle[i].sock);
+                ++m_stats.timeout_evictions;
+                --m_idle_count;
+            }
+            else
+                keep.push_back(idle[i]);
+        }
+
+        // These are the idle sockets that remain
+        idle.swap(keep);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// idle_count() - Returns the number of idle sockets in the pool
+//==========================================================================================================
+int NetSockPool::idle_count()
+{
+    UniqueLock lock(m_mutex);
+    return m_idle_count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_stats() - Fetches the pool statistics
+//==========================================================================================================
+void NetSockPool::get_stats(netsockpool_stats_t* p_stats)
+{
+    UniqueLock lock(m_mutex);
+    *p_stats = m_stats;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// reset_stats() - Clears the pool statistics
+//==========================================================================================================
+void NetSockPool::reset_stats()
+{
+    UniqueLock lock(m_mutex);
+    memset(&m_stats, 0, sizeof m_stats);
+}
+//==========================================================================================================
@@ -0,0 +1,117 @@
+//==========================================================================================================
+// netsockpool.h - Defines a pool of connected outbound NetSock objects that can be re-used
+//
+// acquire() hands out a connected socket for a (host, port, family), re-using an idle one when it can.
+// When the caller is finished with it, release() returns it to the pool.  Idle sockets are evicted when
+// the peer closes them, when they have been idle too long, or when the pool is full.
+//
+// The pool owns every socket it hands out, and must outlive them.  This class is thread-safe.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "netsock.h"
+#include "mstimer.h"
+#include "cthread.h"
+
+//==========================================================================================================
+// netsockpool_stats_t - Counters that describe how effective the pool has been
+//==========================================================================================================
+struct netsockpool_stats_t
+{
+    // The number of acquire() calls that were satisfied by an idle socket
+    uint64_t    hits;
+
+    // The number of acquire() calls that required a new connection
+    uint64_t    misses;
+
+    // The number of new connections that failed
+    uint64_t    connect_failures;
+
+    // The total number of milliseconds spent establishing new connections
+    uint64_t    connect_ms;
+
+    // The number of idle sockets that were found to be dead and were evicted
+    uint64_t    dead_evictions;
+
+    // The number of idle sockets that were evicted because they were idle too long
+    uint64_t    timeout_evictions;
+
+    // The number of released sockets that were closed because the pool was full
+    uint64_t    overflow_evictions;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// NetSockPool - A pool of re-usable outbound connections
+//==========================================================================================================
+class NetSockPool
+{
+public:
+
+    // Constructor and destructor
+    NetSockPool(int max_idle_per_key = 8, int max_idle = 256, int idle_timeout_ms = 60000);
+    ~NetSockPool();
+
+    // Call this to change the size limits and idle timeout of the pool
+    void        set_limits(int max_idle_per_key, int max_idle, int idle_timeout_ms);
+
+    // Returns a connected socket, or NULL if a connection couldn't be established
+    NetSock*    acquire(std::string host, int port, int family = AF_INET, int timeout_ms = -1);
+
+    // Returns a socket to the pool.  Pass 'reusable = false' if the connection is in an unknown state
+    void        release(NetSock* sock, bool reusable = true);
+
+    // Closes every idle socket that has been idle for longer than the idle timeout
+    void        evict_expired();
+
+    // Returns the number of idle sockets in the pool
+    int         idle_count();
+
+    // Fetches or clears the pool statistics
+    void        get_stats(netsockpool_stats_t* p_stats);
+    void        reset_stats();
+
+protected:
+
+    // This is what identifies a pooled connection
+    struct pool_key_t
+    {
+        std::string host;
+        int         port;
+        int         family;
+        bool        operator<(const pool_key_t& rhs) const;
+    };
+
+    // This describes an idle socket
+    struct idle_t
+    {
+        NetSock*    sock;
+        msTimer     timer;
+    };
+
+    // Closes and deletes a socket
+    void        discard(NetSock* sock);
+
+    // Protects every member variable
+    CMutex      m_mutex;
+
+    // The idle sockets for each key, in order of release.  The most recently released is at the back
+    std::map<pool_key_t, std::vector<idle_t> > m_idle;
+
+    // The key of each socket that has been handed out
+    std::map<NetSock*, pool_key_t> m_in_use;
+
+    // The total number of idle sockets
+    int         m_idle_count;
+
+    // Our size limits and idle timeout
+    int         m_max_idle_per_key, m_max_idle, m_idle_timeout_ms;
+
+    // Our statistics
+    netsockpool_stats_t m_stats;
+};
+//==========================================================================================================
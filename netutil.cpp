@@ -7,8 +7,36 @@
 #include <ifaddrs.h>
 #include <string>
 #include "netutil.h"
+#include "netresolver.h"
 using namespace std;
 
+//----------------------------------------------------------------------------------------------------------
+// Older system headers may not define the timestamping constants
+//----------------------------------------------------------------------------------------------------------
+#ifndef SO_TIMESTAMPNS
+#define SO_TIMESTAMPNS 35
+#endif
+
+#ifndef SCM_TIMESTAMPNS
+#define SCM_TIMESTAMPNS SO_TIMESTAMPNS
+#endif
+
+#ifndef SO_TIMESTAMPING
+#define SO_TIMESTAMPING 37
+#endif
+
+#ifndef SCM_TIMESTAMPING
+#define SCM_TIMESTAMPING SO_TIMESTAMPING
+#endif
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// If this isn't NULL, host-name lookups go through this caching resolver
+//==========================================================================================================
+NetResolver* NetUtil::m_resolver = NULL;
+//==========================================================================================================
+
 
 //==========================================================================================================
 // get_local_addrinfo() - Returns an addrinfo structure for the local machine
@@ -30,6 +58,14 @@ addrinfo_t NetUtil::get_local_addrinfo(int type, int port, string bind_to, int f
     // If we fail, our entire return structure will be zero
     memset(&result, 0, sizeof(result));
 
+    // If we're binding to a specific address and have a caching resolver, let it look the address up
+    if (m_resolver && !bind_to.empty())
+    {
+        vector<addrinfo_t> list;
+        if (m_resolver->resolve(type, bind_to, port, family, &list)) result = list[0];
+        return result;
+    }
+
     // Get a pointer to the IP address we want to bind to
     const char* bind_addr = bind_to.empty() ? NULL : bind_to.c_str();
 
@@ -74,6 +110,15 @@ bool NetUtil::get_server_addrinfo(int type, string server, int port, int family,
     // If we fail, our entire return structure will be zero
     memset(p_result, 0, sizeof(addrinfo));
 
+    // If we have a caching resolver, let it look up the server
+    if (m_resolver)
+    {
+        vector<addrinfo_t> list;
+        if (!m_resolver->resolve(type, server, port, family, &list)) return false;
+        *p_result = list[0];
+        return true;
+    }
+
     // Get an ASCII version of the port number
     sprintf(ascii_port, "%i", port);
 
@@ -101,6 +146,50 @@ bool NetUtil::get_server_addrinfo(int type, string server, int port, int family,
 
 
 
+//==========================================================================================================
+// get_server_addrinfo() - Returns every connection address for a remote server, in the order that
+//                         getaddrinfo() prefers them
+//==========================================================================================================
+bool NetUtil::get_server_addrinfo(int type, string server, int port, int family, vector<addrinfo_t>* p_list)
+{
+    char ascii_port[20];
+    struct addrinfo hints, *p_res, *ai;
+    addrinfo_t entry;
+
+    // If we fail, the caller's list will be empty
+    p_list->clear();
+
+    // If we have a caching resolver, let it look up the server
+    if (m_resolver) return m_resolver->resolve(type, server, port, family, p_list);
+
+    // Get an ASCII version of the port number
+    sprintf(ascii_port, "%i", port);
+
+    // Tell getaddrinfo about the socket family and type
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = family;
+    hints.ai_socktype = type;
+
+    // Get information about this server.  If we can't, it doesn't exist
+    if (getaddrinfo(server.c_str(), ascii_port, &hints, &p_res) != 0) return false;
+
+    // Save a copy of every result
+    for (ai = p_res; ai; ai = ai->ai_next)
+    {
+        entry = *ai;
+        p_list->push_back(entry);
+    }
+
+    // Free the memory that was allocated by getaddrinfo
+    if (p_res) freeaddrinfo(p_res);
+
+    // Tell the caller whether we found any addresses for this server
+    return !p_list->empty();
+}
+//==========================================================================================================
+
+
+
 //==========================================================================================================
 // ip_to_string() - Converts an IP address to a string
 //==========================================================================================================
@@ -426,3 +515,60 @@ void addrinfo_t::from_ai(addrinfo& ai)
     protocol = ai.ai_protocol;
 }
 //==========================================================================================================
+
+
+//==========================================================================================================
+// enable_rx_timestamps() - Turns on (or off) kernel receive timestamps (SO_TIMESTAMPNS) for a socket
+//
+// Returns: true if the kernel accepted the change
+//==========================================================================================================
+bool NetUtil::enable_rx_timestamps(int sd, bool flag)
+{
+    int value = flag ? 1 : 0;
+    return setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof value) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_rx_timestamp() - Finds the time that the kernel received a message in that message's ancillary data
+//
+// Passed:  msg    = A message that was filled in by recvmsg()
+//          p_time = Receives the timestamp (CLOCK_REALTIME).  Zeroed if there isn't one
+//
+// Returns: true if a timestamp was found
+//==========================================================================================================
+bool NetUtil::get_rx_timestamp(msghdr* msg, timespec* p_time)
+{
+    // We haven't found a timestamp yet
+    bool is_found = false;
+    memset(p_time, 0, sizeof *p_time);
+
+    // Loop through each control message...
+    for (cmsghdr* cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm))
+    {
+        // Timestamps are socket-level control messages
+        if (cm->cmsg_level != SOL_SOCKET) continue;
+
+        // SO_TIMESTAMPNS delivers a single timestamp
+        if (cm->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy(p_time, CMSG_DATA(cm), sizeof *p_time);
+            is_found = true;
+        }
+
+        // SO_TIMESTAMPING delivers a software timestamp and a hardware timestamp.  If the network card
+        // gave us one, the hardware timestamp is the better of the two
+        if (cm->cmsg_type == SCM_TIMESTAMPING)
+        {
+            timespec ts[3];
+            memcpy(ts, CMSG_DATA(cm), sizeof ts);
+            if (ts[2].tv_sec || ts[2].tv_nsec) {*p_time = ts[2]; is_found = true;}
+            else if (!is_found && (ts[0].tv_sec || ts[0].tv_nsec)) {*p_time = ts[0]; is_found = true;}
+        }
+    }
+
+    // Tell the caller whether we found a timestamp
+    return is_found;
+}
+//==========================================================================================================
@@ -3,7 +3,10 @@
 //==========================================================================================================
 #pragma once
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <string>
+#include <vector>
 #include <netdb.h>
 
 struct ipv4_t
@@ -62,8 +65,13 @@ struct addrinfo_t
     int              protocol;
 };
 
+class NetResolver;
+
 struct NetUtil
 {
+    // Call this to route host-name lookups through a caching resolver.  NULL = Call getaddrinfo() directly
+    static void set_resolver(NetResolver* resolver) {m_resolver = resolver;}
+
     // These fetch a binary IP address for the local host
     static bool get_local_ip(std::string iface, ipv4_t* dest);
     static bool get_local_ip(std::string iface, ipv6_t* dest);
@@ -74,6 +82,9 @@ struct NetUtil
     // Returns addrinfo about a remove server
     static bool get_server_addrinfo(int type, std::string server, int port, int family, addrinfo_t* p_result);
 
+    // Returns every addrinfo result for a remote server
+    static bool get_server_addrinfo(int type, std::string server, int port, int family, std::vector<addrinfo_t>* p_list);
+
     // Fetches the ASCII IP address from a sockaddr*.  
     static std::string ip_to_string(sockaddr* addr);
 
@@ -83,6 +94,17 @@ struct NetUtil
     // Call this to wait for data to arrive on anywhere from 1 to 4 descriptors
     // timeout_ms of -1 means "wait forever"
     static int wait_for_data(int timeout_ms, int fd1, int fd2 = -1, int fd3 = -1, int fd4 = -1);
+
+    // Call this to have the kernel record (with nanosecond resolution) when data arrives on a socket
+    static bool enable_rx_timestamps(int sd, bool flag);
+
+    // Finds the kernel receive timestamp in the ancillary data of a message received by recvmsg()
+    static bool get_rx_timestamp(msghdr* msg, timespec* p_time);
+
+protected:
+
+    // If this isn't NULL, host-name lookups go through it
+    static NetResolver* m_resolver;
 };
 
 
@@ -0,0 +1,713 @@
+//==========================================================================================================
+// rudpsock.cpp - Implements a reliable, sequenced message layer on top of a UDPSock
+//==========================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include "rudpsock.h"
+using namespace std;
+
+
+//==========================================================================================================
+// This is the "time" of a timer that isn't running
+//==========================================================================================================
+static const uint64_t NO_TIMER = ~(uint64_t)0;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// monotonic_ms() - Returns the time of the monotonic clock in milliseconds.  Timers are based on this so
+//                  that changes to the wall clock don't affect them
+//==========================================================================================================
+static uint64_t monotonic_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// new_session() - Picks a session number that is unlikely to match that of a previous run of the sender
+//==========================================================================================================
+static uint32_t new_session()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint32_t session = (uint32_t)ts.tv_nsec ^ (uint32_t)ts.tv_sec * 2654435761u ^ (uint32_t)getpid() << 16;
+    return session ? session : 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// seq_diff() - Returns how far sequence number 'a' is past sequence number 'b', allowing for wrap-around
+//==========================================================================================================
+static inline int32_t seq_diff(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor() - Attaches to a socket and resets the channel
+//==========================================================================================================
+RUDPSock::RUDPSock(UDPSock* sock)
+{
+    m_sock         = sock;
+    m_nak_delay_ms = DEFAULT_NAK_DELAY_MS;
+    m_nak_retry_ms = DEFAULT_NAK_RETRY_MS;
+    m_max_naks     = DEFAULT_MAX_NAKS;
+    m_heartbeat_ms = DEFAULT_HEARTBEAT_MS;
+    m_rx_buffer.resize(65536);
+    set_history_size(DEFAULT_HISTORY_SIZE);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// attach() - Attaches to a (different) socket and resets the channel
+//==========================================================================================================
+void RUDPSock::attach(UDPSock* sock)
+{
+    m_sock = sock;
+    reset();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_history_size() - Sets the size of the send history and of the receive window
+//==========================================================================================================
+void RUDPSock::set_history_size(int messages)
+{
+    // Round the size up to a power of 2, so that wrapping sequence numbers index the ring correctly
+    m_size = 1;
+    while (m_size < (uint32_t)messages && m_size < 0x10000) m_size <<= 1;
+    m_mask = m_size - 1;
+
+    // Throw away the old history and window, and start over
+    m_history.clear();
+    m_window.clear();
+    m_history.resize(m_size);
+    m_window.resize(m_size);
+    reset();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_nak_timing() - Sets how NAKs are scheduled
+//
+// Passed:  delay_ms = How long to wait after detecting a gap before NAKing it, to allow for reordering
+//          retry_ms = How long to wait for a re-sent message before NAKing it again
+//          max_naks = How many times to NAK a message before giving up on it
+//==========================================================================================================
+void RUDPSock::set_nak_timing(int delay_ms, int retry_ms, int max_naks)
+{
+    m_nak_delay_ms = delay_ms;
+    m_nak_retry_ms = retry_ms;
+    m_max_naks     = max_naks;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// reset() - Forgets everything we know about the messages we've sent and received
+//==========================================================================================================
+void RUDPSock::reset()
+{
+    // Nothing in the history is valid
+    for (uint32_t i=0; i<m_history.size(); ++i) m_history[i].is_valid = false;
+
+    // We haven't sent anything, and we're starting a new session
+    m_tx_session        = new_session();
+    m_tx_seq            = 0;
+    m_has_sent          = false;
+    m_next_heartbeat_ms = NO_TIMER;
+
+    // We haven't received anything
+    m_rx_session  = 0;
+    m_rx_expected = 0;
+    m_rx_unseen   = 0;
+    m_is_synced   = false;
+    m_next_nak_ms = NO_TIMER;
+    m_peer.ip.clear();
+    m_peer.port   = 0;
+    m_peer.family = AF_UNSPEC;
+
+    // Clear the statistics
+    m_lost        = 0;
+    m_retransmits = 0;
+    m_naks_sent   = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send() - Sends a message, and keeps a copy of it in the history in case it has to be re-sent
+//
+// Passed:  msg    = The message to send
+//          length = The length of the message, in bytes.  Must be at least 1
+//
+// Returns: The length of the message, or -1 on error
+//==========================================================================================================
+int RUDPSock::send(const void* msg, int length)
+{
+    // If we have no socket, or the message won't fit in a datagram, we can't send it
+    if (m_sock == NULL || length <= 0 || length > MAX_MESSAGE) return -1;
+
+    // This is where the message goes in the history
+    tx_slot_t& slot = m_history[m_tx_seq & m_mask];
+
+    // Build the packet in the history slot
+    slot.packet.resize(sizeof(rudp_header_t) + length);
+    rudp_header_t* header = (rudp_header_t*)&slot.packet[0];
+    header->type     = RUDP_DATA;
+    header->version  = RUDP_VERSION;
+    header->count    = 0;
+    header->session  = m_tx_session;
+    header->sequence = m_tx_seq;
+    memcpy(&slot.packet[sizeof(rudp_header_t)], msg, length);
+    slot.seq      = m_tx_seq;
+    slot.is_valid = true;
+
+    // Send it
+    m_sock->send(&slot.packet[0], slot.packet.size());
+
+    // The next message gets the next sequence number
+    ++m_tx_seq;
+    m_has_sent = true;
+
+    // We don't need to send a heartbeat until we've been idle for a while
+    m_next_heartbeat_ms = monotonic_ms() + m_heartbeat_ms;
+
+    // Tell the caller that the message was sent
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive() - Waits for the next message, in order
+//
+// Passed:  buffer     = Where to store the message
+//          buf_size   = The size of the buffer
+//          timeout_ms = How long to wait for a message.  -1 = Wait forever
+//
+// Returns: The length of the message, 0 on timeout, or -1 on error
+//==========================================================================================================
+int RUDPSock::receive(void* buffer, int buf_size, int timeout_ms)
+{
+    return pump(buffer, buf_size, timeout_ms);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// service() - Answers NAKs, sends heartbeats and NAKs, and buffers arriving messages
+//
+// Passed:  timeout_ms = How long to keep servicing the channel.  0 = Only handle what's already waiting
+//
+// Returns: false if there was an error on the socket
+//==========================================================================================================
+bool RUDPSock::service(int timeout_ms)
+{
+    return pump(NULL, 0, timeout_ms) >= 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// pump() - Handles arriving packets and timers until a message can be delivered or the timeout expires
+//
+// Passed:  buffer     = Where to store a delivered message.  If NULL, messages are buffered instead
+//          buf_size   = The size of the buffer
+//          timeout_ms = How long to wait.  -1 = Wait forever
+//
+// Returns: The length of a delivered message, 0 on timeout, or -1 on error
+//==========================================================================================================
+int RUDPSock::pump(void* buffer, int buf_size, int timeout_ms)
+{
+    udp_peer_t from;
+
+    // If we have no socket, there's nothing to receive from
+    if (m_sock == NULL) return -1;
+
+    // Find out when we have to give up
+    uint64_t deadline = timeout_ms < 0 ? NO_TIMER : monotonic_ms() + timeout_ms;
+
+    // The number of packets we've handled since the deadline passed
+    int drained = 0;
+
+    while (true)
+    {
+        // Send any NAKs and heartbeats that are due
+        uint64_t now = monotonic_ms();
+        service_timers(now);
+
+        // If the message the caller is waiting for is buffered, hand it over
+        if (buffer)
+        {
+            int length = deliver_buffered(buffer, buf_size);
+            if (length) return length;
+        }
+
+        // Once we've run out of time, we only handle packets that are already waiting, and only a few
+        bool is_expired = (deadline != NO_TIMER && now >= deadline);
+        if (is_expired && drained >= MAX_DRAIN) return 0;
+
+        // Find out how long we can wait before we time out or a timer expires
+        uint64_t wake = deadline;
+        if (m_next_nak_ms < wake) wake = m_next_nak_ms;
+        if (m_has_sent && m_next_heartbeat_ms < wake) wake = m_next_heartbeat_ms;
+        int wait_ms = (wake == NO_TIMER) ? -1 : (wake > now ? wake - now : 0);
+
+        // Wait for a packet to arrive.  If none did and we've run out of time, tell the caller
+        if (!m_sock->wait_for_data(wait_ms))
+        {
+            if (is_expired) return 0;
+            continue;
+        }
+
+        // Keep track of how many packets we handle after the deadline
+        if (is_expired) ++drained;
+
+        // Fetch the packet
+        int length = m_sock->receive_from(&m_rx_buffer[0], m_rx_buffer.size(), &from);
+        if (length < 0) return -1;
+
+        // Handle it.  If it's the message the caller is waiting for, we're done
+        length = handle_packet(length, from, buffer, buf_size);
+        if (length) return length;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// handle_packet() - Handles a packet that has arrived in m_rx_buffer
+//
+// Passed:  length   = The length of the packet
+//          from     = The peer that sent it
+//          buffer   = Where to deliver a message, or NULL
+//          buf_size = The size of the buffer
+//
+// Returns: The length of a message delivered to 'buffer', or 0 if none was
+//==========================================================================================================
+int RUDPSock::handle_packet(int length, const udp_peer_t& from, void* buffer, int buf_size)
+{
+    // If this isn't one of our packets, ignore it
+    if (length < (int)sizeof(rudp_header_t)) return 0;
+    rudp_header_t* header = (rudp_header_t*)&m_rx_buffer[0];
+    if (header->version != RUDP_VERSION) return 0;
+
+    // Fetch the fields of the header
+    uint32_t session = header->session;
+    uint32_t seq     = header->sequence;
+    int      count   = header->count;
+
+    // And handle the packet according to its type
+    switch (header->type)
+    {
+        case RUDP_DATA:
+            m_peer = from;
+            return on_data(session, seq, &m_rx_buffer[sizeof(rudp_header_t)], length - sizeof(rudp_header_t),
+                           buffer, buf_size);
+
+        case RUDP_HEARTBEAT:
+            m_peer = from;
+            on_heartbeat(session, seq);
+            break;
+
+        case RUDP_NAK:
+            on_nak(session, seq, count, from);
+            break;
+
+        case RUDP_LOST:
+            on_lost(session, seq, count);
+            break;
+    }
+
+    // No message was delivered
+    return 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// on_data() - Handles an arriving message
+//
+// Passed:  session  = The sender's session
+//          seq      = The sequence number of the message
+//          payload  = The message
+//          length   = The length of the message
+//          buffer   = Where to deliver the message if it's the next one in order, or NULL
+//          buf_size = The size of the buffer
+//
+// Returns: The length of the message if it was delivered to 'buffer', otherwise 0
+//==========================================================================================================
+int RUDPSock::on_data(uint32_t session, uint32_t seq, const char* payload, int length, void* buffer, int buf_size)
+{
+    // Empty messages are never sent
+    if (length <= 0) return 0;
+
+    // If this is the first message we've seen, or the sender has restarted, start receiving here
+    if (!m_is_synced || session != m_rx_session) sync(session, seq);
+
+    // If we've already delivered (or given up on) this message, ignore it
+    if (seq_diff(seq, m_rx_expected) < 0) return 0;
+
+    // If there's no room to buffer this message, drop it.  It will be NAKed later
+    if (!make_room(seq)) return 0;
+
+    // If this is a new message, any we haven't seen before it are missing
+    if (seq_diff(seq, m_rx_unseen) >= 0)
+    {
+        note_gap(seq, monotonic_ms());
+        m_rx_unseen = seq + 1;
+    }
+
+    // Otherwise, if we already have it, it's a duplicate
+    else if (m_window[seq & m_mask].state == RX_PRESENT) return 0;
+
+    // If this is the message the caller is waiting for, hand it over without buffering it
+    if (seq == m_rx_expected && buffer)
+    {
+        ++m_rx_expected;
+        skip_lost();
+        return copy_out(payload, length, buffer, buf_size);
+    }
+
+    // Otherwise, buffer it until the messages before it have been delivered
+    rx_slot_t& slot = m_window[seq & m_mask];
+    slot.state = RX_PRESENT;
+    slot.data.assign(payload, payload + length);
+    return 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// on_heartbeat() - Handles a heartbeat.  Any message before 'next_seq' that we haven't seen is missing
+//==========================================================================================================
+void RUDPSock::on_heartbeat(uint32_t session, uint32_t next_seq)
+{
+    // If this is the first packet we've seen, or the sender has restarted, start receiving with the
+    // sender's next message
+    if (!m_is_synced || session != m_rx_session)
+    {
+        sync(session, next_seq);
+        return;
+    }
+
+    // If we already know about every message the sender has sent, there's nothing to do
+    if (seq_diff(next_seq, m_rx_unseen) <= 0) return;
+
+    // Otherwise, the ones we haven't seen are missing
+    if (make_room(next_seq - 1)) note_gap(next_seq, monotonic_ms());
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// on_nak() - Re-sends the messages a receiver is missing
+//
+// Passed:  session = The session the NAK refers to
+//          first   = The sequence number of the first missing message
+//          count   = The number of missing messages
+//          from    = The receiver that sent the NAK
+//==========================================================================================================
+void RUDPSock::on_nak(uint32_t session, uint32_t first, int count, const udp_peer_t& from)
+{
+    uint32_t lost_first = 0;
+    int      lost_count = 0;
+
+    // If we haven't sent anything, or the NAK is about a previous session, there's nothing to re-send
+    if (!m_has_sent || session != m_tx_session) return;
+
+    // We can never re-send more messages than the history holds
+    if (count > (int)m_size) count = m_size;
+
+    for (int i=0; i<count; ++i)
+    {
+        uint32_t seq = first + i;
+
+        // If we haven't sent this message yet, the receiver is confused
+        if (seq_diff(seq, m_tx_seq) >= 0) break;
+
+        // If the message is still in the history, re-send it
+        tx_slot_t& slot = m_history[seq & m_mask];
+        if (slot.is_valid && slot.seq == seq)
+        {
+            m_sock->send_to(&slot.packet[0], slot.packet.size(), from);
+            ++m_retransmits;
+            continue;
+        }
+
+        // Otherwise, tell the receiver it's gone
+        if (lost_count == 0) lost_first = seq;
+        ++lost_count;
+    }
+
+    // Tell the receiver about the messages we couldn't re-send
+    if (lost_count) send_control(RUDP_LOST, m_tx_session, lost_first, lost_count, &from);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// on_lost() - Gives up on messages the sender can't re-send
+//==========================================================================================================
+void RUDPSock::on_lost(uint32_t session, uint32_t first, int count)
+{
+    // If this is about a previous session of the sender, it doesn't matter
+    if (!m_is_synced || session != m_rx_session) return;
+
+    for (int i=0; i<count; ++i)
+    {
+        uint32_t seq = first + i;
+
+        // Messages we've already delivered or haven't heard of don't matter
+        if (seq_diff(seq, m_rx_expected) < 0 || seq_diff(seq, m_rx_unseen) >= 0) continue;
+
+        // If we're still waiting for this one, stop waiting
+        rx_slot_t& slot = m_window[seq & m_mask];
+        if (slot.state == RX_MISSING) slot.state = RX_LOST;
+    }
+
+    // Step past anything we've given up on
+    skip_lost();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// service_timers() - Sends a heartbeat if one is due, and NAKs any missing messages that are due
+//==========================================================================================================
+void RUDPSock::service_timers(uint64_t now)
+{
+    // If we've been idle for a while, tell the receiver what our next message will be
+    if (m_has_sent && now >= m_next_heartbeat_ms)
+    {
+        send_control(RUDP_HEARTBEAT, m_tx_session, m_tx_seq, 0, NULL);
+        m_next_heartbeat_ms = now + m_heartbeat_ms;
+    }
+
+    // If no NAK is due, we're done
+    if (now < m_next_nak_ms) return;
+
+    // We'll find out when the next NAK is due as we go
+    m_next_nak_ms = NO_TIMER;
+
+    // This is the run of consecutive messages we're about to NAK
+    uint32_t run_first = 0;
+    int      run_count = 0;
+
+    // Look at every message we're waiting for
+    for (uint32_t seq = m_rx_expected; seq != m_rx_unseen; ++seq)
+    {
+        rx_slot_t& slot = m_window[seq & m_mask];
+
+        // If we aren't missing this message, skip it
+        if (slot.state != RX_MISSING) continue;
+
+        // If its NAK isn't due yet, keep track of when it will be
+        if (slot.nak_due_ms > now)
+        {
+            if (slot.nak_due_ms < m_next_nak_ms) m_next_nak_ms = slot.nak_due_ms;
+            continue;
+        }
+
+        // If we've NAKed it enough times, give up on it
+        if (slot.nak_count >= m_max_naks)
+        {
+            slot.state = RX_LOST;
+            continue;
+        }
+
+        // Schedule the next NAK for this message, in case the re-sent message is lost too
+        ++slot.nak_count;
+        slot.nak_due_ms = now + m_nak_retry_ms;
+        if (slot.nak_due_ms < m_next_nak_ms) m_next_nak_ms = slot.nak_due_ms;
+
+        // If this message extends the current run, we're done with it
+        if (run_count && run_first + run_count == seq && run_count < 0xFFFF)
+        {
+            ++run_count;
+            continue;
+        }
+
+        // Otherwise, NAK the current run and start a new one
+        if (run_count) send_control(RUDP_NAK, m_rx_session, run_first, run_count, &m_peer);
+        run_first = seq;
+        run_count = 1;
+    }
+
+    // NAK the last run
+    if (run_count) send_control(RUDP_NAK, m_rx_session, run_first, run_count, &m_peer);
+
+    // Step past anything we've given up on
+    skip_lost();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_control() - Sends a packet that consists of only a header
+//
+// Passed:  type    = The type of packet
+//          session = The session number to put in the header
+//          seq     = The sequence number to put in the header
+//          count   = The count to put in the header
+//          to      = The peer to send to, or NULL for the socket's target
+//==========================================================================================================
+void RUDPSock::send_control(int type, uint32_t session, uint32_t seq, int count, const udp_peer_t* to)
+{
+    rudp_header_t header;
+
+    // Fill in the header
+    header.type     = type;
+    header.version  = RUDP_VERSION;
+    header.count    = count;
+    header.session  = session;
+    header.sequence = seq;
+
+    // And send it
+    if (to)
+        m_sock->send_to(&header, sizeof header, *to);
+    else
+        m_sock->send(&header, sizeof header);
+
+    // Count the NAKs we send
+    if (type == RUDP_NAK) ++m_naks_sent;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sync() - Starts receiving a session at the specified sequence number.  Anything buffered from a
+//          previous session is forgotten
+//==========================================================================================================
+void RUDPSock::sync(uint32_t session, uint32_t seq)
+{
+    m_rx_session  = session;
+    m_next_nak_ms = NO_TIMER;
+    m_rx_expected = seq;
+    m_rx_unseen   = seq;
+    m_is_synced   = true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// make_room() - Makes sure that 'seq' fits in the receive window
+//
+// Returns: false if it can't, because the window is full of messages the caller hasn't taken yet
+//
+// If the window has to slide forward, messages at the front of it that are still missing are given up on
+//==========================================================================================================
+bool RUDPSock::make_room(uint32_t seq)
+{
+    while (seq_diff(seq, m_rx_expected) >= (int32_t)m_size)
+    {
+        // If every message we know of has been delivered, jump straight to the start of the new window
+        if (m_rx_expected == m_rx_unseen)
+        {
+            uint32_t start = seq - m_size + 1;
+            m_lost += start - m_rx_expected;
+            m_rx_expected = start;
+            m_rx_unseen   = start;
+            break;
+        }
+
+        // If the message at the front of the window is waiting to be delivered, we can't slide past it
+        if (m_window[m_rx_expected & m_mask].state == RX_PRESENT) return false;
+
+        // Give up on the message at the front of the window
+        ++m_lost;
+        ++m_rx_expected;
+    }
+
+    // There's room for the message
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// note_gap() - Marks every message from m_rx_unseen up to (but not including) 'seq' as missing
+//==========================================================================================================
+void RUDPSock::note_gap(uint32_t seq, uint64_t now)
+{
+    // If there's no gap, there's nothing to do
+    if (seq == m_rx_unseen) return;
+
+    // Each missing message will be NAKed after a short delay, in case it was merely reordered
+    uint64_t nak_due_ms = now + m_nak_delay_ms;
+    for (; m_rx_unseen != seq; ++m_rx_unseen)
+    {
+        rx_slot_t& slot = m_window[m_rx_unseen & m_mask];
+        slot.state      = RX_MISSING;
+        slot.nak_due_ms = nak_due_ms;
+        slot.nak_count  = 0;
+    }
+
+    // Make sure the NAK timer will fire in time
+    if (nak_due_ms < m_next_nak_ms) m_next_nak_ms = nak_due_ms;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// skip_lost() - Steps past messages at the front of the window that we've given up on
+//==========================================================================================================
+void RUDPSock::skip_lost()
+{
+    while (m_rx_expected != m_rx_unseen && m_window[m_rx_expected & m_mask].state == RX_LOST)
+    {
+        ++m_lost;
+        ++m_rx_expected;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// deliver_buffered() - Delivers the next message if it's already in the window
+//
+// Returns: The length of the message, or 0 if it isn't here yet
+//==========================================================================================================
+int RUDPSock::deliver_buffered(void* buffer, int buf_size)
+{
+    // Step past anything we've given up on
+    skip_lost();
+
+    // If we don't have the next message yet, there's nothing to deliver
+    if (m_rx_expected == m_rx_unseen) return 0;
+    rx_slot_t& slot = m_window[m_rx_expected & m_mask];
+    if (slot.state != RX_PRESENT) return 0;
+
+    // Hand the message to the caller and move on to the next one
+    ++m_rx_expected;
+    int length = copy_out(&slot.data[0], slot.data.size(), buffer, buf_size);
+    skip_lost();
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// copy_out() - Copies a message to the caller's buffer, truncating it if need be
+//
+// Returns: The number of bytes copied
+//==========================================================================================================
+int RUDPSock::copy_out(const char* data, int length, void* buffer, int buf_size)
+{
+    if (length > buf_size) length = buf_size;
+    memcpy(buffer, data, length);
+    return length;
+}
+//==========================================================================================================
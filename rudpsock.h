@@ -0,0 +1,205 @@
+//==========================================================================================================
+// rudpsock.h - Defines a reliable, sequenced message layer on top of a UDPSock
+//
+// Every message carries a 32-bit sequence number.  The receiver delivers messages in order, buffering
+// any that arrive early.  When it sees a gap, it waits briefly (in case the missing message was merely
+// reordered) and then sends a NAK asking for the missing messages.  The sender keeps its most recent
+// messages in a history ring and re-sends whatever is NAKed.  If a NAKed message has already left the
+// history, the sender says so and the receiver skips it, so a loss never stalls the channel the way it
+// would stall a TCP stream.
+//
+// While idle, the sender sends periodic heartbeats that carry the next sequence number, so that the
+// receiver can detect (and NAK) a loss at the end of a burst.
+//
+// Every packet also carries a session number that the sender picks at random when it starts.  If the
+// sender restarts (and its sequence numbers start over), the receiver sees a new session and resyncs.
+//
+// Timers only run while receive() or service() is being called.  A sender that never receives messages
+// should call service() regularly so that it can answer NAKs and send heartbeats.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "udpsock.h"
+#include "endian_types.h"
+
+class RUDPSock
+{
+public:
+
+    // Constructor.  'sock' is the socket that messages are sent and received on
+    RUDPSock(UDPSock* sock = NULL);
+
+    // Call this to attach to a (different) socket.  The state of the channel is reset
+    void    attach(UDPSock* sock);
+
+    // Sets the number of sent messages kept for re-sending, and the number of out-of-order messages that
+    // can be buffered.  It's rounded up to a power of 2, and capped at 65536.  The state of the channel
+    // is reset
+    void    set_history_size(int messages);
+
+    // Sets how long to wait after detecting a gap before sending a NAK, how long to wait before NAKing
+    // again, and how many NAKs to send before giving up on a message
+    void    set_nak_timing(int delay_ms, int retry_ms, int max_naks);
+
+    // Sets how often an idle sender sends a heartbeat
+    void    set_heartbeat_interval(int interval_ms) {m_heartbeat_ms = interval_ms;}
+
+    // Sends a message.  Returns the length of the message, or -1 on error
+    int     send(const void* msg, int length);
+
+    // Waits for the next message, in order.  Returns the length of the message, 0 on timeout, or -1 on
+    // error.  Messages longer than 'buf_size' are truncated
+    int     receive(void* buffer, int buf_size, int timeout_ms = -1);
+
+    // Answers NAKs, sends heartbeats and NAKs, and buffers arriving messages, for up to 'timeout_ms'.
+    // Returns false on error
+    bool    service(int timeout_ms = 0);
+
+    // Returns the sequence number the next message we send will have
+    uint32_t next_sequence() {return m_tx_seq;}
+
+    // Statistics: messages we gave up on, messages we re-sent, and NAKs we sent
+    uint64_t lost()        {return m_lost;}
+    uint64_t retransmits() {return m_retransmits;}
+    uint64_t naks_sent()   {return m_naks_sent;}
+
+protected:
+
+    // Default settings
+    enum
+    {
+        DEFAULT_HISTORY_SIZE = 1024,
+        DEFAULT_NAK_DELAY_MS = 2,
+        DEFAULT_NAK_RETRY_MS = 20,
+        DEFAULT_MAX_NAKS     = 5,
+        DEFAULT_HEARTBEAT_MS = 100
+    };
+
+    // The version of the protocol, and the largest message that fits in a datagram
+    enum {RUDP_VERSION = 2, MAX_MESSAGE = 65507 - 12};
+
+    // Once the timeout of receive() or service() has expired, this is the most packets that are already
+    // waiting that we'll handle before returning
+    enum {MAX_DRAIN = 64};
+
+    // The types of packets on the wire
+    enum
+    {
+        RUDP_DATA      = 1,     // 'sequence' = The number of the message that follows the header
+        RUDP_HEARTBEAT = 2,     // 'sequence' = The number of the next message the sender will send
+        RUDP_NAK       = 3,     // Please re-send messages 'sequence' thru 'sequence + count - 1'
+        RUDP_LOST      = 4      // Messages 'sequence' thru 'sequence + count - 1' can't be re-sent
+    };
+
+    // The header at the front of every packet.  'session' identifies the sender's session; NAK and
+    // LOST packets carry the session they refer to
+    struct rudp_header_t
+    {
+        unsigned char type;
+        unsigned char version;
+        be_uint16_t   count;
+        be_uint32_t   session;
+        be_uint32_t   sequence;
+    };
+
+    // A message in the send history
+    struct tx_slot_t
+    {
+        tx_slot_t() {is_valid = false; seq = 0;}
+        bool        is_valid;
+        uint32_t    seq;
+        std::vector<char> packet;
+    };
+
+    // The state of a message the receiver is waiting for
+    enum {RX_MISSING, RX_PRESENT, RX_LOST};
+
+    // A message in the receive window
+    struct rx_slot_t
+    {
+        rx_slot_t() {state = RX_MISSING; nak_due_ms = 0; nak_count = 0;}
+        int         state;
+        uint64_t    nak_due_ms;
+        int         nak_count;
+        std::vector<char> data;
+    };
+
+    // Forgets everything we know about the messages we've sent and received
+    void    reset();
+
+    // Does the work of receive() and service().  If 'buffer' is NULL, no message is delivered
+    int     pump(void* buffer, int buf_size, int timeout_ms);
+
+    // Handles a packet that has arrived.  Returns the length of a message delivered to 'buffer', or 0
+    int     handle_packet(int length, const udp_peer_t& from, void* buffer, int buf_size);
+
+    // Handles each type of packet
+    int     on_data(uint32_t session, uint32_t seq, const char* payload, int length, void* buffer, int buf_size);
+    void    on_heartbeat(uint32_t session, uint32_t next_seq);
+    void    on_nak(uint32_t session, uint32_t first, int count, const udp_peer_t& from);
+    void    on_lost(uint32_t session, uint32_t first, int count);
+
+    // Sends heartbeats and NAKs that are due
+    void    service_timers(uint64_t now);
+
+    // Sends a packet that has no payload.  If 'to' is NULL it goes to the socket's target
+    void    send_control(int type, uint32_t session, uint32_t seq, int count, const udp_peer_t* to);
+
+    // Starts receiving a session at the specified sequence number
+    void    sync(uint32_t session, uint32_t seq);
+
+    // Makes room in the receive window for 'seq'.  Returns false if it can't
+    bool    make_room(uint32_t seq);
+
+    // Marks every message before 'seq' that we haven't seen yet as missing
+    void    note_gap(uint32_t seq, uint64_t now);
+
+    // Steps past messages we've given up on
+    void    skip_lost();
+
+    // Delivers the next message if we have it buffered.  Returns its length, or 0
+    int     deliver_buffered(void* buffer, int buf_size);
+
+    // Copies a message to the caller's buffer and returns its (possibly truncated) length
+    int     copy_out(const char* data, int length, void* buffer, int buf_size);
+
+    // The socket we send and receive on
+    UDPSock* m_sock;
+
+    // Settings
+    int     m_nak_delay_ms, m_nak_retry_ms, m_max_naks, m_heartbeat_ms;
+
+    // The size of the history and the receive window (a power of 2), and the mask for indexing them
+    uint32_t m_size, m_mask;
+
+    // The send history, our session number, the number of the next message we'll send, and whether
+    // we've sent any
+    std::vector<tx_slot_t> m_history;
+    uint32_t m_tx_session;
+    uint32_t m_tx_seq;
+    bool     m_has_sent;
+
+    // When the next heartbeat is due
+    uint64_t m_next_heartbeat_ms;
+
+    // The receive window.  m_rx_expected is the next message to deliver, and m_rx_unseen is one past
+    // the highest numbered message we know of.  m_rx_session is the sender's session
+    std::vector<rx_slot_t> m_window;
+    uint32_t m_rx_session;
+    uint32_t m_rx_expected, m_rx_unseen;
+    bool     m_is_synced;
+
+    // When the next NAK is due
+    uint64_t m_next_nak_ms;
+
+    // The peer we receive messages from.  NAKs are sent here
+    udp_peer_t m_peer;
+
+    // Packets arrive here
+    std::vector<char> m_rx_buffer;
+
+    // Statistics
+    uint64_t m_lost, m_retransmits, m_naks_sent;
+};
+//==========================================================================================================
@@ -17,7 +17,7 @@ static volatile int bitbucket;
 //============================================================================
 // Constructor() - Serial port begins in the 'closed' state
 //============================================================================
-CSerialPort::CSerialPort() {m_fd = -1; m_default_timeout_ms = SP_NO_TIMEOUT;}
+CSerialPort::CSerialPort() {m_fd = -1; m_sniff = false; m_default_timeout_ms = SP_NO_TIMEOUT;}
 //============================================================================
 
 
@@ -28,6 +28,47 @@ CSerialPort::~CSerialPort() {close();}
 //============================================================================
 
 
+#if __cplusplus >= 201103L
+//============================================================================
+// Move constructor - Takes ownership of another object's serial port
+//============================================================================
+CSerialPort::CSerialPort(CSerialPort&& rhs)
+{
+    m_fd                 = rhs.m_fd;
+    m_sniff              = rhs.m_sniff;
+    m_default_timeout_ms = rhs.m_default_timeout_ms;
+
+    // The other object no longer owns the serial port
+    rhs.m_fd = -1;
+}
+//============================================================================
+
+
+//============================================================================
+// Move assignment - Closes our serial port and takes ownership of another
+//                   object's serial port
+//============================================================================
+CSerialPort& CSerialPort::operator=(CSerialPort&& rhs)
+{
+    // Moving an object onto itself changes nothing
+    if (&rhs == this) return *this;
+
+    // Give up whatever serial port we already have
+    close();
+
+    // Take over the other object's serial port and settings
+    m_fd                 = rhs.m_fd;
+    m_sniff              = rhs.m_sniff;
+    m_default_timeout_ms = rhs.m_default_timeout_ms;
+
+    // The other object no longer owns the serial port
+    rhs.m_fd = -1;
+    return *this;
+}
+//============================================================================
+#endif
+
+
 //============================================================================
 // set_default_read_timeout() - Sets the default timeout for all operations 
 //                              that read data from the serial port.   This 
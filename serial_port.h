@@ -26,6 +26,16 @@ public:
     CSerialPort();
     ~CSerialPort();
 
+#if __cplusplus >= 201103L
+    // A port owns its file descriptor, so it can be moved but not copied
+    CSerialPort(const CSerialPort& rhs) = delete;
+    CSerialPort& operator=(const CSerialPort& rhs) = delete;
+
+    // Move constructor and move assignment.  The object moved from is left closed
+    CSerialPort(CSerialPort&& rhs);
+    CSerialPort& operator=(CSerialPort&& rhs);
+#endif
+
     // Call this to set the default timeout for functions that read data
     void    set_default_read_timeout(int milliseconds);
 
@@ -0,0 +1,682 @@
+//==========================================================================================================
+// shmring.cpp - Implements a shared-memory message ring for passing messages between processes
+//
+// The ring is a bounded queue of slots in the style of Dmitry Vyukov's: every slot carries a sequence
+// number that tells producers and the consumer whose turn it is to use the slot, so no locks are needed.
+//==========================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+using namespace std;
+
+
+//==========================================================================================================
+// This identifies shared memory that holds a ring
+//==========================================================================================================
+static const uint32_t SHMRING_MAGIC = 0x53524E47;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// cpu_relax() - Tells the CPU we're spinning, so it can save power and yield to a sibling hyperthread
+//==========================================================================================================
+static inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("pause" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// monotonic_ms() - Returns the time of the monotonic clock in milliseconds, so that a wait isn't thrown off
+//                  when the wall-clock time is changed
+//==========================================================================================================
+static uint64_t monotonic_ms()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// header_size() - Returns the size of the ring header, rounded up to a whole number of cache lines
+//==========================================================================================================
+static size_t header_size(size_t size)
+{
+    return (size + 63) & ~(size_t)63;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+ShmRing::ShmRing()
+{
+    // We're not attached to a ring
+    m_header      = NULL;
+    m_map_size    = 0;
+    m_slots       = NULL;
+    m_slot_stride = 0;
+    m_slot_size   = 0;
+    m_mask        = 0;
+    m_is_server   = false;
+    m_error       = 0;
+
+    // If the other side can't be running while we spin, we may as well go straight to sleep
+    m_spin_count = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SPIN_COUNT : 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// map() - Maps a shared-memory object into our address space
+//
+// Returns: true if it worked
+//==========================================================================================================
+bool ShmRing::map(int fd, size_t size)
+{
+    // Map the shared-memory object
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // If that failed, tell the caller
+    if (p == MAP_FAILED) return false;
+
+    // The ring header is at the front of the shared memory
+    m_header   = (shmring_header_t*)p;
+    m_map_size = size;
+
+    // And the slots come right after it
+    m_slots = (char*)p + header_size(sizeof(shmring_header_t));
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// is_in_use() - Checks whether a ring's consumer is still running
+//
+// Passed:  fd = A descriptor of the ring's shared-memory object
+//
+// Returns: false if the consumer closed the ring or died without closing it, otherwise true
+//
+// A ring that is too small to hold a header, or whose header doesn't have a process ID in it yet, is
+// still being created by another consumer, so it counts as in use
+//==========================================================================================================
+bool ShmRing::is_in_use(int fd)
+{
+    struct stat info;
+
+    // If it isn't large enough to hold a header yet, its consumer is still creating it
+    if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(shmring_header_t)) return true;
+
+    // Map the ring header so we can look at it.  If we can't, assume the worst
+    void* p = mmap(NULL, sizeof(shmring_header_t), PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return true;
+
+    // Fetch the process ID of the consumer, and find out whether it has closed the ring
+    const shmring_header_t* header = (const shmring_header_t*)p;
+    pid_t pid       = header->owner_pid;
+    bool  is_closed = header->is_closed;
+    munmap(p, sizeof(shmring_header_t));
+
+    // If the consumer closed the ring, it's stale
+    if (is_closed) return false;
+
+    // If the consumer hasn't recorded its process ID yet, it's still creating the ring
+    if (pid == 0) return true;
+
+    // The ring is in use if its consumer process still exists
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// remove_if_stale() - Removes a ring that was left behind by a consumer that died
+//
+// Passed:  name = The name of the shared-memory object, including the leading '/'
+//
+// Returns: true if the name is now free to be created, false if a running consumer owns the ring
+//
+// Would-be consumers take turns deciding (with flock() on the old object), and the name is unlinked only
+// if it still refers to the object that was found to be stale.  That way, a ring that another consumer has
+// just created in place of the stale one is never removed
+//==========================================================================================================
+bool ShmRing::remove_if_stale(string name)
+{
+    struct stat found, current;
+
+    // Open the existing object.  If it has already gone away, the name is free
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return errno == ENOENT;
+
+    // Make sure no other would-be consumer is deciding at the same time
+    flock(fd, LOCK_EX);
+
+    // If its consumer is still running, we can't have the name
+    bool is_stale = !is_in_use(fd);
+
+    // Otherwise, remove it, provided the name still refers to the same object
+    if (is_stale)
+    {
+        int check = shm_open(name.c_str(), O_RDONLY, 0);
+        if (check >= 0)
+        {
+            if (fstat(fd, &found) == 0 && fstat(check, &current) == 0
+            &&  found.st_dev == current.st_dev && found.st_ino == current.st_ino) shm_unlink(name.c_str());
+            ::close(check);
+        }
+    }
+
+    // Closing the descriptor releases the lock
+    ::close(fd);
+    return is_stale;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_server() - Creates a ring.  The caller becomes its one and only consumer
+//
+// Passed:  name           = The name of the shared-memory object
+//          slot_count     = The number of messages the ring can hold.  This is rounded up to a power of 2
+//          slot_size      = The size of the largest message the ring can hold
+//          multi_producer = true if more than one producer may send at the same time
+//
+// Returns: true if the ring was created, false (with get_error() = RING_IN_USE) if a running consumer
+//          already owns a ring by this name, or is creating one
+//
+// A ring left behind by a consumer that died is replaced.  A consumer that dies in the moment between
+// creating the shared-memory object and recording its process ID leaves behind an object that can't
+// be told apart from one being created.  It has to be removed by hand (from /dev/shm)
+//==========================================================================================================
+bool ShmRing::create_server(string name, int slot_count, int slot_size, bool multi_producer)
+{
+    uint32_t count = 2;
+
+    // Close this ring if it happens to be open
+    close();
+
+    // Shared-memory object names start with a '/'
+    m_name = (name.empty() || name[0] != '/') ? "/" + name : name;
+
+    // The number of slots has to be a power of 2
+    while ((int)count < slot_count) count <<= 1;
+
+    // Each slot starts on a cache line
+    size_t stride = (sizeof(shmring_slot_t) + slot_size + 63) & ~(size_t)63;
+
+    // This is how much shared memory we need
+    size_t size = header_size(sizeof(shmring_header_t)) + count * stride;
+
+    // Create the shared-memory object.  Nobody else can have created it at the same time
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+    // If a ring by this name already exists, replace it if it's stale.  We give up after a few tries,
+    // since that means other consumers keep getting there first
+    for (int tries = 0; fd < 0 && errno == EEXIST && tries < 3; ++tries)
+    {
+        // If the ring has a running consumer (or one that is creating it), we can't take it over
+        if (!remove_if_stale(m_name))
+        {
+            errno       = EEXIST;
+            m_error_str = "ring already in use: "+m_name;
+            m_error     = RING_IN_USE;
+            return false;
+        }
+
+        // The name is free, so try again
+        fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    }
+
+    // If we couldn't create it, tell the caller
+    if (fd < 0)
+    {
+        m_error_str = "can't create shared memory "+m_name;
+        m_error     = CANT_CREATE;
+        return false;
+    }
+
+    // Make it large enough to hold the ring, and map it into our address space
+    bool ok = (ftruncate(fd, size) == 0 && map(fd, size));
+
+    // Once it's mapped, we don't need the descriptor
+    ::close(fd);
+
+    // If we couldn't size it or map it, tell the caller
+    if (!ok)
+    {
+        shm_unlink(m_name.c_str());
+        m_error_str = "can't map shared memory "+m_name;
+        m_error     = CANT_CREATE;
+        return false;
+    }
+
+    // Record who owns the ring first, so another would-be consumer can tell it isn't stale
+    m_header->owner_pid = getpid();
+
+    // Fill in the rest of the ring header.  The new shared memory is already full of zeros
+    m_header->slot_count     = count;
+    m_header->slot_size      = slot_size;
+    m_header->slot_stride    = stride;
+    m_header->multi_producer = multi_producer;
+
+    // Save the information we need for finding slots
+    m_slot_stride = stride;
+    m_slot_size   = slot_size;
+    m_mask        = count - 1;
+
+    // Every slot starts out free for the producer that reaches its position first
+    for (uint32_t i=0; i<count; ++i) slot(i)->seq = i;
+
+    // Make sure all of that is visible before we tell producers the ring is ready
+    __sync_synchronize();
+    m_header->magic = SHMRING_MAGIC;
+
+    // We're the consumer of this ring
+    m_is_server = true;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// connect() - Attaches to a ring that was created by create_server()
+//
+// Returns: true if we attached to the ring
+//==========================================================================================================
+bool ShmRing::connect(string name)
+{
+    struct stat info;
+
+    // Close this ring if it happens to be open
+    close();
+
+    // Shared-memory object names start with a '/'
+    m_name = (name.empty() || name[0] != '/') ? "/" + name : name;
+
+    // Open the shared-memory object
+    int fd = shm_open(m_name.c_str(), O_RDWR, 0);
+
+    // If it doesn't exist, tell the caller
+    if (fd < 0)
+    {
+        m_error_str = "no such ring: "+m_name;
+        m_error     = NO_SUCH_RING;
+        return false;
+    }
+
+    // Find out how large it is, and map it into our address space
+    bool ok = (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(shmring_header_t) && map(fd, info.st_size));
+
+    // Once it's mapped, we don't need the descriptor
+    ::close(fd);
+
+    // If it's not large enough to be a ring, or it isn't ready yet, or it's the wrong size, it's no good
+    if (!ok || m_header->magic != SHMRING_MAGIC
+            || m_map_size != header_size(sizeof(shmring_header_t)) + (size_t)m_header->slot_count * m_header->slot_stride)
+    {
+        close();
+        m_error_str = "not a valid ring: "+m_name;
+        m_error     = BAD_RING;
+        return false;
+    }
+
+    // Make sure we see the ring the way the consumer built it
+    __sync_synchronize();
+
+    // Save the information we need for finding slots
+    m_slot_stride = m_header->slot_stride;
+    m_slot_size   = m_header->slot_size;
+    m_mask        = m_header->slot_count - 1;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close() - Detaches from the ring.  If we're the consumer, the ring is destroyed.  Safe to call if the
+//           ring isn't open
+//==========================================================================================================
+void ShmRing::close()
+{
+    // If we're not attached to a ring, there's nothing to do
+    if (m_header == NULL) return;
+
+    // If we're the consumer, tell the producers, wake any that are waiting, and destroy the ring
+    if (m_is_server)
+    {
+        m_header->is_closed = 1;
+        signal(m_header->space);
+        shm_unlink(m_name.c_str());
+    }
+
+    // Unmap the shared memory
+    munmap(m_header, m_map_size);
+
+    // We're no longer attached to a ring
+    m_header    = NULL;
+    m_slots     = NULL;
+    m_is_server = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// signal() - Wakes every process that is sleeping on an event
+//
+// The caller must already have published whatever the sleepers are waiting for
+//==========================================================================================================
+void ShmRing::signal(shmring_event_t& event)
+{
+    // Make sure the sleepers can see what we published before we check whether there are any
+    __sync_synchronize();
+
+    // If nobody is sleeping, there's no need for a system call
+    if (event.waiters == 0) return;
+
+    // Bump the event sequence number so that anyone about to sleep won't, and wake the sleepers
+    __sync_fetch_and_add(&event.seq, 1);
+    syscall(SYS_futex, &event.seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_for() - Spins, then sleeps on an event, until a condition is true or the timeout expires
+//
+// Passed:  event      = The event that is signalled when the condition might have become true
+//          is_ready   = The member function that checks the condition
+//          timeout_ms = # of milliseconds to wait.  -1 = Wait forever
+//
+// Returns: true if the condition became true, false if the timeout expired
+//==========================================================================================================
+bool ShmRing::wait_for(shmring_event_t& event, bool (ShmRing::*is_ready)(), int timeout_ms)
+{
+    timespec ts, *p_ts;
+
+    // Spin for a little while, since the other side is often only a moment away
+    for (int i=0; i<m_spin_count; ++i)
+    {
+        if ((this->*is_ready)()) return true;
+        cpu_relax();
+    }
+
+    // Compute the time at which we give up
+    uint64_t deadline = monotonic_ms() + timeout_ms;
+
+    while (true)
+    {
+        // Let the other side know we're about to sleep, and note the event sequence number
+        __sync_fetch_and_add(&event.waiters, 1);
+        uint32_t seq = event.seq;
+
+        // If the condition became true while we were getting ready to sleep, don't sleep
+        bool ready = (this->*is_ready)();
+
+        // Figure out how long we can sleep.  NULL = Forever
+        int64_t remaining = (int64_t)(deadline - monotonic_ms());
+        if (timeout_ms < 0)
+            p_ts = NULL;
+        else
+        {
+            if (remaining < 0) remaining = 0;
+            ts.tv_sec  = remaining / 1000;
+            ts.tv_nsec = (remaining % 1000) * 1000000;
+            p_ts       = &ts;
+        }
+
+        // Sleep until the event is signalled (or the sequence number has already changed)
+        if (!ready && (timeout_ms < 0 || remaining > 0))
+        {
+            syscall(SYS_futex, &event.seq, FUTEX_WAIT, seq, p_ts, NULL, 0);
+        }
+
+        // We're no longer sleeping
+        __sync_fetch_and_sub(&event.waiters, 1);
+
+        // If the condition is true, tell the caller
+        if (ready || (this->*is_ready)()) return true;
+
+        // If we've run out of time, tell the caller
+        if (timeout_ms >= 0 && monotonic_ms() >= deadline) return false;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// is_data_ready() - Returns true if there's a message waiting to be received
+//==========================================================================================================
+bool ShmRing::is_data_ready()
+{
+    uint64_t position = m_header->head;
+    return slot(position)->seq == position + 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// is_space_ready() - Returns true if there's a free slot for sending, or if the ring has been closed
+//==========================================================================================================
+bool ShmRing::is_space_ready()
+{
+    uint64_t position = m_header->tail;
+    return slot(position)->seq == position || m_header->is_closed;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_for_data() - Waits for a message to arrive
+//
+// Passed:  timeout_ms = # of milliseconds to wait.  -1 = Wait forever
+//
+// Returns: true if a message is waiting to be received, otherwise false
+//==========================================================================================================
+bool ShmRing::wait_for_data(int timeout_ms)
+{
+    // If we're not attached to a ring, nothing will ever arrive
+    if (m_header == NULL) return false;
+
+    // Wait for a producer to fill the slot at the head of the ring
+    return wait_for(m_header->data, &ShmRing::is_data_ready, timeout_ms);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_noblock() - Receives a message if one is waiting.  Never blocks
+//
+// Passed:  buffer = Pointer to the place to store the message
+//          length = The size of the buffer.  Longer messages are truncated to fit
+//
+// Returns: The number of bytes copied into the buffer
+//             -- or -- 0 = No message is waiting
+//             -- or -- -1 = The ring isn't open
+//==========================================================================================================
+int ShmRing::receive_noblock(void* buffer, int length)
+{
+    // If we're not attached to a ring, tell the caller
+    if (m_header == NULL) return -1;
+
+    // Find the slot at the head of the ring
+    uint64_t        position = m_header->head;
+    shmring_slot_t* p_slot   = slot(position);
+
+    // If a producer hasn't filled it yet, there's no message
+    if (p_slot->seq != position + 1) return 0;
+
+    // Make sure we see the message the producer wrote before it marked the slot as filled
+    __sync_synchronize();
+
+    // Copy the message (or as much of it as will fit) into the caller's buffer
+    int count = p_slot->length;
+    if (count > length) count = length;
+    memcpy(buffer, p_slot + 1, count);
+
+    // Make sure we're done with the slot before we hand it back to the producers
+    __sync_synchronize();
+
+    // The slot is now free for whichever producer reaches this position on the next trip around the ring
+    p_slot->seq    = position + m_mask + 1;
+    m_header->head = position + 1;
+
+    // If a producer is waiting for a free slot, wake it up
+    signal(m_header->space);
+
+    // Tell the caller how many bytes we gave him
+    return count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive() - Waits for a message to arrive, then receives it
+//
+// Returns: The same values as receive_noblock(), except that 0 is never returned
+//==========================================================================================================
+int ShmRing::receive(void* buffer, int length)
+{
+    // If we're not attached to a ring, tell the caller
+    if (m_header == NULL) return -1;
+
+    while (true)
+    {
+        // If there's a message waiting, hand it to the caller
+        int count = receive_noblock(buffer, length);
+        if (count) return count;
+
+        // Otherwise, wait for one
+        wait_for_data(-1);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_noblock() - Sends a message if there's a free slot.  Never blocks
+//
+// Returns: The number of bytes sent
+//             -- or -- 0 = The ring is full
+//             -- or -- -1 = The ring isn't open, the consumer has closed it, or the message is empty or
+//                           too large
+//==========================================================================================================
+int ShmRing::send_noblock(const void* buffer, int length)
+{
+    shmring_slot_t* p_slot;
+
+    // If we're not attached to a ring, or the consumer has gone away, tell the caller
+    if (m_header == NULL || m_header->is_closed) return -1;
+
+    // If the message is empty or won't fit in a slot, it can't be sent.  (An empty message would be
+    // indistinguishable from "ring full" here, and from "no message" in receive_noblock())
+    if (length <= 0 || length > m_slot_size) return -1;
+
+    // Find the position of the next slot to fill
+    uint64_t position = m_header->tail;
+
+    // Claim that slot, if it's free
+    while (true)
+    {
+        p_slot = slot(position);
+
+        // Find out where this slot is in its cycle, relative to the position we want
+        int64_t diff = (int64_t)(p_slot->seq - position);
+
+        // If the slot is free...
+        if (diff == 0)
+        {
+            // If we're the only producer, it's ours
+            if (!m_header->multi_producer)
+            {
+                m_header->tail = position + 1;
+                break;
+            }
+
+            // Otherwise, it's ours if we can advance the tail before another producer does
+            if (__sync_bool_compare_and_swap(&m_header->tail, position, position + 1)) break;
+        }
+
+        // If the slot still holds a message from the last trip around the ring, the ring is full
+        else if (diff < 0) return 0;
+
+        // Another producer beat us to it.  Try the next position
+        position = m_header->tail;
+    }
+
+    // Copy the message into the slot
+    memcpy(p_slot + 1, buffer, length);
+    p_slot->length = length;
+
+    // Make sure the message is visible before we mark the slot as filled
+    __sync_synchronize();
+    p_slot->seq = position + 1;
+
+    // If the consumer is asleep, wake it up
+    signal(m_header->data);
+
+    // Tell the caller how many bytes we sent
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send() - Sends a message, waiting for a free slot if the ring is full
+//
+// Returns: The number of bytes sent
+//             -- or -- -1 = The ring isn't open, the consumer has closed it, or the message is empty or
+//                           too large
+//==========================================================================================================
+int ShmRing::send(const void* buffer, int length)
+{
+    while (true)
+    {
+        // Try to send the message.  If it was sent (or can never be sent), tell the caller
+        int sent = send_noblock(buffer, length);
+        if (sent) return sent;
+
+        // The ring is full.  Wait for the consumer to free a slot
+        wait_for(m_header->space, &ShmRing::is_space_ready, -1);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send() - Sends a string as a message
+//==========================================================================================================
+int ShmRing::send(string s)
+{
+    return send(s.c_str(), s.size());
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_error() - Returns the most recent error code, and optionally, a description of it
+//==========================================================================================================
+int ShmRing::get_error(string* p_str)
+{
+    if (p_str) *p_str = m_error_str;
+    return m_error;
+}
+//==========================================================================================================
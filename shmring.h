@@ -0,0 +1,197 @@
+//==========================================================================================================
+// shmring.h - Defines a shared-memory message ring for passing messages between processes on one host
+//
+// The ring lives in a POSIX shared-memory object (shm_open + mmap) and is made of fixed-size slots, each
+// holding one message.  Sending a message is a copy into a slot; receiving it is a copy out of the slot.
+// Neither one makes a system call unless the other side is asleep.
+//
+// The consumer creates the ring with create_server() and producers attach to it with connect().  A ring
+// is either single-producer (the fastest) or multi-producer, in which case any number of threads or
+// processes may send into it at once.  There is always exactly one consumer.
+//
+// A consumer waiting for a message spins briefly, then sleeps on a futex in the shared memory.  A
+// producer waiting for a free slot does the same.
+//
+// The send/receive methods mirror those of NetSock, so a component can be switched between transports.
+//
+// Note: On older versions of glibc, programs that use this must link with -lrt
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+
+class ShmRing
+{
+public:
+
+    // The are the codes that can be returned by get_error()
+    enum
+    {
+        CANT_CREATE,
+        NO_SUCH_RING,
+        BAD_RING,
+        RING_IN_USE
+    };
+
+    // Constructor and Destructor
+    ShmRing();
+    ~ShmRing() {close();}
+
+#if __cplusplus >= 201103L
+    // A ring owns its shared-memory mapping, so it can't be copied
+    ShmRing(const ShmRing& rhs) = delete;
+    ShmRing& operator=(const ShmRing& rhs) = delete;
+#endif
+
+    // Call this to create a ring and become its consumer.  'slot_count' is rounded up to a power of 2
+    bool    create_server(std::string name, int slot_count = 1024, int slot_size = 2048, bool multi_producer = false);
+
+    // Call this to attach to a ring as a producer
+    bool    connect(std::string name);
+
+    // Waits for a message to arrive.  Returns 'true' if one arrived before the timeout expired
+    bool    wait_for_data(int timeout_ms = -1);
+
+    // Waits for a message and copies it into the buffer.  Returns the length of the message (which is
+    // truncated if it's longer than the buffer), or -1 if the ring isn't open
+    int     receive(void* buffer, int length);
+
+    // Copies a message into the buffer if one is waiting.  Returns the length of the message, 0 if no
+    // message is waiting, or -1 if the ring isn't open
+    int     receive_noblock(void* buffer, int length);
+
+    // Sends a message, waiting for a free slot if the ring is full.  Returns the length of the message,
+    // or -1 if the message is empty or too large, or the ring has been closed by the consumer
+    int     send(const void* buffer, int length);
+    int     send(std::string s);
+
+    // Sends a message if there's a free slot.  Returns the length of the message, 0 if the ring is full,
+    // or -1 if the message is empty or too large, or the ring has been closed by the consumer
+    int     send_noblock(const void* buffer, int length);
+
+    // Returns the largest message that fits in a slot
+    int     max_message_size() {return m_slot_size;}
+
+    // Call this to detach from the ring.  When the consumer closes, the ring is destroyed
+    void    close();
+
+    // When connect() or create_server() fail, this will give information about the error
+    int     get_error(std::string* p_str = NULL);
+
+    // Returns true if we are attached to a ring
+    bool    is_open() {return m_header != NULL;}
+
+protected:
+
+    // The number of times we check the ring before going to sleep, on a machine with more than one CPU
+    enum {SPIN_COUNT = 4096};
+
+    // Describes something a process can sleep on until another process wakes it up
+    struct shmring_event_t
+    {
+        volatile uint32_t   seq;
+        volatile uint32_t   waiters;
+    };
+
+    // This sits at the front of the shared memory, followed by the slots
+    struct shmring_header_t
+    {
+        // Identifies the memory as a ring, and is set only once the ring is ready for use
+        volatile uint32_t   magic;
+
+        // The number of slots (a power of 2), the payload size of a slot, and the distance between slots
+        uint32_t            slot_count;
+        uint32_t            slot_size;
+        uint32_t            slot_stride;
+
+        // True if more than one producer may send at once
+        uint32_t            multi_producer;
+
+        // Set by the consumer when it closes the ring
+        volatile uint32_t   is_closed;
+
+        // The process ID of the consumer, so another would-be consumer can tell whether it's still alive
+        volatile uint32_t   owner_pid;
+
+        // Consumers sleep on 'data', producers sleep on 'space'
+        shmring_event_t     data, space;
+
+        // The position of the next slot to fill, on its own cache line
+        char                pad1[64];
+        volatile uint64_t   tail;
+
+        // The position of the next slot to empty, on its own cache line
+        char                pad2[64];
+        volatile uint64_t   head;
+        char                pad3[64];
+    };
+
+    // This is the front of every slot.  The message follows it
+    struct shmring_slot_t
+    {
+        // When seq == position, the slot is free.  When seq == position + 1, it holds a message
+        volatile uint64_t   seq;
+        uint32_t            length;
+        uint32_t            reserved;
+    };
+
+    // Returns a pointer to the slot for a ring position
+    shmring_slot_t* slot(uint64_t position)
+    {
+        return (shmring_slot_t*)(m_slots + (position & m_mask) * m_slot_stride);
+    }
+
+    // Maps the shared-memory object into our address space
+    bool    map(int fd, size_t size);
+
+    // Returns true if the ring's consumer is still running, or is still creating the ring
+    static bool is_in_use(int fd);
+
+    // Removes a ring whose consumer died.  Returns false if the ring is in use
+    static bool remove_if_stale(std::string name);
+
+    // Spins, then sleeps on an event, until 'is_ready' returns true or the timeout expires
+    bool    wait_for(shmring_event_t& event, bool (ShmRing::*is_ready)(), int timeout_ms);
+
+    // Wakes everyone who is sleeping on an event
+    void    signal(shmring_event_t& event);
+
+    // Returns true if a message is waiting to be received
+    bool    is_data_ready();
+
+    // Returns true if a slot is free for sending, or if the ring has been closed by the consumer
+    bool    is_space_ready();
+
+    // Most recent error
+    std::string m_error_str;
+    int     m_error;
+
+    // The name of the shared-memory object
+    std::string m_name;
+
+    // True if we created the ring (and are therefore its consumer)
+    bool    m_is_server;
+
+    // The shared memory, and its size
+    shmring_header_t* m_header;
+    size_t  m_map_size;
+
+    // Where the slots start, how far apart they are, and how large their payload is
+    char*   m_slots;
+    size_t  m_slot_stride;
+    int     m_slot_size;
+
+    // Ring positions are converted to slot indices with this
+    uint64_t m_mask;
+
+    // How many times we check the ring before sleeping.  Spinning is pointless with only one CPU
+    int     m_spin_count;
+
+#if __cplusplus < 201103L
+private:
+
+    // A ring owns its shared-memory mapping, so it can't be copied.  These are never defined
+    ShmRing(const ShmRing& rhs);
+    ShmRing& operator=(const ShmRing& rhs);
+#endif
+};
@@ -0,0 +1,336 @@
+//==========================================================================================================
+// udprecorder.cpp - Implements a class that records UDP packets to a pcap file
+//==========================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include "udprecorder.h"
+#include "endian_types.h"
+using namespace std;
+
+
+//==========================================================================================================
+// These describe the IP and UDP headers we put in front of each recorded packet
+//==========================================================================================================
+enum
+{
+    IPV4_HEADER_SIZE = 20,
+    IPV6_HEADER_SIZE = 40,
+    UDP_HEADER_SIZE  = 8,
+    IPPROTO_UDP_ID   = 17,
+    RECORD_TTL       = 64
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// ipv4_checksum() - Computes the checksum of an IPv4 header
+//==========================================================================================================
+static uint16_t ipv4_checksum(const unsigned char* header)
+{
+    uint32_t sum = 0;
+
+    // Add up the header as 16-bit words
+    for (int i=0; i<IPV4_HEADER_SIZE; i += 2) sum += (header[i] << 8) | header[i+1];
+
+    // Fold the carries back into the low 16 bits
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+
+    // The checksum is the one's complement of the sum
+    return ~sum & 0xFFFF;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor() - Marks the recorder as closed
+//==========================================================================================================
+UDPRecorder::UDPRecorder()
+{
+    m_fd      = -1;
+    m_packets = 0;
+    m_local.ip.clear();
+    m_local.port   = 0;
+    m_local.family = AF_UNSPEC;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Creates (or opens for appending) a recording
+//
+// Passed:  filename = The name of the file to record to
+//          append   = If true and the file already exists, packets are added to the end of it
+//          local    = If not NULL, the address and port recorded as the destination of every packet
+//
+// Returns: true if the file is ready to record to
+//==========================================================================================================
+bool UDPRecorder::create(string filename, bool append, const udp_peer_t* local)
+{
+    struct stat sb;
+
+    // If we already have a recording open, close it
+    close();
+
+    // Keep track of what we'll record as the destination of each packet
+    if (local)
+        m_local = *local;
+    else
+    {
+        m_local.ip.clear();
+        m_local.port   = 0;
+        m_local.family = AF_UNSPEC;
+    }
+
+    // Open the file
+    int flags = O_RDWR | O_CREAT | O_APPEND | (append ? 0 : O_TRUNC);
+    m_fd = open(filename.c_str(), flags, 0644);
+    if (m_fd < 0) return false;
+
+    // Find out how large the file already is
+    if (fstat(m_fd, &sb) < 0)
+    {
+        close();
+        return false;
+    }
+
+    // If we're adding to an existing recording, make sure it's in the format we write
+    if (sb.st_size > 0)
+    {
+        pcap_file_header_t header;
+        if (pread(m_fd, &header, sizeof header, 0) != sizeof header
+        ||  header.magic != PCAP_MAGIC_NSEC || header.linktype != LINKTYPE_RAW)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Build the header of a new file
+    pcap_file_header_t header;
+    memset(&header, 0, sizeof header);
+    header.magic         = PCAP_MAGIC_NSEC;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.snaplen       = 65535;
+    header.linktype      = LINKTYPE_RAW;
+
+    // And write it to the file
+    if (write(m_fd, &header, sizeof header) != sizeof header)
+    {
+        close();
+        return false;
+    }
+
+    // The file is ready to have packets recorded to it
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close() - Writes any buffered records and closes the file
+//==========================================================================================================
+void UDPRecorder::close()
+{
+    // If there's no file open, there's nothing to do
+    if (m_fd < 0) return;
+
+    // Write whatever we have buffered, and close the file
+    flush();
+    ::close(m_fd);
+    m_fd = -1;
+
+    // We haven't recorded anything to a new file yet
+    m_packets = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// flush() - Writes any buffered records to the file
+//
+// Returns: true if everything was written
+//==========================================================================================================
+bool UDPRecorder::flush()
+{
+    size_t offset = 0;
+
+    // If there's no file open, we can't write to it
+    if (m_fd < 0) return false;
+
+    // Write the buffer, a piece at a time if need be
+    while (offset < m_buffer.size())
+    {
+        ssize_t rc = write(m_fd, &m_buffer[offset], m_buffer.size() - offset);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) break;
+        offset += rc;
+    }
+
+    // Throw away what we wrote.  If the write failed, the unwritten records are lost
+    bool ok = (offset == m_buffer.size());
+    m_buffer.clear();
+    return ok;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append_headers() - Appends an IPv4 or IPv6 header and a UDP header to the buffer
+//
+// Passed:  peer   = The peer that sent the packet
+//          length = The length of the payload
+//
+// The header type is chosen by the peer's address family.  Our own address is recorded as the destination
+// if it's the same family; otherwise the destination address is left empty
+//==========================================================================================================
+void UDPRecorder::append_headers(const udp_peer_t& peer, int length)
+{
+    unsigned char header[IPV6_HEADER_SIZE + UDP_HEADER_SIZE];
+    int           ip_size;
+
+    // Start out with an empty header
+    memset(header, 0, sizeof header);
+
+    // Decide whether we have a destination address of the same family as the peer
+    bool have_local = (m_local.family == peer.family);
+
+    // Build an IPv6 header
+    if (peer.family == AF_INET6)
+    {
+        ip_size = IPV6_HEADER_SIZE;
+        header[0] = 0x60;
+        ((be_uint16_t*)(header + 4))->set(UDP_HEADER_SIZE + length);
+        header[6] = IPPROTO_UDP_ID;
+        header[7] = RECORD_TTL;
+        memcpy(header + 8, peer.ip.octet, 16);
+        if (have_local) memcpy(header + 24, m_local.ip.octet, 16);
+    }
+
+    // Otherwise, build an IPv4 header
+    else
+    {
+        ip_size = IPV4_HEADER_SIZE;
+        header[0] = 0x45;
+        ((be_uint16_t*)(header + 2))->set(IPV4_HEADER_SIZE + UDP_HEADER_SIZE + length);
+        header[6] = 0x40;
+        header[8] = RECORD_TTL;
+        header[9] = IPPROTO_UDP_ID;
+        memcpy(header + 12, peer.ip.octet, 4);
+        if (have_local) memcpy(header + 16, m_local.ip.octet, 4);
+        ((be_uint16_t*)(header + 10))->set(ipv4_checksum(header));
+    }
+
+    // Build the UDP header.  A checksum of zero means "not computed"
+    unsigned char* udp = header + ip_size;
+    ((be_uint16_t*)(udp + 0))->set(peer.port);
+    ((be_uint16_t*)(udp + 2))->set(m_local.port);
+    ((be_uint16_t*)(udp + 4))->set(UDP_HEADER_SIZE + length);
+
+    // And add both headers to the buffer
+    m_buffer.insert(m_buffer.end(), header, header + ip_size + UDP_HEADER_SIZE);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// record() - Records a packet
+//
+// Passed:  data   = The payload of the packet
+//          length = The length of the payload
+//          peer   = The peer that sent the packet
+//          when   = The time the packet arrived (CLOCK_REALTIME)
+//
+// Returns: true if the packet was recorded
+//==========================================================================================================
+bool UDPRecorder::record(const void* data, int length, const udp_peer_t& peer, const timespec& when)
+{
+    pcap_record_header_t record;
+
+    // If there's no file open, or the packet is nonsense, don't record it
+    if (m_fd < 0 || length < 0 || length > 65535 - IPV6_HEADER_SIZE - UDP_HEADER_SIZE) return false;
+
+    // Find out how large the headers in front of the payload are
+    int header_size = UDP_HEADER_SIZE + (peer.family == AF_INET6 ? IPV6_HEADER_SIZE : IPV4_HEADER_SIZE);
+
+    // Build the pcap record header
+    record.ts_sec   = when.tv_sec;
+    record.ts_frac  = when.tv_nsec;
+    record.incl_len = header_size + length;
+    record.orig_len = header_size + length;
+
+    // Append the record header, the IP and UDP headers, and the payload to the buffer
+    const char* p = (const char*)&record;
+    m_buffer.insert(m_buffer.end(), p, p + sizeof record);
+    append_headers(peer, length);
+    m_buffer.insert(m_buffer.end(), (const char*)data, (const char*)data + length);
+
+    // Count this packet
+    ++m_packets;
+
+    // If we've buffered enough, write it to the file
+    return m_buffer.size() < FLUSH_SIZE || flush();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// record() - Records a packet that was fetched with UDPSock::receive_batch()
+//==========================================================================================================
+bool UDPRecorder::record(const udp_packet_t& packet, const timespec& when)
+{
+    udp_peer_t peer;
+
+    // Find out who sent the packet
+    peer.from_sockaddr((const sockaddr*)&packet.peer);
+
+    // If the packet was truncated, we only have the part that fit in the buffer
+    int length = packet.length < packet.buf_size ? packet.length : packet.buf_size;
+
+    // And record it
+    return record(packet.buffer, length, peer, when);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// capture() - Waits for a packet to arrive on a socket and records it
+//
+// Passed:  sock       = The socket to receive from
+//          timeout_ms = How long to wait for a packet.  -1 = Wait forever
+//
+// Returns: The length of the packet, 0 if none arrived before the timeout, or -1 on error
+//
+// If the socket has rx timestamps turned on, the kernel's timestamp is recorded.  Otherwise the packet is
+// stamped with the time we received it
+//==========================================================================================================
+int UDPRecorder::capture(UDPSock& sock, int timeout_ms)
+{
+    udp_peer_t peer;
+    timespec   when;
+
+    // If there's no file open, there's nowhere to record the packet
+    if (m_fd < 0) return -1;
+
+    // Make sure we have room for the largest possible packet
+    if (m_rx_buffer.empty()) m_rx_buffer.resize(65536);
+
+    // Wait for a packet to arrive
+    if (timeout_ms >= 0 && !sock.wait_for_data(timeout_ms)) return 0;
+
+    // Fetch it, along with the kernel's timestamp of when it arrived
+    int length = sock.receive_timestamped(&m_rx_buffer[0], m_rx_buffer.size(), &when, &peer);
+    if (length < 0) return -1;
+
+    // If the kernel didn't timestamp it, use the current time
+    if (when.tv_sec == 0 && when.tv_nsec == 0) clock_gettime(CLOCK_REALTIME, &when);
+
+    // And record it
+    return record(&m_rx_buffer[0], length, peer, when) ? length : -1;
+}
+//==========================================================================================================
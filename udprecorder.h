@@ -0,0 +1,128 @@
+//==========================================================================================================
+// udprecorder.h - Defines a class that records UDP packets to a file, for later replay by UDPReplayer
+//
+// The file is a standard pcap file (nanosecond timestamps, LINKTYPE_RAW), so it can also be opened with
+// Wireshark or tcpdump.  Each packet is stored with an IP and UDP header that we construct from the
+// address of the peer that sent it, followed by the payload.
+//
+// The file is append-only: records are written one after another and never modified, so a file that
+// is still being recorded can be read (or memory-mapped) at any time.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "udpsock.h"
+
+//==========================================================================================================
+// These describe the pcap file format
+//==========================================================================================================
+
+// The magic numbers for files with microsecond and nanosecond timestamps
+static const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+static const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+
+// The link types we understand.  We write LINKTYPE_RAW (packets that begin with an IP header)
+static const uint32_t LINKTYPE_ETHERNET = 1;
+static const uint32_t LINKTYPE_RAW      = 101;
+
+// This is at the front of every pcap file
+struct pcap_file_header_t
+{
+    uint32_t    magic;
+    uint16_t    version_major;
+    uint16_t    version_minor;
+    int32_t     thiszone;
+    uint32_t    sigfigs;
+    uint32_t    snaplen;
+    uint32_t    linktype;
+};
+
+// This is at the front of every packet in a pcap file.  'ts_frac' is in microseconds or nanoseconds,
+// depending on the magic number
+struct pcap_record_header_t
+{
+    uint32_t    ts_sec;
+    uint32_t    ts_frac;
+    uint32_t    incl_len;
+    uint32_t    orig_len;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// UDPRecorder - Records UDP packets to a pcap file
+//==========================================================================================================
+class UDPRecorder
+{
+public:
+
+    // Constructor and destructor
+    UDPRecorder();
+    ~UDPRecorder() {close();}
+
+#if __cplusplus >= 201103L
+    // A recorder owns its file descriptor, so it can't be copied
+    UDPRecorder(const UDPRecorder& rhs) = delete;
+    UDPRecorder& operator=(const UDPRecorder& rhs) = delete;
+#endif
+
+    // Call this to create a recording.  If 'append' is true and the file exists, new packets are added
+    // to the end of it.  'local' is recorded as the destination of every packet
+    bool    create(std::string filename, bool append = false, const udp_peer_t* local = NULL);
+
+    // Records a packet that arrived at the specified time (CLOCK_REALTIME)
+    bool    record(const void* data, int length, const udp_peer_t& peer, const timespec& when);
+
+    // Records a packet that was fetched with UDPSock::receive_batch()
+    bool    record(const udp_packet_t& packet, const timespec& when);
+
+    // Waits for a packet to arrive on a socket and records it.  The kernel's receive timestamp is used if
+    // the socket has them turned on.  Returns the length of the packet, 0 on timeout, or -1 on error
+    int     capture(UDPSock& sock, int timeout_ms = -1);
+
+    // Writes any buffered records to the file
+    bool    flush();
+
+    // Flushes and closes the file
+    void    close();
+
+    // Returns the number of packets that have been recorded
+    uint64_t packets() {return m_packets;}
+
+    // Returns true if a recording is open
+    bool    is_open() {return m_fd >= 0;}
+
+protected:
+
+    // Records are buffered until there are at least this many bytes
+    enum {FLUSH_SIZE = 1024 * 1024};
+
+    // Appends an IPv4 or IPv6 header and a UDP header describing a packet to the buffer
+    void    append_headers(const udp_peer_t& peer, int length);
+
+    // The file we're recording to
+    int     m_fd;
+
+    // Records waiting to be written to the file
+    std::vector<char> m_buffer;
+
+    // capture() receives packets into this
+    std::vector<char> m_rx_buffer;
+
+    // The destination address and port that we record for every packet
+    udp_peer_t m_local;
+
+    // The number of packets recorded
+    uint64_t m_packets;
+
+#if __cplusplus < 201103L
+private:
+
+    // A recorder owns its file descriptor, so it can't be copied.  These are never defined
+    UDPRecorder(const UDPRecorder& rhs);
+    UDPRecorder& operator=(const UDPRecorder& rhs);
+#endif
+};
+//==========================================================================================================
@@ -0,0 +1,353 @@
+//==========================================================================================================
+// udpreplayer.cpp - Implements a class that replays UDP packets from a pcap file
+//==========================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "udpreplayer.h"
+#include "endian_types.h"
+using namespace std;
+
+
+//==========================================================================================================
+// These describe the headers in front of the payload of each packet
+//==========================================================================================================
+enum
+{
+    ETHERNET_HEADER_SIZE = 14,
+    VLAN_TAG_SIZE        = 4,
+    IPV6_HEADER_SIZE     = 40,
+    UDP_HEADER_SIZE      = 8,
+    IPPROTO_UDP_ID       = 17,
+    ETHERTYPE_IPV4       = 0x0800,
+    ETHERTYPE_IPV6       = 0x86DD,
+    ETHERTYPE_VLAN       = 0x8100
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// When pacing, we sleep until this many nanoseconds before a packet is due, then spin the rest of the way,
+// and we never sleep longer than MAX_SLEEP_NS at a time so that stop() is noticed promptly
+//==========================================================================================================
+static const uint64_t SPIN_NS      = 50000;
+static const uint64_t MAX_SLEEP_NS = 100000000;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// monotonic_ns() - Returns the current time of the monotonic clock in nanoseconds
+//==========================================================================================================
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sleep_until() - Sleeps until the monotonic clock reaches 'when_ns', or until 'is_stopped' becomes true
+//==========================================================================================================
+static void sleep_until(uint64_t when_ns, volatile bool& is_stopped)
+{
+    timespec ts;
+
+    while (!is_stopped)
+    {
+        // Find out how long we have to wait
+        uint64_t now = monotonic_ns();
+        if (now >= when_ns) return;
+
+        // If it's almost time, spin the rest of the way
+        if (when_ns - now <= SPIN_NS) continue;
+
+        // Otherwise, sleep until just before it's time, a piece at a time
+        uint64_t wake = when_ns - SPIN_NS;
+        if (wake - now > MAX_SLEEP_NS) wake = now + MAX_SLEEP_NS;
+        ts.tv_sec  = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor() - Marks the replayer as closed
+//==========================================================================================================
+UDPReplayer::UDPReplayer()
+{
+    m_map        = NULL;
+    m_map_size   = 0;
+    m_is_nsec    = false;
+    m_linktype   = 0;
+    m_count      = 0;
+    m_is_stopped = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// open() - Memory-maps a recording and counts the UDP packets in it
+//
+// Passed:  filename = The name of the pcap file to replay
+//
+// Returns: true if the file was opened, and is a pcap file we understand
+//==========================================================================================================
+bool UDPReplayer::open(string filename)
+{
+    pcap_file_header_t header;
+    struct stat        sb;
+
+    // If we already have a recording open, close it
+    close();
+
+    // Open the file and find out how large it is
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    if (fstat(fd, &sb) < 0 || sb.st_size < (off_t)sizeof header)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // Map the file into memory.  Once it's mapped, we don't need the descriptor
+    void* map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    // Keep track of the mapping, and tell the kernel we'll be reading it front to back
+    m_map      = (const char*)map;
+    m_map_size = sb.st_size;
+    madvise(map, m_map_size, MADV_SEQUENTIAL);
+
+    // Fetch the file header and make sure this is a recording we understand
+    memcpy(&header, m_map, sizeof header);
+    m_is_nsec  = (header.magic == PCAP_MAGIC_NSEC);
+    m_linktype = header.linktype;
+    if ((header.magic != PCAP_MAGIC_NSEC && header.magic != PCAP_MAGIC_USEC)
+    ||  (m_linktype != LINKTYPE_RAW && m_linktype != LINKTYPE_ETHERNET))
+    {
+        close();
+        return false;
+    }
+
+    // A stop() aimed at an earlier replay doesn't apply to this recording
+    m_is_stopped = false;
+
+    // Count the UDP packets in the recording
+    replay_packet_t packet;
+    size_t offset = sizeof header;
+    while (next_packet(&offset, &packet)) ++m_count;
+
+    // The recording is ready to replay
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close() - Unmaps the recording
+//==========================================================================================================
+void UDPReplayer::close()
+{
+    // If we have a recording mapped, unmap it
+    if (m_map) munmap((void*)m_map, m_map_size);
+
+    // And mark the replayer as closed
+    m_map      = NULL;
+    m_map_size = 0;
+    m_count    = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next_packet() - Finds the next UDP packet in the recording
+//
+// Passed:  offset   = The offset in the file of the next record.  On return, the offset of the record
+//                     after the packet that was found
+//          p_packet = Receives the location, length and timestamp of the packet's payload
+//
+// Returns: true if a packet was found, false at the end of the file
+//
+// Records that aren't UDP packets (or are fragments of one) are skipped.  A record at the end of the file
+// that isn't complete (because it's still being recorded) is treated as the end of the file
+//==========================================================================================================
+bool UDPReplayer::next_packet(size_t* offset, replay_packet_t* p_packet)
+{
+    pcap_record_header_t record;
+
+    while (*offset + sizeof record <= m_map_size)
+    {
+        // Fetch the record header, and make sure the entire record is in the file
+        memcpy(&record, m_map + *offset, sizeof record);
+        const unsigned char* p = (const unsigned char*)m_map + *offset + sizeof record;
+        size_t length = record.incl_len;
+        if (length > m_map_size - *offset - sizeof record) return false;
+
+        // The next record follows this one
+        *offset += sizeof record + length;
+
+        // Assume that the packet begins with an IP header
+        uint32_t ethertype = 0;
+
+        // If the packet begins with an Ethernet header, find out what follows it and skip past it
+        if (m_linktype == LINKTYPE_ETHERNET)
+        {
+            if (length < ETHERNET_HEADER_SIZE) continue;
+            ethertype = ((be_uint16_t*)(p + 12))->get();
+            p      += ETHERNET_HEADER_SIZE;
+            length -= ETHERNET_HEADER_SIZE;
+
+            // Skip past a VLAN tag
+            if (ethertype == ETHERTYPE_VLAN && length >= VLAN_TAG_SIZE)
+            {
+                ethertype = ((be_uint16_t*)(p + 2))->get();
+                p      += VLAN_TAG_SIZE;
+                length -= VLAN_TAG_SIZE;
+            }
+
+            // If this isn't an IP packet, skip it
+            if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6) continue;
+        }
+
+        // If this isn't even long enough for an IP header, skip it
+        if (length < 1) continue;
+
+        // Find the UDP header of an IPv4 packet.  Fragments after the first one are skipped
+        size_t ip_size;
+        int    version = p[0] >> 4;
+        if (version == 4)
+        {
+            ip_size = (p[0] & 0x0F) * 4;
+            if (ip_size < 20 || length < ip_size) continue;
+            if (p[9] != IPPROTO_UDP_ID) continue;
+            if (((be_uint16_t*)(p + 6))->get() & 0x1FFF) continue;
+        }
+
+        // Find the UDP header of an IPv6 packet.  We don't handle extension headers
+        else if (version == 6)
+        {
+            ip_size = IPV6_HEADER_SIZE;
+            if (length < ip_size || p[6] != IPPROTO_UDP_ID) continue;
+        }
+
+        // Anything else isn't a packet we can replay
+        else continue;
+
+        // Skip past the IP header and make sure there's a UDP header
+        p      += ip_size;
+        length -= ip_size;
+        if (length < UDP_HEADER_SIZE) continue;
+
+        // The payload is what follows the UDP header.  If the capture was truncated, we replay what we have
+        size_t udp_length = ((be_uint16_t*)(p + 4))->get();
+        if (udp_length < UDP_HEADER_SIZE) continue;
+        size_t payload = udp_length - UDP_HEADER_SIZE;
+        if (payload > length - UDP_HEADER_SIZE) payload = length - UDP_HEADER_SIZE;
+
+        // Tell the caller where the payload is and when it was recorded
+        uint64_t frac = m_is_nsec ? record.ts_frac : (uint64_t)record.ts_frac * 1000;
+        p_packet->data    = (const char*)p + UDP_HEADER_SIZE;
+        p_packet->length  = payload;
+        p_packet->when_ns = (uint64_t)record.ts_sec * 1000000000 + frac;
+        return true;
+    }
+
+    // If we get here, we've reached the end of the file
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// replay() - Sends every packet in the recording through a socket
+//
+// Passed:  sock  = The socket to send packets through.  They are sent to the socket's target
+//          speed = A multiple of the rate the packets were recorded at.  0 = As fast as possible
+//
+// Returns: The number of packets sent, or -1 if the recording isn't open or nothing could be sent
+//
+// If a packet can't be sent, replay() stops there.  If stop() has been called since the recording was
+// opened, replay() returns without sending anything.
+//
+// Each packet is sent when it is due relative to the first one, so a slow send doesn't cause the packets
+// after it to drift later.  Packets that are already due (or all of them, when speed is 0) are sent in
+// batches with UDPSock::send_batch()
+//==========================================================================================================
+int UDPReplayer::replay(UDPSock& sock, double speed)
+{
+    udp_packet_t    batch[BATCH_SIZE];
+    replay_packet_t packet;
+    int             sent = 0;
+
+    // If there's no recording open, there's nothing to replay
+    if (m_map == NULL) return -1;
+
+    // Every packet is sent to the target of the socket
+    memset(batch, 0, sizeof batch);
+
+    // Fetch the first packet.  The others are scheduled relative to it
+    size_t offset = sizeof(pcap_file_header_t);
+    bool have_packet = next_packet(&offset, &packet);
+    uint64_t first_ns = have_packet ? packet.when_ns : 0;
+    uint64_t start_ns = monotonic_ns();
+
+    while (have_packet && !m_is_stopped)
+    {
+        // Wait until the first packet of this batch is due
+        if (speed > 0)
+        {
+            uint64_t delta = packet.when_ns > first_ns ? packet.when_ns - first_ns : 0;
+            sleep_until(start_ns + (uint64_t)(delta / speed), m_is_stopped);
+        }
+
+        // Find out what time it is now
+        uint64_t now = monotonic_ns();
+
+        // Gather up this packet and any that follow it that are also due
+        int count = 0;
+        while (have_packet && count < BATCH_SIZE)
+        {
+            // If we're pacing and this packet isn't due yet, it starts the next batch
+            if (count && speed > 0)
+            {
+                uint64_t delta = packet.when_ns > first_ns ? packet.when_ns - first_ns : 0;
+                if (start_ns + (uint64_t)(delta / speed) > now) break;
+            }
+
+            // Add this packet to the batch
+            batch[count].buffer   = (void*)packet.data;
+            batch[count].buf_size = packet.length;
+            batch[count].length   = packet.length;
+            ++count;
+
+            // And fetch the next one
+            have_packet = next_packet(&offset, &packet);
+        }
+
+        // Send the batch.  If only part of it was sent, try again with the rest
+        for (int done = 0; done < count;)
+        {
+            int rc = sock.send_batch(batch + done, count - done);
+
+            // If nothing more could be sent, tell the caller how many we managed to send
+            if (rc < 0) return sent ? sent : -1;
+
+            // Count the packets we sent
+            done += rc;
+            sent += rc;
+        }
+    }
+
+    // Tell the caller how many packets were sent
+    return sent;
+}
+//==========================================================================================================
@@ -0,0 +1,92 @@
+//==========================================================================================================
+// udpreplayer.h - Defines a class that replays UDP packets from a pcap file
+//
+// The file is memory-mapped, and packets are sent through a UDPSock (to that socket's target) with the
+// same spacing they were recorded with, at a multiple of the original rate, or as fast as possible.
+// Packets that are due at the same moment are sent together with UDPSock::send_batch().
+//
+// Files written by UDPRecorder can be replayed, as can captures from tcpdump (raw IP or Ethernet, with
+// microsecond or nanosecond timestamps).  Packets that aren't UDP are skipped.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include "udprecorder.h"
+
+class UDPReplayer
+{
+public:
+
+    // Constructor and destructor
+    UDPReplayer();
+    ~UDPReplayer() {close();}
+
+#if __cplusplus >= 201103L
+    // A replayer owns its memory mapping, so it can't be copied
+    UDPReplayer(const UDPReplayer& rhs) = delete;
+    UDPReplayer& operator=(const UDPReplayer& rhs) = delete;
+#endif
+
+    // Call this to open a recording.  Returns false if it can't be opened or isn't a pcap file we
+    // understand
+    bool    open(std::string filename);
+
+    // Closes the recording
+    void    close();
+
+    // Returns the number of UDP packets in the recording
+    int     count() {return m_count;}
+
+    // Sends every packet in the recording through 'sock'.  'speed' is a multiple of the original rate:
+    // 1.0 = the rate it was recorded at, 2.0 = twice as fast, 0 = as fast as possible.  Returns the number
+    // of packets sent, or -1 on error
+    int     replay(UDPSock& sock, double speed = 1.0);
+
+    // Causes replay() to return.  Safe to call from any thread.  The replayer stays stopped until open() is
+    // called again
+    void    stop() {m_is_stopped = true;}
+
+protected:
+
+    // The number of packets we send with a single call to send_batch()
+    enum {BATCH_SIZE = 64};
+
+    // Describes a packet in the recording
+    struct replay_packet_t
+    {
+        // The payload and its length
+        const char* data;
+        int         length;
+
+        // When it was recorded, in nanoseconds since the epoch
+        uint64_t    when_ns;
+    };
+
+    // Finds the next UDP packet in the recording, starting at 'offset'.  Returns false at end of file
+    bool    next_packet(size_t* offset, replay_packet_t* p_packet);
+
+    // The memory-mapped file and its size
+    const char* m_map;
+    size_t  m_map_size;
+
+    // True if the timestamps are in nanoseconds (rather than microseconds)
+    bool    m_is_nsec;
+
+    // The link type of the recording
+    uint32_t m_linktype;
+
+    // The number of UDP packets in the recording
+    int     m_count;
+
+    // This is set when it's time for replay() to return
+    volatile bool m_is_stopped;
+
+#if __cplusplus < 201103L
+private:
+
+    // A replayer owns its memory mapping, so it can't be copied.  These are never defined
+    UDPReplayer(const UDPReplayer& rhs);
+    UDPReplayer& operator=(const UDPReplayer& rhs);
+#endif
+};
+//==========================================================================================================
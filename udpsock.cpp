@@ -2,10 +2,100 @@
 // udpsock.cpp - Implements a class that manages UDP sockets
 //==========================================================================================================
 #include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <linux/errqueue.h>
 #include "udpsock.h"
 #include "netutil.h"
 using namespace std;
 
+//----------------------------------------------------------------------------------------------------------
+// recvmmsg() and sendmmsg() are available in glibc 2.14 and later.  Older systems (and kernels that don't
+// support them) fall back to sending and receiving one packet at a time
+//----------------------------------------------------------------------------------------------------------
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 14))
+#define HAVE_MMSG
+#endif
+//----------------------------------------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------------------------------------
+// Older system headers may not define the UDP segmentation-offload constants
+//----------------------------------------------------------------------------------------------------------
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+//----------------------------------------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------------------------------------
+// Older system headers may not define the options that restrict a socket to the groups it has joined
+//----------------------------------------------------------------------------------------------------------
+#ifndef IP_MULTICAST_ALL
+#define IP_MULTICAST_ALL 49
+#endif
+
+#ifndef IPV6_MULTICAST_ALL
+#define IPV6_MULTICAST_ALL 29
+#endif
+//----------------------------------------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------------------------------------
+// Older system headers may not define the transmit timestamping and scheduling constants
+//----------------------------------------------------------------------------------------------------------
+#ifndef SO_TIMESTAMPING
+#define SO_TIMESTAMPING 37
+#endif
+
+#ifndef SCM_TIMESTAMPING
+#define SCM_TIMESTAMPING SO_TIMESTAMPING
+#endif
+
+#ifndef SO_EE_ORIGIN_TIMESTAMPING
+#define SO_EE_ORIGIN_TIMESTAMPING 4
+#endif
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#endif
+
+#ifndef SCM_TXTIME
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+// These are the SO_TIMESTAMPING flags from linux/net_tstamp.h
+enum
+{
+    TS_TX_HARDWARE  = (1 << 0),
+    TS_TX_SOFTWARE  = (1 << 1),
+    TS_SOFTWARE     = (1 << 4),
+    TS_RAW_HARDWARE = (1 << 6),
+    TS_OPT_ID       = (1 << 7),
+    TS_OPT_TSONLY   = (1 << 11)
+};
+
+// This is 'struct sock_txtime' from linux/net_tstamp.h
+struct txtime_config_t
+{
+    clockid_t   clockid;
+    uint32_t    flags;
+};
+//----------------------------------------------------------------------------------------------------------
+
 
 
 //==========================================================================================================
@@ -104,6 +194,249 @@ bool UDPSock::create_server(int port, string bind_to, int family)
 
 
 
+//==========================================================================================================
+// create_multicast_sender() - Creates a socket for sending UDP packets to a multicast group
+//
+// Passed:  port     = The UDP port number the group's receivers are listening on
+//          group    = The multicast group (i.e., "239.1.2.3" or "ff15::1234")
+//          iface    = The name of the interface to send on.  "" = Let the kernel choose
+//          ttl      = How many routers a packet may cross.  1 = Stay on the local network
+//          loopback = True if receivers on this machine should get the packets we send
+//
+// Returns: true if the socket was created
+//==========================================================================================================
+bool UDPSock::create_multicast_sender(int port, string group, string iface, int ttl, bool loopback)
+{
+    // If the socket is open, close it
+    close();
+
+    // Fetch the address of the group we're sending to
+    if (!NetUtil::get_server_addrinfo(SOCK_DGRAM, group, port, AF_UNSPEC, &m_target)) return false;
+
+    // Create the socket
+    m_sd = socket(m_target.family, m_target.socktype, m_target.protocol);
+
+    // If that failed, tell the caller
+    if (m_sd < 0) return false;
+
+    // If the caller wants us to send on a particular interface, tell the kernel which one
+    if (!iface.empty())
+    {
+        int result;
+
+        // An IPv4 interface is identified by its IP address
+        if (m_target.family == AF_INET)
+        {
+            ipv4_t local_ip;
+            if (!NetUtil::get_local_ip(iface, &local_ip)) return false;
+            result = setsockopt(m_sd, IPPROTO_IP, IP_MULTICAST_IF, local_ip.octet, sizeof local_ip.octet);
+        }
+
+        // An IPv6 interface is identified by its index
+        else
+        {
+            unsigned int index = if_nametoindex(iface.c_str());
+            if (index == 0) return false;
+            result = setsockopt(m_sd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof index);
+        }
+
+        // If the kernel didn't like the interface, tell the caller
+        if (result < 0) return false;
+    }
+
+    // Set the TTL and the loopback mode
+    return set_multicast_ttl(ttl) && set_multicast_loopback(loopback);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_multicast_receiver() - Creates a socket for receiving UDP packets sent to multicast groups
+//
+// Passed:  port   = The UDP port number that packets are sent to
+//          group  = A multicast group to join.  "" = Don't join one yet
+//          iface  = The name of the interface to join the group on.  "" = Let the kernel choose
+//          family = AF_INET or AF_INET6, the type of groups that will be joined
+//
+// Returns: true if the socket was created (and the group, if any, was joined)
+//==========================================================================================================
+bool UDPSock::create_multicast_receiver(int port, string group, string iface, int family)
+{
+    int one = 1;
+
+    // If the socket is open, close it
+    close();
+
+    // Fetch the wildcard address for this port, so that we receive packets sent to any group we join
+    addrinfo_t info = NetUtil::get_local_addrinfo(SOCK_DGRAM, port, "", family);
+
+    // Create the socket
+    m_sd = socket(info.family, info.socktype, info.protocol);
+
+    // If that failed, tell the caller
+    if (m_sd < 0) return false;
+
+    // Allow other receivers on this machine to listen to the same port
+    if (setsockopt(m_sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0) return false;
+
+    // Bind the socket to the port
+    if (bind(m_sd, info, info.addrlen) < 0) return false;
+
+    // Linux normally hands a socket bound to the wildcard address the packets of every group that any
+    // socket on the machine has joined.  We only want the groups that we join.  (Older kernels don't
+    // support this, so failure isn't an error)
+    int zero = 0;
+    if (info.family == AF_INET)
+        setsockopt(m_sd, IPPROTO_IP, IP_MULTICAST_ALL, &zero, sizeof zero);
+    else
+        setsockopt(m_sd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &zero, sizeof zero);
+
+    // If the caller gave us a group, join it
+    return group.empty() || join_group(group, iface);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// join_group() - Starts receiving packets sent to a multicast group
+//==========================================================================================================
+bool UDPSock::join_group(string group, string iface)
+{
+    return change_membership(group, iface, true);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// leave_group() - Stops receiving packets sent to a multicast group
+//==========================================================================================================
+bool UDPSock::leave_group(string group, string iface)
+{
+    return change_membership(group, iface, false);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// change_membership() - Joins or leaves a multicast group
+//
+// Passed:  group = The multicast group
+//          iface = The name of the interface to join it on.  "" = Let the kernel choose
+//          join  = true to join the group, false to leave it
+//
+// Returns: true if the kernel accepted the change
+//==========================================================================================================
+bool UDPSock::change_membership(string group, string iface, bool join)
+{
+    addrinfo_t info;
+
+    // Find out what kind of socket this is
+    int family = socket_family();
+
+    // If the socket isn't open, there's nothing to join
+    if (family == AF_UNSPEC) return false;
+
+    // Fetch the address of the group.  It has to be the same kind of address as our socket
+    if (!NetUtil::get_server_addrinfo(SOCK_DGRAM, group, 0, family, &info)) return false;
+
+    // If this is an IPv4 socket, the interface is identified by its IP address
+    if (family == AF_INET)
+    {
+        ip_mreq request;
+        memset(&request, 0, sizeof request);
+        request.imr_multiaddr = ((sockaddr_in*)&info.addr)->sin_addr;
+
+        // If the caller named an interface, find its address.  Otherwise, the kernel chooses
+        if (!iface.empty())
+        {
+            ipv4_t local_ip;
+            if (!NetUtil::get_local_ip(iface, &local_ip)) return false;
+            memcpy(&request.imr_interface, local_ip.octet, sizeof local_ip.octet);
+        }
+
+        // Join or leave the group
+        int option = join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP;
+        return setsockopt(m_sd, IPPROTO_IP, option, &request, sizeof request) == 0;
+    }
+
+    // Otherwise, this is an IPv6 socket, and the interface is identified by its index
+    ipv6_mreq request;
+    memset(&request, 0, sizeof request);
+    request.ipv6mr_multiaddr = ((sockaddr_in6*)&info.addr)->sin6_addr;
+
+    // If the caller named an interface, find its index.  Otherwise, the kernel chooses
+    if (!iface.empty())
+    {
+        request.ipv6mr_interface = if_nametoindex(iface.c_str());
+        if (request.ipv6mr_interface == 0) return false;
+    }
+
+    // Join or leave the group
+    int option = join ? IPV6_ADD_MEMBERSHIP : IPV6_DROP_MEMBERSHIP;
+    return setsockopt(m_sd, IPPROTO_IPV6, option, &request, sizeof request) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_multicast_ttl() - Sets how many routers the multicast packets we send may cross
+//==========================================================================================================
+bool UDPSock::set_multicast_ttl(int ttl)
+{
+    // Find out what kind of socket this is
+    int family = socket_family();
+
+    // Set the TTL (which IPv6 calls the hop limit)
+    if (family == AF_INET)  return setsockopt(m_sd, IPPROTO_IP,   IP_MULTICAST_TTL,    &ttl, sizeof ttl) == 0;
+    if (family == AF_INET6) return setsockopt(m_sd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof ttl) == 0;
+
+    // If we get here, the socket isn't open
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_multicast_loopback() - Controls whether receivers on this machine get the multicast packets we send
+//==========================================================================================================
+bool UDPSock::set_multicast_loopback(bool flag)
+{
+    int value = flag ? 1 : 0;
+
+    // Find out what kind of socket this is
+    int family = socket_family();
+
+    // Turn loopback on or off
+    if (family == AF_INET)  return setsockopt(m_sd, IPPROTO_IP,   IP_MULTICAST_LOOP,   &value, sizeof value) == 0;
+    if (family == AF_INET6) return setsockopt(m_sd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &value, sizeof value) == 0;
+
+    // If we get here, the socket isn't open
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// socket_family() - Returns the address family of our socket (AF_INET or AF_INET6), or AF_UNSPEC if the
+//                   socket isn't open
+//==========================================================================================================
+int UDPSock::socket_family()
+{
+    sockaddr_storage addr;
+    socklen_t        length = sizeof addr;
+
+    // If the socket isn't open, it doesn't have a family
+    if (m_sd < 0) return AF_UNSPEC;
+
+    // Ask the kernel what kind of address our socket has
+    if (getsockname(m_sd, (sockaddr*)&addr, &length) < 0) return AF_UNSPEC;
+
+    // And hand the caller its family
+    return addr.ss_family;
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // send() - Call this to transmit data on a "Sender" socket
 //==========================================================================================================
@@ -146,6 +479,758 @@ int UDPSock::receive(void* buffer, int buf_size, string* p_source)
 
 
 
+//==========================================================================================================
+// receive_from() - Waits for a packet on a server socket, and identifies the peer that sent it without
+//                  converting its address to text
+//
+// Passed:  buffer     = Where to store the packet
+//          buf_size   = The size of the buffer
+//          p_peer     = Receives the identity of the peer that sent the packet
+//
+// Returns: The number of bytes in the received message, or -1 on error
+//==========================================================================================================
+int UDPSock::receive_from(void* buffer, int buf_size, udp_peer_t* p_peer)
+{
+    sockaddr_storage peer;
+
+    // We need this for the call to ::recvfrom
+    socklen_t addrlen = sizeof(peer);
+
+    // Wait for a UDP message to arrive, and stuff it into the caller's buffer
+    int byte_count = recvfrom(m_sd, buffer, buf_size, 0, (sockaddr*)&peer, &addrlen);
+
+    // If that failed, tell the caller
+    if (byte_count < 0) return -1;
+
+    // Tell the caller who sent the message
+    p_peer->from_sockaddr((sockaddr*)&peer);
+
+    // Return the length of the message that was just fetched
+    return byte_count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_to() - Sends a message to a specific peer
+//
+// Returns: The number of bytes sent, or -1 on error
+//==========================================================================================================
+int UDPSock::send_to(const void* msg, int length, const udp_peer_t& peer)
+{
+    sockaddr_storage addr;
+
+    // Build the address of the peer
+    socklen_t addrlen = peer.to_sockaddr(&addr);
+
+    // And send the message there
+    return sendto(m_sd, msg, length, 0, (sockaddr*)&addr, addrlen);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_batch() - Receives as many waiting packets as will fit into the caller's array, with as few
+//                   system calls as possible
+//
+// Passed:  packets    = The packets to fill in.  'buffer' and 'buf_size' must be set by the caller
+//          count      = The number of entries in 'packets[]'
+//          timeout_ms = How long to wait for the first packet to arrive.  -1 = Wait forever
+//
+// Returns: The number of packets received, 0 if none arrived before the timeout, or -1 on error
+//
+// For each packet received, 'length', 'is_truncated', 'peer' and 'peer_len' are filled in.  No addresses
+// are converted to strings; NetUtil::ip_to_string() will do that for the packets the caller cares about
+//==========================================================================================================
+int UDPSock::receive_batch(udp_packet_t* packets, int count, int timeout_ms)
+{
+    // If the socket isn't open, don't try to receive anything
+    if (m_sd < 0) return -1;
+
+    // If there's no room for any packets, there's nothing to do
+    if (count <= 0) return 0;
+
+    // If we have a timeout, wait for the first packet, and never block after that
+    if (timeout_ms >= 0 && !wait_for_data(timeout_ms)) return 0;
+    int first_flags = (timeout_ms >= 0) ? MSG_DONTWAIT : 0;
+
+#ifdef HAVE_MMSG
+    mmsghdr msgs[BATCH_SIZE];
+    iovec   iov[BATCH_SIZE];
+
+    // This is the number of packets we have received so far
+    int received = 0;
+
+    // Loop until the caller's array is full, or there are no more packets waiting
+    while (received < count)
+    {
+        // This is the portion of the caller's array that we're going to fill on this pass
+        udp_packet_t* p = packets + received;
+        int n = count - received;
+        if (n > BATCH_SIZE) n = BATCH_SIZE;
+
+        // Describe each of the caller's buffers to recvmmsg()
+        memset(msgs, 0, n * sizeof msgs[0]);
+        for (int i=0; i<n; ++i)
+        {
+            iov[i].iov_base              = p[i].buffer;
+            iov[i].iov_len               = p[i].buf_size;
+            msgs[i].msg_hdr.msg_iov      = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen   = 1;
+            msgs[i].msg_hdr.msg_name     = &p[i].peer;
+            msgs[i].msg_hdr.msg_namelen  = sizeof p[i].peer;
+        }
+
+        // The first call waits for a packet if it needs to, the ones after that never wait
+        int flags = (received == 0 && first_flags == 0) ? MSG_WAITFORONE : MSG_DONTWAIT;
+
+        // Fetch as many packets as are waiting
+        int result = recvmmsg(m_sd, msgs, n, flags, NULL);
+
+        // If we were interrupted before receiving anything, try again
+        if (result < 0 && errno == EINTR && received == 0) continue;
+
+        // If the kernel doesn't support recvmmsg(), receive the packets one at a time
+        if (result < 0 && errno == ENOSYS && received == 0) return receive_each(packets, count, first_flags);
+
+        // If no more packets are waiting (or an error occured), we're done
+        if (result < 0) break;
+
+        // Tell the caller about each packet that arrived
+        for (int i=0; i<result; ++i)
+        {
+            p[i].length       = msgs[i].msg_len;
+            p[i].is_truncated = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+            p[i].peer_len     = msgs[i].msg_hdr.msg_namelen;
+        }
+
+        // Keep track of how many packets we've received
+        received += result;
+
+        // If the kernel ran out of packets before we ran out of room, we're done
+        if (result < n) break;
+    }
+
+    // If the first call failed outright, tell the caller.  (Having no packets waiting isn't a failure)
+    if (received == 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+    // Tell the caller how many packets we received
+    return received;
+#else
+    return receive_each(packets, count, first_flags);
+#endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_each() - Does the work of receive_batch() one packet at a time
+//
+// Passed:  packets     = The packets to fill in
+//          count       = The number of entries in 'packets[]'
+//          first_flags = 0 to wait for the first packet, or MSG_DONTWAIT to not wait
+//
+// Returns: The number of packets received, or -1 if the first receive failed
+//==========================================================================================================
+int UDPSock::receive_each(udp_packet_t* packets, int count, int first_flags)
+{
+    int received = 0;
+
+    // Loop through the caller's array until it is full or there are no more packets waiting...
+    while (received < count)
+    {
+        udp_packet_t& p = packets[received];
+
+        // Only the first receive is allowed to wait for a packet
+        int flags = (received == 0 ? first_flags : MSG_DONTWAIT) | MSG_TRUNC;
+
+        // Fetch a packet.  With MSG_TRUNC, we're told the full length of the packet
+        p.peer_len = sizeof p.peer;
+        int length = recvfrom(m_sd, p.buffer, p.buf_size, flags, (sockaddr*)&p.peer, &p.peer_len);
+
+        // If we were interrupted before receiving anything, try again
+        if (length < 0 && errno == EINTR && received == 0) continue;
+
+        // If no more packets are waiting (or an error occured), we're done
+        if (length < 0) break;
+
+        // Tell the caller about the packet
+        p.is_truncated = (length > p.buf_size);
+        p.length       = p.is_truncated ? p.buf_size : length;
+
+        // Keep track of how many packets we've received
+        ++received;
+    }
+
+    // If the first call failed outright, tell the caller.  (Having no packets waiting isn't a failure)
+    if (received == 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+    // Tell the caller how many packets we received
+    return received;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_batch() - Sends a list of packets with as few system calls as possible
+//
+// Passed:  packets = The packets to send.  'buffer' and 'length' must be filled in.  If 'peer_len' is
+//                    zero, the packet goes to the target of this socket, otherwise it goes to 'peer'
+//          count   = The number of entries in 'packets[]'
+//
+// Returns: The number of packets that were sent, or -1 if none of them could be sent
+//==========================================================================================================
+int UDPSock::send_batch(const udp_packet_t* packets, int count)
+{
+    // If the socket isn't open, don't try to send anything
+    if (m_sd < 0) return -1;
+
+#ifdef HAVE_MMSG
+    mmsghdr msgs[BATCH_SIZE];
+    iovec   iov[BATCH_SIZE];
+
+    // This is the number of packets we have sent so far
+    int sent = 0;
+
+    // Loop until every packet has been sent...
+    while (sent < count)
+    {
+        // This is the portion of the caller's array that we're going to send on this pass
+        const udp_packet_t* p = packets + sent;
+        int n = count - sent;
+        if (n > BATCH_SIZE) n = BATCH_SIZE;
+
+        // Describe each of the packets to sendmmsg()
+        memset(msgs, 0, n * sizeof msgs[0]);
+        for (int i=0; i<n; ++i)
+        {
+            iov[i].iov_base             = p[i].buffer;
+            iov[i].iov_len              = p[i].length;
+            msgs[i].msg_hdr.msg_iov     = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+            msgs[i].msg_hdr.msg_name    = p[i].peer_len ? (void*)&p[i].peer : (void*)&m_target.addr;
+            msgs[i].msg_hdr.msg_namelen = p[i].peer_len ? p[i].peer_len     : m_target.addrlen;
+        }
+
+        // Send as many of them as the kernel will take
+        int result = sendmmsg(m_sd, msgs, n, 0);
+
+        // If we were interrupted, just try again
+        if (result < 0 && errno == EINTR) continue;
+
+        // If the kernel doesn't support sendmmsg(), send the rest of the packets one at a time
+        if (result < 0 && errno == ENOSYS)
+        {
+            int each = send_each(p, count - sent);
+            if (each > 0) sent += each;
+            break;
+        }
+
+        // If a packet couldn't be sent, we're done
+        if (result <= 0) break;
+
+        // Keep track of how many packets we've sent
+        sent += result;
+    }
+
+    // Tell the caller how many packets were sent
+    return (sent == 0 && count > 0) ? -1 : sent;
+#else
+    return send_each(packets, count);
+#endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_each() - Does the work of send_batch() one packet at a time
+//
+// Returns: The number of packets that were sent, or -1 if none of them could be sent
+//==========================================================================================================
+int UDPSock::send_each(const udp_packet_t* packets, int count)
+{
+    int sent;
+
+    // Loop through each packet in the caller's array...
+    for (sent = 0; sent < count; ++sent)
+    {
+        const udp_packet_t& p = packets[sent];
+
+        // Find out where this packet is going
+        const sockaddr* dest    = p.peer_len ? (const sockaddr*)&p.peer : (const sockaddr*)m_target;
+        socklen_t       destlen = p.peer_len ? p.peer_len : m_target.addrlen;
+
+        // Send it.  If that fails, we're done
+        if (sendto(m_sd, p.buffer, p.length, 0, dest, destlen) < 0) break;
+    }
+
+    // Tell the caller how many packets were sent
+    return (sent == 0 && count > 0) ? -1 : sent;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_rx_timestamps() - Turns on (or off) kernel timestamping of arriving packets
+//==========================================================================================================
+bool UDPSock::enable_rx_timestamps(bool flag)
+{
+    return m_sd >= 0 && NetUtil::enable_rx_timestamps(m_sd, flag);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_timestamped() - Waits for a packet to arrive and fetches the time the kernel received it
+//
+// Passed:  buffer    = Where to store the packet
+//          buf_size  = The size of the buffer
+//          p_rx_time = Receives the time the packet arrived.  Zero if rx timestamps aren't turned on
+//          p_peer    = If not NULL, receives the identity of the peer that sent the packet
+//
+// Returns: The number of bytes in the received message, or -1 on error
+//==========================================================================================================
+int UDPSock::receive_timestamped(void* buffer, int buf_size, timespec* p_rx_time, udp_peer_t* p_peer)
+{
+    char             control[256];
+    sockaddr_storage peer;
+
+    // Describe the caller's buffer
+    iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len  = buf_size;
+
+    // Describe the message to recvmsg()
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_name       = &peer;
+    msg.msg_namelen    = sizeof peer;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+
+    // Wait for a UDP message to arrive
+    int byte_count = recvmsg(m_sd, &msg, 0);
+
+    // If that failed, tell the caller
+    if (byte_count < 0) return -1;
+
+    // Tell the caller when the packet arrived, and who sent it
+    NetUtil::get_rx_timestamp(&msg, p_rx_time);
+    if (p_peer) p_peer->from_sockaddr((sockaddr*)&peer);
+
+    // Return the length of the message that was just fetched
+    return byte_count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_tx_timestamps() - Turns on (or off) reporting of when each packet we send leaves the host.  The
+//                          network card's timestamps are used if it has been configured to provide them
+//==========================================================================================================
+bool UDPSock::enable_tx_timestamps(bool flag)
+{
+    // These are the timestamps we want, and how we want them reported
+    int flags = TS_TX_SOFTWARE | TS_TX_HARDWARE | TS_SOFTWARE | TS_RAW_HARDWARE | TS_OPT_ID | TS_OPT_TSONLY;
+
+    // Turn them on or off
+    if (!flag) flags = 0;
+    return m_sd >= 0 && setsockopt(m_sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof flags) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_tx_timestamp() - Fetches the next transmit timestamp from the socket's error queue
+//
+// Passed:  p_id       = Receives the number of the send that was timestamped
+//          p_tx_time  = Receives the time the packet left the host
+//          timeout_ms = How long to wait for a timestamp to become available.  -1 = Wait forever
+//
+// Returns: true if a timestamp was fetched
+//==========================================================================================================
+bool UDPSock::get_tx_timestamp(uint32_t* p_id, timespec* p_tx_time, int timeout_ms)
+{
+    char   control[256];
+    msghdr msg;
+
+    // If the socket isn't open, there's nothing to fetch
+    if (m_sd < 0) return false;
+
+    // If the caller is willing to wait, wait for the error queue to become non-empty
+    if (timeout_ms != 0)
+    {
+        pollfd pfd = {m_sd, 0, 0};
+        poll(&pfd, 1, timeout_ms);
+    }
+
+    // Loop through the notifications waiting in the error queue...
+    while (true)
+    {
+        // We want the ancillary data, not the payload
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof control;
+
+        // Fetch the next notification.  If there isn't one, tell the caller
+        if (recvmsg(m_sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return false;
+
+        // We don't yet know whether this notification is a timestamp
+        bool has_time = false, has_id = false;
+
+        // Loop through each control message in the notification...
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            // The timestamps themselves
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING)
+            {
+                timespec ts[3];
+                memcpy(ts, CMSG_DATA(cm), sizeof ts);
+                *p_tx_time = (ts[2].tv_sec || ts[2].tv_nsec) ? ts[2] : ts[0];
+                has_time = true;
+            }
+
+            // The extended error report that tells us which send was timestamped
+            bool is_recverr = (cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR)
+                           || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (is_recverr)
+            {
+                sock_extended_err* err = (sock_extended_err*)CMSG_DATA(cm);
+                if (err->ee_errno == ENOMSG && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                {
+                    *p_id  = err->ee_data;
+                    has_id = true;
+                }
+            }
+        }
+
+        // If this notification was a timestamp, hand it to the caller.  Otherwise, look at the next one
+        if (has_time && has_id) return true;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_txtime() - Allows send_at() to schedule packets for transmission at a future time
+//
+// Passed:  clock_id = The clock that send_at() times refer to.  The "fq" queueing discipline requires
+//                     CLOCK_MONOTONIC, "etf" usually uses CLOCK_TAI
+//==========================================================================================================
+bool UDPSock::enable_txtime(int clock_id)
+{
+    txtime_config_t config;
+    config.clockid = clock_id;
+    config.flags   = 0;
+    return m_sd >= 0 && setsockopt(m_sd, SOL_SOCKET, SO_TXTIME, &config, sizeof config) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_at() - Sends a message to the target of this socket, to be transmitted no earlier than 'tx_time_ns'
+//
+// Returns: The number of bytes sent, or -1 on error (including when enable_txtime() hasn't been called)
+//==========================================================================================================
+int UDPSock::send_at(const void* msg, int length, uint64_t tx_time_ns)
+{
+    char control[CMSG_SPACE(sizeof(uint64_t))];
+
+    // Describe the message
+    iovec iov;
+    iov.iov_base = (void*)msg;
+    iov.iov_len  = length;
+
+    // Describe it to sendmsg()
+    msghdr hdr;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.msg_name       = (void*)&m_target.addr;
+    hdr.msg_namelen    = m_target.addrlen;
+    hdr.msg_iov        = &iov;
+    hdr.msg_iovlen     = 1;
+    hdr.msg_control    = control;
+    hdr.msg_controllen = sizeof control;
+
+    // Attach the transmit time as a control message
+    memset(control, 0, sizeof control);
+    cmsghdr* cmsg    = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_TXTIME;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &tx_time_ns, sizeof tx_time_ns);
+
+    // And send it
+    return sendmsg(m_sd, &hdr, 0);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_gso() - Turns on (or off) kernel segmentation of the buffers handed to send_segmented()
+//
+// Returns: true if GSO is now in the state the caller asked for
+//==========================================================================================================
+bool UDPSock::enable_gso(bool flag)
+{
+    int       value  = 0;
+    socklen_t length = sizeof value;
+
+    // Turning GSO off always works
+    m_gso_enabled = false;
+    if (!flag) return true;
+
+    // If the socket isn't open, we can't find out whether the kernel supports GSO
+    if (m_sd < 0) return false;
+
+    // Older kernels silently ignore the UDP_SEGMENT control message (and send the buffer as one huge
+    // datagram), so make sure the kernel knows what UDP_SEGMENT is before we use it
+    if (getsockopt(m_sd, SOL_UDP, UDP_SEGMENT, &value, &length) < 0) return false;
+
+    // The kernel supports it
+    m_gso_enabled = true;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_segmented() - Sends a buffer as a series of equal-sized datagrams to the target of this socket
+//
+// Passed:  buffer       = The data to send
+//          length       = The number of bytes in the buffer
+//          segment_size = The length of each datagram.  The last one gets whatever is left over
+//
+// Returns: The number of bytes sent (which will be 'length'), or -1 on error
+//
+// With GSO enabled, each system call hands the kernel up to GSO_MAX_SEGMENTS datagrams.  If the kernel
+// (or the network interface) turns out not to support GSO, we switch it off and split the buffer ourselves
+//==========================================================================================================
+int UDPSock::send_segmented(const void* buffer, int length, int segment_size)
+{
+    // If the socket isn't open or the segment size makes no sense, don't try to send anything
+    if (m_sd < 0 || segment_size <= 0 || segment_size > MAX_UDP_PAYLOAD) return -1;
+
+    // Find out how many bytes a single GSO send can carry, in whole segments
+    int max_chunk = GSO_MAX_SEGMENTS * segment_size;
+    if (max_chunk > MAX_UDP_PAYLOAD) max_chunk = (MAX_UDP_PAYLOAD / segment_size) * segment_size;
+
+    // Get a byte pointer to the caller's buffer
+    const char* ptr = (const char*)buffer;
+
+    // Keep track of how many bytes remain to be sent
+    int bytes_remaining = length;
+
+    // Loop until every byte has been sent...
+    while (bytes_remaining)
+    {
+        // This is how much we're going to send on this pass
+        int chunk = (bytes_remaining < max_chunk) ? bytes_remaining : max_chunk;
+
+        // A single datagram doesn't need GSO.  If GSO is on, let the kernel split the chunk
+        bool is_sent = (m_gso_enabled && chunk > segment_size) && send_gso(ptr, chunk, segment_size);
+
+        // Otherwise, split it into datagrams ourselves
+        if (!is_sent && !send_segments(ptr, chunk, segment_size)) return -1;
+
+        // Adjust the pointer and the count of bytes remaining to be sent
+        ptr             += chunk;
+        bytes_remaining -= chunk;
+    }
+
+    // Tell the caller that every byte was sent
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_gso() - Sends a buffer with a single sendmsg() and has the kernel split it into datagrams
+//
+// Returns: true if the buffer was sent.  If the kernel or the interface can't segment it, GSO is turned
+//          off and false is returned
+//==========================================================================================================
+bool UDPSock::send_gso(const char* buffer, int length, int segment_size)
+{
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+
+    // Describe the buffer
+    iovec iov;
+    iov.iov_base = (void*)buffer;
+    iov.iov_len  = length;
+
+    // Describe the message to sendmsg()
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_name       = (void*)&m_target.addr;
+    msg.msg_namelen    = m_target.addrlen;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+
+    // Attach the segment size as a control message
+    memset(control, 0, sizeof control);
+    cmsghdr* cmsg    = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type  = UDP_SEGMENT;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size = segment_size;
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof gso_size);
+
+    // Send the buffer, trying again if we're interrupted
+    int sent;
+    do sent = sendmsg(m_sd, &msg, 0); while (sent < 0 && errno == EINTR);
+
+    // If that worked, we're done
+    if (sent >= 0) return true;
+
+    // These mean the kernel or the interface can't do segmentation offload for this socket
+    if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) m_gso_enabled = false;
+
+    // Tell the caller that the buffer wasn't sent
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_segments() - Splits a buffer into datagrams and sends them with as few system calls as possible
+//
+// Returns: true if every datagram was sent
+//==========================================================================================================
+bool UDPSock::send_segments(const char* buffer, int length, int segment_size)
+{
+    udp_packet_t packets[BATCH_SIZE];
+
+    // Loop until every byte has been sent...
+    while (length)
+    {
+        int count = 0;
+
+        // Describe as many datagrams as fit in our array
+        while (length && count < BATCH_SIZE)
+        {
+            udp_packet_t& p = packets[count++];
+            p.buffer   = (void*)buffer;
+            p.length   = (length < segment_size) ? length : segment_size;
+            p.peer_len = 0;
+            buffer    += p.length;
+            length    -= p.length;
+        }
+
+        // Send them.  If any of them couldn't be sent, tell the caller
+        if (send_batch(packets, count) != count) return false;
+    }
+
+    // Tell the caller that every datagram was sent
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enable_gro() - Turns on (or off) kernel coalescing of arriving datagrams
+//
+// Returns: true if GRO is now in the state the caller asked for
+//==========================================================================================================
+bool UDPSock::enable_gro(bool flag)
+{
+    int value = flag ? 1 : 0;
+
+    // If the socket isn't open, there's nothing to turn on
+    if (m_sd < 0) return false;
+
+    // Tell the kernel whether it may coalesce datagrams for us
+    return setsockopt(m_sd, SOL_UDP, UDP_GRO, &value, sizeof value) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_coalesced() - Receives what may be several coalesced datagrams from one peer, and splits them
+//                       back into separate datagrams
+//
+// Passed:  buffer     = The buffer to receive into.  It should be 65536 bytes long
+//          buf_size   = The size of the buffer
+//          packets    = Filled in with one entry per datagram.  Each entry's 'buffer' points into 'buffer'
+//          count      = The number of entries in 'packets[]'.  If there are more datagrams than entries,
+//                       the last entry is marked as truncated and the datagrams after it are thrown away
+//          timeout_ms = How long to wait for data to arrive.  -1 = Wait forever
+//
+// Returns: The number of datagrams, 0 if nothing arrived before the timeout, or -1 on error
+//
+// This works whether or not GRO is enabled; without it, each read is a single datagram
+//==========================================================================================================
+int UDPSock::receive_coalesced(void* buffer, int buf_size, udp_packet_t* packets, int count, int timeout_ms)
+{
+    char             control[CMSG_SPACE(sizeof(int))];
+    sockaddr_storage peer;
+
+    // If the socket isn't open or there's nowhere to put the datagrams, don't try to receive anything
+    if (m_sd < 0 || count <= 0) return -1;
+
+    // If we have a timeout, wait for data to arrive
+    if (timeout_ms >= 0 && !wait_for_data(timeout_ms)) return 0;
+
+    // Describe the caller's buffer
+    iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len  = buf_size;
+
+    // Describe the message to recvmsg()
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_name       = &peer;
+    msg.msg_namelen    = sizeof peer;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof control;
+
+    // Fetch the data, trying again if we're interrupted
+    int length;
+    do length = recvmsg(m_sd, &msg, 0); while (length < 0 && errno == EINTR);
+
+    // If that failed, tell the caller
+    if (length < 0) return -1;
+
+    // Unless the kernel tells us it coalesced several datagrams, this is a single datagram
+    int segment_size = 0;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+        {
+            memcpy(&segment_size, CMSG_DATA(cmsg), sizeof segment_size);
+        }
+    }
+    if (segment_size <= 0) segment_size = length;
+
+    // Split the data back into datagrams
+    int n = 0, offset = 0;
+    do
+    {
+        udp_packet_t& p = packets[n++];
+        p.buffer       = (char*)buffer + offset;
+        p.buf_size     = buf_size - offset;
+        p.length       = (length - offset < segment_size) ? length - offset : segment_size;
+        p.is_truncated = false;
+        p.peer         = peer;
+        p.peer_len     = msg.msg_namelen;
+        offset        += p.length;
+    }
+    while (offset < length && n < count);
+
+    // If we ran out of room in 'packets[]' or the caller's buffer, the last datagram is incomplete
+    if (offset < length || (msg.msg_flags & MSG_TRUNC)) packets[n-1].is_truncated = true;
+
+    // Tell the caller how many datagrams there are
+    return n;
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // wait_for_data() - Waits for the specified amount of time for data to be available for reading
 //
@@ -172,6 +1257,165 @@ void UDPSock::close()
 
     // And mark the socket as closed
     m_sd = -1;
+
+    // A new socket won't have segmentation offload turned on
+    m_gso_enabled = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// move_object() - Takes ownership of another object's socket, leaving that object closed
+//==========================================================================================================
+void UDPSock::move_object(UDPSock& rhs)
+{
+    // Moving an object onto itself changes nothing
+    if (&rhs == this) return;
+
+    // Give up whatever socket we already have
+    close();
+
+    // Take over the other object's socket and its target address
+    m_sd          = rhs.m_sd;
+    m_target      = rhs.m_target;
+    m_gso_enabled = rhs.m_gso_enabled;
+
+    // The other object no longer owns a socket
+    rhs.m_sd          = -1;
+    rhs.m_gso_enabled = false;
+}
+//==========================================================================================================
+
+
+
+//==========================================================================================================
+// from_sockaddr() - Fills in a udp_peer_t from a socket address
+//
+// Returns: false if the address isn't an IPv4 or IPv6 address, in which case the peer is all zeros
+//==========================================================================================================
+bool udp_peer_t::from_sockaddr(const sockaddr* addr)
+{
+    // Start out with an empty peer
+    ip.clear();
+    port   = 0;
+    family = addr->sa_family;
+
+    // Fill in an IPv4 address
+    if (family == AF_INET)
+    {
+        const sockaddr_in* addr4 = (const sockaddr_in*)addr;
+        memcpy(ip.octet, &addr4->sin_addr, 4);
+        port = ntohs(addr4->sin_port);
+        return true;
+    }
+
+    // Fill in an IPv6 address
+    if (family == AF_INET6)
+    {
+        const sockaddr_in6* addr6 = (const sockaddr_in6*)addr;
+        memcpy(ip.octet, &addr6->sin6_addr, 16);
+        port = ntohs(addr6->sin6_port);
+        return true;
+    }
+
+    // Any other kind of address can't be represented
+    family = AF_UNSPEC;
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// to_sockaddr() - Builds a socket address from a udp_peer_t
+//
+// Returns: The length of the address
+//==========================================================================================================
+socklen_t udp_peer_t::to_sockaddr(sockaddr_storage* addr) const
+{
+    // Start out with an empty address
+    memset(addr, 0, sizeof *addr);
+
+    // Build an IPv4 address
+    if (family == AF_INET)
+    {
+        sockaddr_in* addr4 = (sockaddr_in*)addr;
+        addr4->sin_family = AF_INET;
+        addr4->sin_port   = htons(port);
+        memcpy(&addr4->sin_addr, ip.octet, 4);
+        return sizeof *addr4;
+    }
+
+    // Build an IPv6 address
+    sockaddr_in6* addr6 = (sockaddr_in6*)addr;
+    addr6->sin6_family = AF_INET6;
+    addr6->sin6_port   = htons(port);
+    memcpy(&addr6->sin6_addr, ip.octet, 16);
+    return sizeof *addr6;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// text() - Returns the peer as text, in "address:port" form.  IPv6 addresses are bracketed
+//==========================================================================================================
+string udp_peer_t::text() const
+{
+    char address[INET6_ADDRSTRLEN], buffer[INET6_ADDRSTRLEN + 16];
+
+    // Convert the address to text
+    inet_ntop(family == AF_INET ? AF_INET : AF_INET6, ip.octet, address, sizeof address);
+
+    // Append the port number to it
+    if (family == AF_INET)
+        sprintf(buffer, "%s:%u", address, port);
+    else
+        sprintf(buffer, "[%s]:%u", address, port);
+
+    // And hand the result to the caller
+    return buffer;
 }
 //==========================================================================================================
 
+
+//==========================================================================================================
+// hash() - Returns a hash of the peer (FNV-1a, over the address, port and family)
+//==========================================================================================================
+uint32_t udp_peer_t::hash() const
+{
+    uint32_t h = 2166136261u;
+
+    // Fold in every byte of the address
+    for (int i=0; i<16; ++i) h = (h ^ ip.octet[i]) * 16777619u;
+
+    // Fold in the port number and the family
+    h = (h ^ (port & 0xFF))  * 16777619u;
+    h = (h ^ (port >> 8))    * 16777619u;
+    h = (h ^ family)         * 16777619u;
+
+    // And hand the result to the caller
+    return h;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// operator==() - Returns true if two peers are the same
+//==========================================================================================================
+bool udp_peer_t::operator==(const udp_peer_t& rhs) const
+{
+    return port == rhs.port && family == rhs.family && memcmp(ip.octet, rhs.ip.octet, 16) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// operator<() - Orders peers by address, then port, then family
+//==========================================================================================================
+bool udp_peer_t::operator<(const udp_peer_t& rhs) const
+{
+    int result = memcmp(ip.octet, rhs.ip.octet, 16);
+    if (result) return result < 0;
+    if (port != rhs.port) return port < rhs.port;
+    return family < rhs.family;
+}
+//==========================================================================================================
@@ -5,9 +5,75 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <stdint.h>
+#include <time.h>
 #include <string>
 #include "netutil.h"
 
+//==========================================================================================================
+// udp_peer_t - A compact identity for the other end of a UDP conversation.  It can be compared, sorted and
+//              hashed without allocating memory, so it makes a good key for per-peer tables
+//==========================================================================================================
+struct udp_peer_t
+{
+    // The IP address.  IPv4 addresses are stored the way ipv6_t::from_ipv4() stores them
+    ipv6_t      ip;
+
+    // The UDP port number, in host byte order
+    uint16_t    port;
+
+    // AF_INET or AF_INET6
+    uint16_t    family;
+
+    // Fills this in from a socket address.  Returns false if it isn't an IPv4 or IPv6 address
+    bool        from_sockaddr(const sockaddr* addr);
+
+    // Builds a socket address from this peer, and returns its length
+    socklen_t   to_sockaddr(sockaddr_storage* addr) const;
+
+    // Returns the peer as text, i.e. "10.1.1.5:9000" or "[fe80::1]:9000".  Meant for logging
+    std::string text() const;
+
+    // Returns a hash of the peer
+    uint32_t    hash() const;
+
+    // Comparisons, for use as a key in a map or a hash table
+    bool        operator==(const udp_peer_t& rhs) const;
+    bool        operator!=(const udp_peer_t& rhs) const {return !(*this == rhs);}
+    bool        operator< (const udp_peer_t& rhs) const;
+};
+
+// A hash functor, for hash tables keyed on udp_peer_t
+struct udp_peer_hash
+{
+    size_t operator()(const udp_peer_t& peer) const {return peer.hash();}
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// udp_packet_t - Describes one datagram for UDPSock::receive_batch() and UDPSock::send_batch()
+//==========================================================================================================
+struct udp_packet_t
+{
+    // The caller's buffer, and its size
+    void*       buffer;
+    int         buf_size;
+
+    // The number of bytes in the datagram
+    int         length;
+
+    // True if the datagram was larger than the buffer, and was truncated
+    bool        is_truncated;
+
+    // The address the datagram came from (or is going to), and the length of that address.  When sending,
+    // a 'peer_len' of 0 means "send to the target of this socket"
+    sockaddr_storage peer;
+    socklen_t   peer_len;
+};
+//==========================================================================================================
+
+
 //==========================================================================================================
 // UDPSock() - UDP socket for sending or receiving UDP datagrams
 //==========================================================================================================
@@ -16,11 +82,21 @@ class UDPSock
 public:
 
     // Constructor, marks the socket as closed
-    UDPSock() {m_sd = -1;}
+    UDPSock() {m_sd = -1; m_gso_enabled = false;}
     
     // Destructor - Closes the socket
     ~UDPSock() {close();}
 
+#if __cplusplus >= 201103L
+    // A socket owns its descriptor, so it can be moved but not copied
+    UDPSock(const UDPSock& rhs) = delete;
+    UDPSock& operator=(const UDPSock& rhs) = delete;
+
+    // Move constructor and move assignment.  The object moved from is left closed
+    UDPSock(UDPSock&& rhs) {m_sd = -1; m_gso_enabled = false; move_object(rhs);}
+    UDPSock& operator=(UDPSock&& rhs) {move_object(rhs); return *this;}
+#endif
+
     // Create a socket that we will send UDP packets on.
     bool    create_broadcaster(int port, std::string dest, int family = AF_INET);
 
@@ -30,6 +106,27 @@ public:
     // Create a socket that we will use to receive UDP packets
     bool    create_server(int port, std::string bind_to = "", int family = AF_UNSPEC);
 
+    // Create a socket that sends to a multicast group.  'iface' is the name of the interface to send on
+    // ("eth0", etc), or "" to let the kernel choose
+    bool    create_multicast_sender(int port, std::string group, std::string iface = "", int ttl = 1, 
+                                    bool loopback = true);
+
+    // Create a socket that receives multicast packets sent to 'port'.  If 'group' isn't empty, it is
+    // joined.  Any number of other groups may be joined afterwards with join_group()
+    bool    create_multicast_receiver(int port, std::string group = "", std::string iface = "", 
+                                      int family = AF_INET);
+
+    // Call these to start or stop receiving packets sent to a multicast group.  'iface' is the name of the
+    // interface to receive on, or "" to let the kernel choose
+    bool    join_group(std::string group, std::string iface = "");
+    bool    leave_group(std::string group, std::string iface = "");
+
+    // Call this to set how many routers a multicast packet we send may cross.  1 = The local network only
+    bool    set_multicast_ttl(int ttl);
+
+    // Call this to control whether multicast packets we send are delivered to receivers on this machine
+    bool    set_multicast_loopback(bool flag);
+
     // Closes the socket
     void    close();
 
@@ -42,15 +139,97 @@ public:
     // Call this to wait for a UDP packet to arrive
     int     receive(void* buffer, int buffer_length, std::string* p_peer_ip = NULL);
 
+    // Call this to wait for a UDP packet to arrive and find out who sent it, without building a string
+    int     receive_from(void* buffer, int buffer_length, udp_peer_t* p_peer);
+
+    // Call this to send a message to a specific peer (i.e., to reply to one returned by receive_from)
+    int     send_to(const void* msg, int length, const udp_peer_t& peer);
+
+    // Call this to receive as many waiting packets as will fit in 'packets[]' with as few system calls as
+    // possible.  Waits for the first one.  Returns the number received, 0 on timeout, or -1 on error
+    int     receive_batch(udp_packet_t* packets, int count, int timeout_ms = -1);
+
+    // Call this to send a list of packets with as few system calls as possible.  Returns the number of
+    // packets that were sent, or -1 if none could be sent
+    int     send_batch(const udp_packet_t* packets, int count);
+
+    // Call this to have the kernel timestamp packets as they arrive, with nanosecond resolution
+    bool    enable_rx_timestamps(bool flag);
+
+    // Waits for a packet and fetches the time the kernel received it (CLOCK_REALTIME, or the network
+    // card's clock if it timestamps packets).  Returns the number of bytes in the packet, or -1 on error
+    int     receive_timestamped(void* buffer, int buf_size, timespec* p_rx_time, udp_peer_t* p_peer = NULL);
+
+    // Call this to have the kernel report when each packet we send leaves the host.  Sends are numbered
+    // from 0, starting with the first one after this call
+    bool    enable_tx_timestamps(bool flag);
+
+    // Fetches the transmit timestamp of a sent packet, waiting up to 'timeout_ms' for one.  Returns false
+    // if none are available
+    bool    get_tx_timestamp(uint32_t* p_id, timespec* p_tx_time, int timeout_ms = 0);
+
+    // Call this to allow send_at() to schedule packets.  The interface needs the "fq" or "etf" queueing
+    // discipline for the schedule to be honored; otherwise packets go out immediately
+    bool    enable_txtime(int clock_id = CLOCK_MONOTONIC);
+
+    // Sends a message no earlier than 'tx_time_ns', in nanoseconds of the clock given to enable_txtime()
+    int     send_at(const void* msg, int length, uint64_t tx_time_ns);
+
+    // Call this to have the kernel split send_segmented() buffers into datagrams (UDP_SEGMENT).  Returns
+    // false if the kernel can't, in which case send_segmented() splits them itself
+    bool    enable_gso(bool flag);
+
+    // Sends a buffer as a series of datagrams that are 'segment_size' bytes long (the last one may be
+    // shorter).  Returns the number of bytes sent, or -1 on error
+    int     send_segmented(const void* buffer, int length, int segment_size);
+
+    // Call this to allow the kernel to coalesce arriving datagrams from the same peer (UDP_GRO).  Returns
+    // false if the kernel can't
+    bool    enable_gro(bool flag);
+
+    // Receives one (possibly coalesced) read into 'buffer' and splits it back into datagrams.  The
+    // entries of 'packets[]' point into 'buffer', which should be 65536 bytes long.  Returns the number
+    // of datagrams, 0 on timeout, or -1 on error
+    int     receive_coalesced(void* buffer, int buf_size, udp_packet_t* packets, int count, int timeout_ms = -1);
+
     // Returns the socket descriptor of this socket
     int     get_sd() {return m_sd;}
 
 protected:
 
+    // Takes ownership of another object's socket, leaving that object closed
+    void    move_object(UDPSock& rhs);
+
+    // The number of packets we hand to recvmmsg()/sendmmsg() at a time
+    enum {BATCH_SIZE = 64};
+
+    // These do the work of receive_batch() and send_batch() one packet at a time, for systems that
+    // don't have recvmmsg() and sendmmsg()
+    int     receive_each(udp_packet_t* packets, int count, int flags);
+    int     send_each(const udp_packet_t* packets, int count);
+
+    // The most datagrams the kernel will split a single UDP_SEGMENT send into, and the largest send
+    enum {GSO_MAX_SEGMENTS = 64, MAX_UDP_PAYLOAD = 65507};
+
+    // Sends a buffer with a single UDP_SEGMENT send.  Returns false if the kernel couldn't do it
+    bool    send_gso(const char* buffer, int length, int segment_size);
+
+    // Sends a buffer as a series of separate datagrams
+    bool    send_segments(const char* buffer, int length, int segment_size);
+
+    // Returns the address family of our socket, or AF_UNSPEC if it isn't open
+    int     socket_family();
+
+    // Joins or leaves a multicast group
+    bool    change_membership(std::string group, std::string iface, bool join);
+
     // The file descriptor
     int        m_sd;
 
     // The address IP address/port/etc of the UDP target
     addrinfo_t m_target;
+
+    // True if send_segmented() should let the kernel split buffers into datagrams
+    bool       m_gso_enabled;
 };
 //==========================================================================================================